@@ -0,0 +1,74 @@
+/**
+ * @defgroup ARRAYVIEW Array views
+ * @brief Non-owning, possibly strided, views on contiguous memory
+ *
+ * The photometry functions read the wavelength and flux values through raw
+ * pointers. A `cphot::ArrayView` wraps any existing buffer (`std::vector`,
+ * `DMatrix`, memory-mapped file, column of a larger matrix) so that it can be
+ * integrated without being copied into an `xt::xarray` first.
+ *
+ * ```cpp
+ * std::vector<double> wavelength, flux;
+ * auto f = filter.get_flux(cphot::ArrayView<double>(wavelength),
+ *                          cphot::ArrayView<double>(flux), nm, flam);
+ * // one column of a (n_wavelength, n_spectra) row major buffer
+ * cphot::ArrayView<float> column(buffer + s, n_wavelength, n_spectra);
+ * ```
+ *
+ * C++17 equivalent of `std::span<const T>` with a stride.
+ */
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <xtensor/xarray.hpp>
+
+namespace cphot {
+
+/**
+ * @ingroup ARRAYVIEW
+ * @brief Pointer with a constant stride (in elements)
+ *
+ * Same indexing and arithmetic as `const T*` as far as the kernels are
+ * concerned (see `cphot::kernels`).
+ */
+template <typename T>
+struct StridedPointer {
+    const T* ptr = nullptr;         ///< first element
+    std::ptrdiff_t stride = 1;      ///< distance between consecutive elements
+
+    const T& operator[](size_t i) const { return this->ptr[static_cast<std::ptrdiff_t>(i) * this->stride]; }
+    StridedPointer operator+(size_t i) const {
+        return {this->ptr + static_cast<std::ptrdiff_t>(i) * this->stride, this->stride};
+    }
+};
+
+/**
+ * @ingroup ARRAYVIEW
+ * @brief Read-only view on n elements spaced by a stride
+ *
+ * The view does not own the data, which must outlive it.
+ */
+template <typename T>
+class ArrayView {
+    public:
+        ArrayView(const T* data, size_t size, std::ptrdiff_t stride=1)
+            : ptr(data), n(size), step(stride) {}
+        ArrayView(const std::vector<T>& values)
+            : ptr(values.data()), n(values.size()) {}
+        ArrayView(const xt::xarray<T, xt::layout_type::row_major>& values)
+            : ptr(values.data()), n(values.size()) {}
+
+        size_t size() const { return this->n; }
+        const T* data() const { return this->ptr; }
+        std::ptrdiff_t stride() const { return this->step; }
+        bool is_contiguous() const { return this->step == 1; }
+        const T& operator[](size_t i) const { return this->ptr[static_cast<std::ptrdiff_t>(i) * this->step]; }
+        StridedPointer<T> strided_data() const { return {this->ptr, this->step}; }
+
+    private:
+        const T* ptr = nullptr;         ///< first element
+        size_t n = 0;                   ///< number of elements
+        std::ptrdiff_t step = 1;        ///< distance between consecutive elements
+};
+
+} // namespace cphot
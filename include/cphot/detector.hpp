@@ -0,0 +1,106 @@
+/**
+ * @defgroup DETECTOR Detector types
+ * @brief Photon and energy counting detectors as compile-time tags
+ *
+ * Photon counting detectors (CCDs) weight the integrals of the flux by
+ * \f$\lambda\f$, energy counting detectors (bolometers) do not.
+ *
+ * The kernels and integration policies are templated on the tags
+ * `cphot::PhotonCounter` and `cphot::EnergyCounter`, so that the weighting is
+ * resolved at compile time and never branches in the inner loops. The kernels
+ * only use `Detector::weight(λ)`, so that any tag with the same members (see
+ * `cphot::DensityWeighting`) can stand for a detector.
+ * `cphot::Filter` stores its detector as a `cphot::DetectorType` and
+ * dispatches once per call (e.g., filters loaded from a library), while
+ * `cphot::TypedFilter` fixes it in its type:
+ *
+ * ```cpp
+ * cphot::TypedFilter<cphot::PhotonCounter> filter(wavelength, transmission, nm, "B");
+ * ```
+ */
+#pragma once
+#include <stdexcept>
+#include <string>
+
+namespace cphot {
+
+/**
+ * @ingroup DETECTOR
+ * @brief Type of detector
+ */
+enum class DetectorType { photon, energy };
+
+/**
+ * @ingroup DETECTOR
+ * @brief Integer power of a wavelength
+ *
+ * @tparam Power    exponent (negative powers are one division)
+ * @param x         wavelength
+ * @return x^Power (exactly x for Power = 1 and 1 for Power = 0)
+ */
+template <int Power>
+constexpr double wavelength_power(double x){
+    if constexpr (Power < 0){
+        return 1. / wavelength_power<-Power>(x);
+    } else if constexpr (Power == 0){
+        return 1.;
+    } else if constexpr (Power == 1){
+        return x;
+    } else {
+        return x * wavelength_power<Power - 1>(x);
+    }
+}
+
+/**
+ * @ingroup DETECTOR
+ * @brief Photon counting detector: integrands weighted by λ
+ */
+struct PhotonCounter {
+    static constexpr DetectorType type = DetectorType::photon;
+    static constexpr bool photon = true;
+    static constexpr const char* name = "photon";
+    static constexpr int power = 1;     ///< power of λ in the weight
+    static constexpr double weight(double x){ return x; }
+};
+
+/**
+ * @ingroup DETECTOR
+ * @brief Energy counting detector: unweighted integrands
+ */
+struct EnergyCounter {
+    static constexpr DetectorType type = DetectorType::energy;
+    static constexpr bool photon = false;
+    static constexpr const char* name = "energy";
+    static constexpr int power = 0;     ///< power of λ in the weight
+    static constexpr double weight(double /* x */){ return 1.; }
+};
+
+/**
+ * @ingroup DETECTOR
+ * @brief Detector type from its name
+ *
+ * @param dtype  "photon" or "energy"
+ * @return DetectorType
+ * @throw std::runtime_error if detector type is invalid
+ */
+DetectorType parse_detector_type(const std::string& dtype){
+    if (dtype.compare(PhotonCounter::name) == 0){
+        return DetectorType::photon;
+    } else if (dtype.compare(EnergyCounter::name) == 0){
+        return DetectorType::energy;
+    }
+    throw std::runtime_error("only photon and energy allowed");
+}
+
+/**
+ * @ingroup DETECTOR
+ * @brief Name of a detector type
+ *
+ * @param type  detector type
+ * @return "photon" or "energy"
+ */
+std::string to_string(DetectorType type){
+    return (type == DetectorType::photon) ? PhotonCounter::name : EnergyCounter::name;
+}
+
+} // namespace cphot
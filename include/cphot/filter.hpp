@@ -15,21 +15,78 @@
  */
 #pragma once
 #include "rquantities.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <exception>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <regex>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <xtensor/xadapt.hpp>
 #include <xtensor/xarray.hpp>
+#include "array_view.hpp"
+#include "detector.hpp"
+#include "flux_density.hpp"
+#include "hash.hpp"
+#include "integration.hpp"
+#include "interpolate.hpp"
+#include "kernels.hpp"
+#include "quantity_array.hpp"
+#include "spectrum.hpp"
 #include "vega.hpp"
+#include "wavelength_grid.hpp"
 
 /** \ingroup FILTER
  */
 namespace cphot {
 
 using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
+using FMatrix = xt::xarray<float, xt::layout_type::row_major>;
+
+/**
+ * @ingroup FILTER
+ * @brief Integration weights of a filter on a given wavelength grid.
+ *
+ * The flux of a spectrum `f` defined on that grid is
+ * `sum_i values[i] * f[offset + i]`.
+ */
+struct GridWeights {
+    size_t offset = 0;            ///< index of the first non-zero weight on the grid
+    std::vector<double> values;   ///< normalized weights (empty if no overlap)
+};
+
+/**
+ * @ingroup FILTER
+ * @brief Usage of the wavelength grid cache of a filter (see `Filter::get_flux`).
+ */
+struct GridCacheStats {
+    size_t hits = 0;        ///< calls that reused a resampled transmission
+    size_t misses = 0;      ///< calls that resampled the transmission
+    size_t size = 0;        ///< number of grids in the cache
+    size_t capacity = 0;    ///< maximum number of grids (0: disabled)
+};
+
+/**
+ * @ingroup FILTER
+ * @brief How `Filter::get_flux` integrates a spectrum.
+ */
+enum class IntegrationMode {
+    //! resample the filter on the spectrum and use the trapezoidal rule
+    trapezoid,
+    //! resample the filter on the spectrum and use the composite Simpson rule
+    simpson,
+    //! integrate the product of the piecewise-linear filter and spectrum exactly
+    exact_linear
+};
 
 /**
  * @ingroup FILTER
@@ -39,44 +96,170 @@ using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
  * Define a filter by its name, wavelength and transmission The type of
  * detector (energy or photon counter) can be specified for adapting
  * calculations. (default: photon)
+ *
+ * The passband data are immutable and shared between copies of a filter, so
+ * that copying or storing filters in containers does not copy any array.
+ *
+ * Thread safety: every const member function (all the getters and
+ * `get_flux` variants) can be called concurrently on the same filter, or on
+ * copies sharing its data, without external locking. The properties that
+ * integrate Vega are computed once under `std::call_once`, and the
+ * wavelength and grid caches are guarded by their own mutexes (as is
+ * `clear_grid_cache`). Assigning to, destroying or changing the settings
+ * (`set_grid_cache_capacity`) of a `Filter` object while another thread
+ * uses that same object is a data race, as for any standard type; copies
+ * have their own settings.
  */
 class Filter {
     private:
         static constexpr double c = speed_of_light.to(angstrom / second);
         static constexpr double h = 6.62607015e-27;  // erg/s
 
-        //! wavelength of the filter stored in nm
-        DMatrix wavelength_nm;
-        //! transmission of the passband
-        DMatrix transmission;
-        //! name of the filter
-        std::string name = "";
-        //! type, either photon or energy
-        std::string dtype = "photon";
+        /**
+         * @brief Properties that require integrating the Vega spectrum.
+         *
+         * They are computed on first access only.
+         */
+        struct SEDProperties {
+            std::once_flag computed;       ///< guards the one-time calculation
+            double lphot = 0;              ///< Photon distribution based effective wavelength in nm
+            double leff = 0;               ///< Effective wavelength in nm
+            double vega_zero_flux = 0;     ///< Vega flux in flam
+        };
+
+        /**
+         * @brief Filter wavelength converted to the units of the callers.
+         *
+         * Each unit is converted once, the oldest unit is dropped beyond
+         * `max_units`.
+         */
+        struct WavelengthCache {
+            static constexpr size_t max_units = 4;    ///< number of units kept
+            std::mutex lock;                          ///< guards the entries
+            //! conversion factor from nm and converted wavelength
+            std::vector<std::pair<double, std::shared_ptr<const DMatrix>>> entries;
+        };
+
+        /**
+         * @brief Transmission of the filter resampled on a spectrum wavelength.
+         *
+         * Only the window of the grid that sees the filter is kept (see
+         * `Filter::get_support_window`).
+         */
+        struct ResampledGrid {
+            double convfac = 1;                 ///< conversion from nm to the grid unit
+            int power = 0;                      ///< power of λ in the weight w
+            size_t n_wave = 0;                  ///< number of points of the grid
+            size_t start = 0;                   ///< first point of the window
+            std::vector<double> wavelength;     ///< grid values within the window
+            std::vector<double> transmission;   ///< w T on the window
+            double denominator = 0;             ///< int w T dλ
+        };
+
+        /**
+         * @brief Resampled transmissions of the most recently used grids.
+         *
+         * Indexed by a fingerprint of the grid and shared by the copies of
+         * the filter. Each handle that enables the cache drops the least
+         * recently used grid beyond its own capacity when it adds one.
+         */
+        struct GridCache {
+            std::mutex lock;                                ///< guards the entries
+            std::atomic<size_t> hits {0};                   ///< verified lookups
+            std::atomic<size_t> misses {0};                 ///< resamplings
+            //! fingerprint and resampled grid, most recently used first
+            std::list<std::pair<uint64_t, std::shared_ptr<const ResampledGrid>>> entries;
+            //! position of the fingerprints in entries
+            std::unordered_map<uint64_t, decltype(entries)::iterator> index;
+        };
+
+        /**
+         * @brief Passband definition and its properties.
+         *
+         * Immutable once constructed and shared between copies of the filter,
+         * which makes copies and moves O(1) and keeps a single copy of the
+         * data in memory. The lazily evaluated parts guard themselves.
+         */
+        struct FilterData {
+            //! wavelength of the filter stored in nm
+            DMatrix wavelength_nm;
+            //! transmission of the passband
+            DMatrix transmission;
+            //! name of the filter
+            std::string name = "";
+            //! type of detector, photon or energy counter
+            DetectorType detector = DetectorType::photon;
+            //! Central wavelength in nm
+            double cl = 0;
+            //! pivot wavelength in nm
+            double lpivot = 0;
+            //! minimum wavelength in nm
+            double lmin = 0;
+            //! maximum wavelength in nm
+            double lmax = 0;
+            //! norm of the passband
+            double norm = 0;
+            //! effective width in nm
+            double width = 0;
+            //! full width at half maximum in nm
+            double fwhm = 0;
+            //! Internal int λ * transmission * dλ
+            double lT = 0;
+            //! first knot of the nonzero support of the transmission
+            size_t support_first = 0;
+            //! last knot of the nonzero support of the transmission
+            size_t support_last = 0;
+            //! lazily evaluated SED dependent properties
+            mutable SEDProperties sed_properties;
+            //! converted wavelength definitions
+            mutable WavelengthCache wavelength_cache;
+            //! transmissions resampled on recent spectrum wavelengths
+            mutable GridCache grid_cache;
+        };
+
+        //! shared passband data
+        std::shared_ptr<const FilterData> data;
         //! units of the wavelength (nm by construction)
         QLength wavelength_unit = nm;
-        //! Central wavelength in nm
-        double cl;
-        //! pivot wavelength in nm
-        double lpivot;
-        //! minimum wavelength in nm
-        double lmin;
-        //! maximum wavelength in nm
-        double lmax;
-        //! norm of the passband
-        double norm;
-        //! effective width in nm
-        double width;
-        //! full width at half maximum in nm
-        double fwhm;
-        //! Photon distribution based effective wavelength.
-        double lphot = 0;
-        //! Effective wavelength
-        double leff = 0;
-        //! Internal int λ * transmission * dλ
-        double lT;
-
-        void calculate_sed_independent_properties();
+        //! grids this handle keeps in the grid cache (0: cache not used)
+        size_t grid_cache_capacity = 0;
+
+        static void calculate_sed_independent_properties(FilterData& data);
+        void calculate_sed_dependent_properties() const;
+        const SEDProperties& get_sed_properties() const;
+        std::shared_ptr<const DMatrix> get_cached_wavelength(const QLength& wavelength_unit) const;
+        std::pair<size_t, size_t> get_support_window(const double* wavelength,
+                                                     size_t n_wave,
+                                                     const QLength& wavelength_unit) const;
+        static uint64_t grid_fingerprint(const double* wavelength, size_t n_wave,
+                                         double convfac, int power);
+        template <typename Detector>
+        std::shared_ptr<const ResampledGrid> get_resampled_grid(const double* wavelength,
+                                                                size_t n_wave,
+                                                                const QLength& wavelength_unit) const;
+        template <typename Func>
+        void for_each_grid_transmission(const WavelengthGrid& grid, Func&& func) const;
+        static GridWeights normalized_grid_weights(size_t offset,
+                                                   const std::vector<double>& values);
+        template <typename Func>
+        auto dispatch_detector(Func&& func) const -> decltype(func(PhotonCounter()));
+        template <typename Func>
+        auto dispatch_weighting(FluxDensityType flux_type, Func&& func) const -> decltype(func(PhotonCounter()));
+
+    protected:
+        template <typename Integration, typename Detector, typename Flux>
+        QSpectralFluxDensity integrate_flux(const double* wavelength,
+                                            size_t n_wave,
+                                            Flux flux,
+                                            const QLength& wavelength_unit,
+                                            const QSpectralFluxDensity& flux_unit) const;
+        template <typename Integration, typename Detector, typename Flux>
+        QSpectralFluxDensity integrate_flux(const double* wavelength,
+                                            size_t n_wave,
+                                            Flux flux,
+                                            const QLength& wavelength_unit,
+                                            const QSpectralFluxDensity& flux_unit,
+                                            integration::Workspace& workspace) const;
 
     public:
         Filter(const DMatrix& wavelength,
@@ -84,45 +267,102 @@ class Filter {
                const QLength& wavelength_unit,
                const std::string dtype,
                const std::string name);
-        void info();
+        void info() const;
+
+        std::string get_name() const { return this->data->name;}
+        double get_norm() const;
+        QLength get_leff() const;
+        QLength get_lphot() const;
+        QLength get_fwhm() const;
+        QLength get_width() const;
+        QLength get_lmax() const;
+        QLength get_lmin() const;
+        QLength get_lpivot() const;
+        QLength get_cl() const;
 
-        std::string get_name(){ return this->name;}
-        double get_norm();
-        QLength get_leff();
-        QLength get_lphot();
-        QLength get_fwhm();
-        QLength get_width();
-        QLength get_lmax();
-        QLength get_lmin();
-        QLength get_lpivot();
-        QLength get_cl();
+        double get_AB_zero_mag() const;
+        QSpectralFluxDensity get_AB_zero_flux() const;
+        QSpectralFluxDensity get_AB_zero_Jy() const;
 
-        double get_AB_zero_mag();
-        QSpectralFluxDensity get_AB_zero_flux();
-        QSpectralFluxDensity get_AB_zero_Jy();
+        double get_ST_zero_mag() const;
+        QSpectralFluxDensity get_ST_zero_flux() const;
+        QSpectralFluxDensity get_ST_zero_Jy() const;
 
-        double get_ST_zero_mag();
-        QSpectralFluxDensity get_ST_zero_flux();
-        QSpectralFluxDensity get_ST_zero_Jy();
+        double get_Vega_zero_mag() const;
+        QSpectralFluxDensity get_Vega_zero_flux() const;
+        QSpectralFluxDensity get_Vega_zero_Jy() const;
 
-        double get_Vega_zero_mag();
-        QSpectralFluxDensity get_Vega_zero_flux();
-        QSpectralFluxDensity get_Vega_zero_Jy();
+        const DMatrix& get_wavelength() const;
+        DMatrix get_wavelength(const QLength& in) const;
+        const DMatrix& get_transmission() const;
 
-        DMatrix get_wavelength();
-        DMatrix get_wavelength(const QLength& in);
-        DMatrix get_transmission();
+        bool is_photon_type() const;
+        DetectorType get_detector_type() const { return this->data->detector; }
+        //! first and last knots of the nonzero support of the transmission
+        std::pair<size_t, size_t> get_support_knots() const {
+            return {this->data->support_first, this->data->support_last};
+        }
+        std::string get_dtype() const { return to_string(this->data->detector); }
 
-        bool is_photon_type();
+        GridCacheStats get_grid_cache_stats() const;
+        //! enable the grid cache for this handle (off by default; per handle, the grids are shared)
+        void set_grid_cache_capacity(size_t capacity);
+        //! drop the grids and counters shared by every copy of the filter
+        void clear_grid_cache();
 
         QSpectralFluxDensity get_flux(const DMatrix& wavelength,
                                       const DMatrix& flux,
                                       const QLength& wavelength_unit,
-                                      const QSpectralFluxDensity& flux_unit);
+                                      const QSpectralFluxDensity& flux_unit,
+                                      IntegrationMode mode=IntegrationMode::trapezoid,
+                                      FluxDensityType flux_type=FluxDensityType::flam) const;
+        template <typename Integration=integration::Trapezoid, typename T=double>
+        QSpectralFluxDensity get_flux(const DMatrix& wavelength,
+                                      const xt::xarray<T, xt::layout_type::row_major>& flux,
+                                      const QLength& wavelength_unit,
+                                      const QSpectralFluxDensity& flux_unit,
+                                      FluxDensityType flux_type=FluxDensityType::flam) const;
+        template <typename Integration=integration::Trapezoid, typename T=double>
+        QSpectralFluxDensity get_flux(const ArrayView<double>& wavelength,
+                                      const ArrayView<T>& flux,
+                                      const QLength& wavelength_unit,
+                                      const QSpectralFluxDensity& flux_unit,
+                                      FluxDensityType flux_type=FluxDensityType::flam) const;
+        template <typename Integration=integration::Trapezoid, typename T=double>
+        QSpectralFluxDensity get_flux(const ArrayView<double>& wavelength,
+                                      const ArrayView<T>& flux,
+                                      const QLength& wavelength_unit,
+                                      const QSpectralFluxDensity& flux_unit,
+                                      FluxDensityType flux_type,
+                                      integration::Workspace& workspace) const;
+        template <typename Integration=integration::Trapezoid, typename T=double>
+        QSpectralFluxDensity get_flux(const QuantityArray<QLength>& wavelength,
+                                      const QuantityArray<QSpectralFluxDensity, T>& flux,
+                                      FluxDensityType flux_type=FluxDensityType::flam) const;
+        QSpectralFluxDensity get_flux(const Spectrum& spectrum) const;
+        template <typename T=double>
+        QSpectralFluxDensity get_flux(const WavelengthGrid& grid,
+                                      const xt::xarray<T, xt::layout_type::row_major>& flux,
+                                      const QSpectralFluxDensity& flux_unit,
+                                      FluxDensityType flux_type=FluxDensityType::flam) const;
+        template <typename Integration=integration::Trapezoid>
+        GridWeights get_grid_weights(const DMatrix& wavelength,
+                                     const QLength& wavelength_unit,
+                                     FluxDensityType flux_type=FluxDensityType::flam) const;
+        GridWeights get_grid_weights(const WavelengthGrid& grid,
+                                     FluxDensityType flux_type=FluxDensityType::flam) const;
+        template <typename Integration=integration::Trapezoid, typename Acc=double, typename T=double>
+        std::vector<QSpectralFluxDensity> get_flux_batch(
+                                      const DMatrix& wavelength,
+                                      const xt::xarray<T, xt::layout_type::row_major>& flux,
+                                      const QLength& wavelength_unit,
+                                      const QSpectralFluxDensity& flux_unit,
+                                      FluxDensityType flux_type=FluxDensityType::flam) const;
 
-        Filter reinterp(const DMatrix& new_wavelength_nm);
+        Filter reinterp(const DMatrix& new_wavelength_nm) const;
         Filter reinterp(const DMatrix& new_wavelength,
-                        const QLength& new_wavelength_unit);
+                        const QLength& new_wavelength_unit) const;
+        Filter reinterp(const WavelengthGrid& grid) const;
 };
 
 /**
@@ -134,6 +374,8 @@ class Filter {
  * @param dtype            "photon" or "energy"
  * @param name             name of the passband
  * @throw std::runtime_error if detector type is invalid
+ *
+ * The definition is sorted by increasing wavelength if it is not already.
  */
 Filter::Filter(const DMatrix& wavelength,
                const DMatrix& transmission,
@@ -141,18 +383,29 @@ Filter::Filter(const DMatrix& wavelength,
                const std::string dtype,
                const std::string name){
     double convfac = wavelength_unit.to(nanometre);
-    this->wavelength_nm = convfac * wavelength;
+    auto data = std::make_shared<FilterData>();
+    data->wavelength_nm = convfac * wavelength;
+    data->name = name;
+    data->transmission = transmission;
     this->wavelength_unit = nm;
-    this->name = name;
-    this->transmission = transmission;
 
-    if ((dtype.compare("photon") == 0) ||
-        (dtype.compare("energy") == 0)){
-        this->dtype = dtype;
-    } else {
-        throw std::runtime_error("only photon and energy allowed");
+    // all the calculations walk the passband in increasing wavelength
+    const size_t n_points = data->wavelength_nm.size();
+    if (! interpolate::is_sorted(data->wavelength_nm.data(), n_points)){
+        std::vector<size_t> order(n_points);
+        for (size_t i = 0; i < n_points; ++i){ order[i] = i; }
+        std::stable_sort(order.begin(), order.end(), [&wavelength](size_t a, size_t b){
+            return wavelength[a] < wavelength[b];
+        });
+        for (size_t i = 0; i < n_points; ++i){
+            data->wavelength_nm[i] = convfac * wavelength[order[i]];
+            data->transmission[i] = transmission[order[i]];
+        }
     }
-    this->calculate_sed_independent_properties();
+
+    data->detector = parse_detector_type(dtype);
+    calculate_sed_independent_properties(*data);
+    this->data = data;
 }
 
 /**
@@ -163,7 +416,7 @@ Filter::Filter(const DMatrix& wavelength,
  * @return std::ostream&  same as os
  */
 std::ostream & operator<<(std::ostream &os,
-                          Filter &F){
+                          const Filter &F){
     os << "Filter: " << F.get_name()
        << "\n";
     return os;
@@ -175,28 +428,33 @@ std::ostream & operator<<(std::ostream &os,
  * These properties are e.g., fwhm, pivot wavelength.
  * Those that do not require to consider an SED such as Vega.
  */
-void Filter::calculate_sed_independent_properties(){
+void Filter::calculate_sed_independent_properties(FilterData& data){
     // Calculate Filter properties
-    const auto& wavelength_nm = this->wavelength_nm;
-    const auto& transmission = this->transmission;
+    const auto& wavelength_nm = data.wavelength_nm;
+    const auto& transmission = data.transmission;
 
     size_t n_points = transmission.size();
     double transmission_max = xt::amax(transmission)[0];
     double transmission_max_100th = transmission_max / 100.;
 
-    auto norm = xt::trapz(transmission, wavelength_nm)[0];
-    auto _lT = xt::trapz(wavelength_nm * transmission, wavelength_nm)[0];
+    // the passband properties are defined with the trapezoidal rule
+    using Integration = integration::Trapezoid;
+    auto trapz = [&wavelength_nm, n_points](const DMatrix& y){
+        return Integration::integrate(wavelength_nm.data(), y.data(), n_points);
+    };
+    auto norm = trapz(transmission);
+    auto _lT = trapz(wavelength_nm * transmission);
     auto _cl = norm > 0 ? _lT / norm : 0.;
-    this->cl = _cl;
-    this->norm = norm;
-    this->lT = _lT;
+    data.cl = _cl;
+    data.norm = norm;
+    data.lT = _lT;
     double lpivot2 = 0.;
-    if (this->dtype.compare("photon") == 0){
-        lpivot2 = _lT / trapz(transmission / wavelength_nm, wavelength_nm)[0];
+    if (data.detector == DetectorType::photon){
+        lpivot2 = _lT / trapz(transmission / wavelength_nm);
     } else {
-        lpivot2 = norm / trapz(transmission / xt::square(wavelength_nm), wavelength_nm)[0];
+        lpivot2 = norm / trapz(transmission / xt::square(wavelength_nm));
     }
-    this->lpivot = std::sqrt(lpivot2);
+    data.lpivot = std::sqrt(lpivot2);
 
     // the last value with a transmission at least 1% of maximum transmission
     double lmax = wavelength_nm[0];
@@ -208,15 +466,30 @@ void Filter::calculate_sed_independent_properties(){
             lmin = std::min(lmin, wavelength_nm[i]);
         }
     }
-    this->lmin = lmin;
-    this->lmax = lmax;
+    data.lmin = lmin;
+    data.lmax = lmax;
+
+    // nonzero support: the transmission vanishes outside of the knots that
+    // surround the first and last nonzero values
+    size_t first_nonzero = n_points;
+    size_t last_nonzero = 0;
+    for (size_t i=0; i < n_points; ++i){
+        if (transmission[i] != 0.){
+            first_nonzero = std::min(first_nonzero, i);
+            last_nonzero = i;
+        }
+    }
+    if (first_nonzero <= last_nonzero){
+        data.support_first = (first_nonzero > 0) ? first_nonzero - 1 : 0;
+        data.support_last = std::min(last_nonzero + 1, n_points - 1);
+    }
 
     // Effective width
     // Equivalent to the horizontal size of a rectangle with height equal
     // to maximum transmission and with the same area that the one covered by
     // the filter transmission curve.
     // W = int(T dlamb) / max(T)
-    this->width = (norm / xt::amax(transmission)[0]);
+    data.width = (norm / xt::amax(transmission)[0]);
 
     // FWHM
     // the difference between the two wavelengths for which filter transmission is
@@ -226,7 +499,7 @@ void Filter::calculate_sed_independent_properties(){
     //      This calculation is not exact but rounded to the nearest passband data
     //      points
     double first = wavelength_nm[0];
-    double last = wavelength_nm[-1];
+    double last = wavelength_nm[wavelength_nm.size() - 1];
     double thresh = transmission_max * 0.5;
     for (size_t i=0; i < wavelength_nm.size() - 1; ++i){
         if((transmission[i+1] > thresh) and (transmission[i] <= thresh)){
@@ -234,25 +507,323 @@ void Filter::calculate_sed_independent_properties(){
             break;
         }
     }
-    for (size_t i=wavelength_nm.size(); i > 1; --i){
+    for (size_t i=wavelength_nm.size() - 1; i > 1; --i){
         if((transmission[i-1] > thresh) and (transmission[i] <= thresh)){
             last = wavelength_nm[i];
             break;
         }
     }
-    this->fwhm = last - first;
+    data.fwhm = last - first;
+}
+
+/**
+ * @brief Calculate the properties of the filter that depend on the Vega spectrum.
+ *
+ * These are the effective and photon wavelengths and the Vega zero point.
+ * This is called only once through `Filter::get_sed_properties`.
+ */
+void Filter::calculate_sed_dependent_properties() const {
+    SEDProperties& props = this->data->sed_properties;
+
+    // integrals of λ^p T Vega dλ from the cumulative integrals of the shared
+    // Vega spectrum (no interpolation over the entire Vega grid)
+    auto vega = get_reference_spectrum("vega");
+    const DMatrix& wave = this->data->wavelength_nm;
+    const DMatrix& trans = this->data->transmission;
+    double vega_T0 = vega->moment(wave, trans, 0);
+    double vega_T1 = vega->moment(wave, trans, 1);
+    double vega_T2 = vega->moment(wave, trans, 2);
 
     // leff = int (lamb * T * Vega dlamb) / int(T * Vega dlamb)
-    auto vega = Vega();
-    const DMatrix& vega_wavelength = vega.get_wavelength(nm);
-    const DMatrix& vega_flux = vega.get_flux(flam);
-    auto vega_T = xt::interp(vega_wavelength, this->get_wavelength(nm), this->get_transmission(), 0., 0.);
-    this->leff =  xt::trapz(vega_wavelength * vega_T * vega_flux, vega_wavelength)[0] /
-                  xt::trapz(vega_T * vega_flux, vega_wavelength)[0];
+    props.leff =  vega_T1 / vega_T0;
 
     // lphot = int(lamb ** 2 * T * Vega dlamb) / int(lamb * T * Vega dlamb)
-    this->lphot = xt::trapz(xt::square(vega_wavelength) * vega_T * vega_flux, vega_wavelength)[0] /
-                  xt::trapz(vega_wavelength * vega_T * vega_flux, vega_wavelength)[0];
+    props.lphot = vega_T2 / vega_T1;
+
+    props.vega_zero_flux = this->get_flux(*vega).to(flam);
+}
+
+/**
+ * @brief Access the SED dependent properties, computing them on first call.
+ *
+ * Concurrent callers are safe: the calculation runs exactly once and the
+ * other callers wait for it to complete.
+ *
+ * @return the SED dependent properties
+ */
+const Filter::SEDProperties& Filter::get_sed_properties() const {
+    std::call_once(this->data->sed_properties.computed,
+                   [this](){ this->calculate_sed_dependent_properties(); });
+    return this->data->sed_properties;
+}
+
+/**
+ * @brief Filter wavelength in a given unit, converted once per unit
+ *
+ * Used by the photometry functions instead of
+ * `Filter::get_wavelength(const QLength&)`, which converts on every call.
+ * The values are the same (same products), so are the results.
+ *
+ * @param wavelength_unit   unit of the wavelength
+ * @return wavelength definition in that unit
+ */
+std::shared_ptr<const DMatrix> Filter::get_cached_wavelength(const QLength& wavelength_unit) const {
+    const double convfac = nm.to(wavelength_unit);
+    if (convfac == 1.){
+        // shares the ownership of the filter data
+        return std::shared_ptr<const DMatrix>(this->data, &(this->data->wavelength_nm));
+    }
+    WavelengthCache& cache = this->data->wavelength_cache;
+    std::lock_guard<std::mutex> guard(cache.lock);
+    for (const auto& entry: cache.entries){
+        if (entry.first == convfac){
+            return entry.second;
+        }
+    }
+    auto converted = std::make_shared<const DMatrix>(this->data->wavelength_nm * convfac);
+    if (cache.entries.size() >= WavelengthCache::max_units){
+        cache.entries.erase(cache.entries.begin());
+    }
+    cache.entries.emplace_back(convfac, converted);
+    return converted;
+}
+
+/**
+ * @brief Range of points of a wavelength definition that see the filter
+ *
+ * The transmission interpolated on the wavelength is zero outside of
+ * [start, end), and so are the trapezoids outside of that range. The range
+ * includes the neighbors of the support, whose trapezoids are partially
+ * covered. Costs two binary searches.
+ *
+ * @param wavelength        wavelength values (sorted)
+ * @param n_wave            number of wavelength values
+ * @param wavelength_unit   wavelength unit
+ * @return [start, end) indices in wavelength (empty if no overlap)
+ */
+std::pair<size_t, size_t> Filter::get_support_window(const double* wavelength,
+                                                     size_t n_wave,
+                                                     const QLength& wavelength_unit) const {
+    if (this->data->support_last <= this->data->support_first){
+        return {0, 0};
+    }
+    const double convfac = nm.to(wavelength_unit);
+    const double support_min = this->data->wavelength_nm[this->data->support_first] * convfac;
+    const double support_max = this->data->wavelength_nm[this->data->support_last] * convfac;
+    const double* end = wavelength + n_wave;
+    const size_t lower = std::lower_bound(wavelength, end, support_min) - wavelength;
+    const size_t upper = std::upper_bound(wavelength, end, support_max) - wavelength;
+    if ((lower >= n_wave) || (upper == 0)){
+        return {0, 0};
+    }
+    return {(lower > 0) ? lower - 1 : 0, std::min(upper + 1, n_wave)};
+}
+
+/**
+ * @brief Fingerprint of a wavelength definition
+ *
+ * Hash of the length, the unit, the endpoints and 16 evenly spaced values,
+ * i.e., independent of the length of the grid, and of the weighting of the
+ * integrals. Grids with the same fingerprint are compared value by value
+ * before being reused.
+ *
+ * @param wavelength    wavelength values
+ * @param n_wave        number of wavelength values
+ * @param convfac       conversion factor from nm to the wavelength unit
+ * @param power         power of λ in the weight of the integrals
+ * @return 64-bit FNV-1a hash (see `cphot::Fnv1a`)
+ */
+uint64_t Filter::grid_fingerprint(const double* wavelength, size_t n_wave,
+                                  double convfac, int power){
+    Fnv1a hash;
+    hash.add(n_wave);
+    hash.add(convfac);
+    hash.add(power);
+    constexpr size_t n_samples = 16;
+    for (size_t s = 0; (n_wave > 0) && (s < n_samples); ++s){
+        hash.add(wavelength[s * (n_wave - 1) / (n_samples - 1)]);
+    }
+    return hash.value;
+}
+
+/**
+ * @brief Transmission resampled on a wavelength definition, from the grid cache
+ *
+ * A cached grid is reused only if its window holds the same values as the
+ * wavelength: on sorted grids, the points outside of the window cannot see
+ * the filter, so that the integrals are the same. Otherwise the transmission
+ * is resampled and the least recently used grid is dropped if the cache is
+ * full.
+ *
+ * @tparam Detector         detector (or weighting) tag, see `cphot::Weighting`
+ * @param wavelength        wavelength values (sorted)
+ * @param n_wave            number of wavelength values
+ * @param wavelength_unit   wavelength unit
+ * @return resampled grid (nullptr if the wavelength does not overlap the filter)
+ */
+template <typename Detector>
+std::shared_ptr<const Filter::ResampledGrid> Filter::get_resampled_grid(
+    const double* wavelength,
+    size_t n_wave,
+    const QLength& wavelength_unit) const {
+    GridCache& cache = this->data->grid_cache;
+    const double convfac = nm.to(wavelength_unit);
+    const uint64_t key = grid_fingerprint(wavelength, n_wave, convfac, Detector::power);
+
+    std::shared_ptr<const ResampledGrid> grid;
+    {
+        std::lock_guard<std::mutex> guard(cache.lock);
+        const auto found = cache.index.find(key);
+        if (found != cache.index.end()){
+            cache.entries.splice(cache.entries.begin(), cache.entries, found->second);
+            grid = found->second->second;
+        }
+    }
+    if (grid && (grid->n_wave == n_wave) && (grid->convfac == convfac)
+        && (grid->power == Detector::power)
+        && std::equal(grid->wavelength.begin(), grid->wavelength.end(), wavelength + grid->start)){
+        ++cache.hits;
+        return grid;
+    }
+
+    const auto window = this->get_support_window(wavelength, n_wave, wavelength_unit);
+    ++cache.misses;
+    if (window.second < window.first + 2) {
+        return nullptr;
+    }
+    const auto filt_wave = this->get_cached_wavelength(wavelength_unit);
+    const size_t first = this->data->support_first;
+    const size_t n_knots = this->data->support_last - first + 1;
+    auto resampled = std::make_shared<ResampledGrid>();
+    resampled->convfac = convfac;
+    resampled->power = Detector::power;
+    resampled->n_wave = n_wave;
+    resampled->start = window.first;
+    resampled->wavelength.assign(wavelength + window.first, wavelength + window.second);
+    resampled->transmission.resize(resampled->wavelength.size());
+    resampled->denominator = kernels::resample_weighted_transmission<Detector>(
+        resampled->wavelength.data(), resampled->wavelength.size(),
+        filt_wave->data() + first, this->data->transmission.data() + first, n_knots,
+        resampled->transmission.data());
+
+    std::lock_guard<std::mutex> guard(cache.lock);
+    const size_t capacity = this->grid_cache_capacity;
+    if (capacity == 0){
+        return resampled;
+    }
+    const auto found = cache.index.find(key);
+    if (found != cache.index.end()){
+        cache.entries.erase(found->second);
+        cache.index.erase(found);
+    }
+    while (cache.entries.size() >= capacity){
+        cache.index.erase(cache.entries.back().first);
+        cache.entries.pop_back();
+    }
+    cache.entries.emplace_front(key, resampled);
+    cache.index[key] = cache.entries.begin();
+    return resampled;
+}
+
+/**
+ * @brief Usage of the wavelength grid cache
+ *
+ * The grids and counters are shared by the copies of the filter, the
+ * capacity is that of this handle.
+ *
+ * @return hits, misses, number of grids and capacity
+ */
+GridCacheStats Filter::get_grid_cache_stats() const {
+    GridCache& cache = this->data->grid_cache;
+    std::lock_guard<std::mutex> guard(cache.lock);
+    GridCacheStats stats;
+    stats.hits = cache.hits;
+    stats.misses = cache.misses;
+    stats.size = cache.entries.size();
+    stats.capacity = this->grid_cache_capacity;
+    return stats;
+}
+
+/**
+ * @brief Set the number of wavelength grids kept by the grid cache
+ *
+ * The cache is off by default: each grid keeps a copy of the window of the
+ * wavelength that sees the filter and the resampled transmission (16 bytes
+ * per point), for every filter, which adds up quickly for large libraries
+ * and high resolution spectra. Enable it on the filters that integrate many
+ * spectra sharing a few wavelength definitions.
+ *
+ * The capacity is a setting of this handle (copies made afterwards inherit
+ * it), a capacity of 0 stops this handle from using the cache without
+ * affecting the others. The grids themselves are shared by the copies of
+ * the filter: with a non-zero capacity, the least recently used grids are
+ * dropped if the cache holds more.
+ *
+ * @param capacity  maximum number of grids (0: cache not used)
+ */
+void Filter::set_grid_cache_capacity(size_t capacity){
+    this->grid_cache_capacity = capacity;
+    if (capacity == 0){
+        return;
+    }
+    GridCache& cache = this->data->grid_cache;
+    std::lock_guard<std::mutex> guard(cache.lock);
+    while (cache.entries.size() > capacity){
+        cache.index.erase(cache.entries.back().first);
+        cache.entries.pop_back();
+    }
+}
+
+/**
+ * @brief Drop the grids of the grid cache and reset its counters
+ *
+ * The grids and counters are shared: this applies to every copy of the
+ * filter (the capacities are unchanged).
+ */
+void Filter::clear_grid_cache(){
+    GridCache& cache = this->data->grid_cache;
+    std::lock_guard<std::mutex> guard(cache.lock);
+    cache.entries.clear();
+    cache.index.clear();
+    cache.hits = 0;
+    cache.misses = 0;
+}
+
+/**
+ * @brief Visit the points of a grid within the filter support
+ *
+ * Calls `func(i, T_i)` with the transmission interpolated at every point of
+ * the grid within the support, in increasing order. The points covered by
+ * each segment of the passband are located with `WavelengthGrid::lower_bound`
+ * (arithmetic on regular grids) and the transmission is linear in between,
+ * so the inner loop does not search.
+ *
+ * @param grid  wavelength grid
+ * @param func  callable (size_t, double)
+ */
+template <typename Func>
+void Filter::for_each_grid_transmission(const WavelengthGrid& grid, Func&& func) const {
+    if (this->data->support_last <= this->data->support_first){
+        return;
+    }
+    const double convfac = nm.to(grid.get_wavelength_unit());
+    const double* x = grid.data();
+    for (size_t k = this->data->support_first; k < this->data->support_last; ++k){
+        const double x0 = this->data->wavelength_nm[k] * convfac;
+        const double x1 = this->data->wavelength_nm[k + 1] * convfac;
+        // points in [x0, x1), the last segment also includes x1
+        const size_t start = grid.lower_bound(x0);
+        const size_t end = (k + 1 == this->data->support_last) ? grid.upper_bound(x1)
+                                                          : grid.lower_bound(x1);
+        if ((end <= start) || (x1 <= x0)){
+            continue;
+        }
+        const double beta = (this->data->transmission[k + 1] - this->data->transmission[k]) / (x1 - x0);
+        const double alpha = this->data->transmission[k] - beta * x0;
+        for (size_t i = start; i < end; ++i){
+            func(i, alpha + beta * x[i]);
+        }
+    }
 }
 
 /**
@@ -263,10 +834,10 @@ void Filter::calculate_sed_independent_properties(){
  *
  * @return AB magnitude zero point
  */
-double Filter::get_AB_zero_mag(){
+double Filter::get_AB_zero_mag() const {
     double C1 = (this->wavelength_unit).to(angstrom);
     C1 = C1 * C1 / speed_of_light.to(angstrom / second);
-    C1 = this->lpivot * this->lpivot * C1;
+    C1 = this->data->lpivot * this->data->lpivot * C1;
     return 2.5 * std::log10(C1) + 48.60;
 }
 
@@ -278,7 +849,7 @@ double Filter::get_AB_zero_mag(){
  *
  * @return AB flux zero point
  */
-QSpectralFluxDensity Filter::get_AB_zero_flux(){
+QSpectralFluxDensity Filter::get_AB_zero_flux() const {
     return std::pow(10, -0.4 * this->get_AB_zero_mag()) * flam;
 }
 
@@ -292,7 +863,7 @@ QSpectralFluxDensity Filter::get_AB_zero_flux(){
  *
  * @return AB flux zero point in Jansky (Jy)
  */
-QSpectralFluxDensity Filter::get_AB_zero_Jy(){
+QSpectralFluxDensity Filter::get_AB_zero_Jy() const {
         double c = 1e-8 * speed_of_light.to(meter / second);
         double f = 1e5 / c * std::pow(this->get_lpivot().to(angstrom), 2) * this->get_AB_zero_flux().to(flam);
         return f * Jy;
@@ -305,7 +876,7 @@ QSpectralFluxDensity Filter::get_AB_zero_Jy(){
  *
  * @return ST magnitude zero point
  */
-double Filter::get_ST_zero_mag(){
+double Filter::get_ST_zero_mag() const {
     return 21.1;    // definition
 }
 
@@ -317,7 +888,7 @@ double Filter::get_ST_zero_mag(){
  *
  * @return ST flux in flam
  */
-QSpectralFluxDensity Filter::get_ST_zero_flux(){
+QSpectralFluxDensity Filter::get_ST_zero_flux() const {
     return std::pow(10, -0.4 * this->get_ST_zero_mag()) * flam;
 }
 
@@ -331,7 +902,7 @@ QSpectralFluxDensity Filter::get_ST_zero_flux(){
  *
  * @return ST flux in Jy
  */
-QSpectralFluxDensity Filter::get_ST_zero_Jy(){
+QSpectralFluxDensity Filter::get_ST_zero_Jy() const {
         double c = 1e-8 * speed_of_light.to(meter / second);
         double f = 1e5 / c * std::pow(this->get_lpivot().to(angstrom), 2) * this->get_ST_zero_flux().to(flam);
         return f * Jy;
@@ -342,22 +913,19 @@ QSpectralFluxDensity Filter::get_ST_zero_Jy(){
  *
  * @return Vega magnitude zero point
  */
-double Filter::get_Vega_zero_mag(){
+double Filter::get_Vega_zero_mag() const {
     return -2.5 * std::log10(this->get_Vega_zero_flux().to(flam));
 }
 
 /**
  * @brief  Vega flux zero point
  *
+ * Computed once on first access.
+ *
  * @return flux of Vega in flam (erg/s/cm^2/Angstrom)
  */
-QSpectralFluxDensity Filter::get_Vega_zero_flux(){
-    Vega v = Vega();
-    double flux_flam = this->get_flux(
-        v.get_wavelength(nm),
-        v.get_flux(flam),
-        nm, flam).to(flam);
-    return flux_flam * flam;
+QSpectralFluxDensity Filter::get_Vega_zero_flux() const {
+    return this->get_sed_properties().vega_zero_flux * flam;
 }
 
 /**
@@ -370,7 +938,7 @@ QSpectralFluxDensity Filter::get_Vega_zero_flux(){
  *
  * @return flux of Vega in Jy
  */
-QSpectralFluxDensity Filter::get_Vega_zero_Jy(){
+QSpectralFluxDensity Filter::get_Vega_zero_Jy() const {
         double c = 1e-8 * speed_of_light.to(meter / second);
         double f = 1e5 / c * std::pow(this->get_lpivot().to(angstrom), 2) * this->get_Vega_zero_flux().to(flam);
         return f * Jy;
@@ -379,8 +947,20 @@ QSpectralFluxDensity Filter::get_Vega_zero_Jy(){
 /**
  * @brief Integrate the flux within the filter and return the integrated energy/flux
  *
- * The filter is first interpolated on the spectrum wavelength definition.
- * The flux is then calculated as the integral of the flux within the filter depending on the detector type as:
+ * The filter is interpolated on the spectrum wavelength definition and the
+ * integrals are evaluated on the fly by `cphot::kernels::fused_flux_integrals`
+ * over the points that fall within the support of the filter only.
+ * The filter definition is converted to the wavelength unit once per unit
+ * and kept with the filter, so that repeated calls do not allocate.
+ *
+ * With the trapezoidal rule and the grid cache enabled (see
+ * `Filter::set_grid_cache_capacity`, off by default), the transmission
+ * resampled on the last wavelength definitions is kept with the filter.
+ * Spectra on a known wavelength only
+ * cost a comparison of the wavelength values and a weighted sum of the flux,
+ * with bit-identical results (see `cphot::kernels::cached_flux_numerator`).
+ * `Filter::get_grid_cache_stats` counts the hits and misses.
+ * The flux is calculated as the integral of the flux within the filter depending on the detector type as:
  *
  * - for photon detectors:
  * \f[
@@ -392,10 +972,21 @@ QSpectralFluxDensity Filter::get_Vega_zero_Jy(){
  * f_\lambda = \frac{\int T(\lambda) f_\lambda d\lambda}{\int T(\lambda) d\lambda}
  * \f]
  *
+ * The integration rule is selected at runtime with `mode`, see
+ * `cphot::integration` for the rules and the template version of this
+ * function to select them at compile time.
+ *
+ * Spectra per unit frequency or in photons (`flux_type`) are integrated as
+ * they are, with the conversion to \f$f_\lambda\f$ folded into the weight
+ * of the integrals, and the flux is returned in the same units (see
+ * `cphot::FluxDensityType`).
+ *
  * @param wavelength        wavelength array
  * @param flux              flux array
  * @param wavelength_unit   wavelength unit
  * @param flux_unit         flux unit
+ * @param mode              integration mode (default: trapezoid)
+ * @param flux_type         flux density type of the spectrum (default: flam)
  * @return integrated flux through the filter
  *
  */
@@ -403,34 +994,530 @@ QSpectralFluxDensity Filter::get_flux(
     const DMatrix& wavelength,
     const DMatrix& flux,
     const QLength& wavelength_unit,
-    const QSpectralFluxDensity& flux_unit) {
-    //filter on wavelength units
-    const DMatrix& filt_wave = this->get_wavelength(wavelength_unit);
-    const DMatrix& filt_trans = this->get_transmission();
+    const QSpectralFluxDensity& flux_unit,
+    IntegrationMode mode,
+    FluxDensityType flux_type) const {
+    switch (mode){
+        case IntegrationMode::simpson:
+            return this->get_flux<integration::Simpson>(
+                wavelength, flux, wavelength_unit, flux_unit, flux_type);
+        case IntegrationMode::exact_linear:
+            return this->get_flux<integration::ExactLinear>(
+                wavelength, flux, wavelength_unit, flux_unit, flux_type);
+        default:
+            return this->get_flux<integration::Trapezoid>(
+                wavelength, flux, wavelength_unit, flux_unit, flux_type);
+    }
+}
+
+/**
+ * @brief Integrate the flux within the filter with a given integration rule
+ *
+ * Same as `Filter::get_flux` with the rule resolved at compile time, e.g.,
+ * `filter.get_flux<cphot::integration::Simpson>(wavelength, flux, nm, flam)`.
+ *
+ * With `integration::ExactLinear`, the filter is not resampled: both
+ * the filter and the spectrum are taken as piecewise linear and the integrals
+ * of their product are exact over the range covered by both (see
+ * `cphot::kernels::exact_linear_flux_integrals`). This gives stable fluxes
+ * for spectra that are coarser than the filter, at a cost of
+ * O(n_filter + n_overlap).
+ *
+ * The flux can be stored in single precision (`cphot::FMatrix`), the
+ * integrals are always accumulated in double precision (see
+ * `cphot::kernels`). The relative difference with the double precision flux
+ * is then bounded by the rounding of the flux values, \f$2^{-24} \approx
+ * 6\times10^{-8}\f$, for positive spectra.
+ *
+ * @tparam Integration      integration policy (default: trapezoid)
+ * @tparam T                storage type of the flux (double or float)
+ * @param wavelength        wavelength array
+ * @param flux              flux array
+ * @param wavelength_unit   wavelength unit
+ * @param flux_unit         flux unit
+ * @param flux_type         flux density type of the spectrum (default: flam)
+ * @return integrated flux through the filter
+ * @throw std::runtime_error if the sizes differ
+ */
+template <typename Integration, typename T>
+QSpectralFluxDensity Filter::get_flux(
+    const DMatrix& wavelength,
+    const xt::xarray<T, xt::layout_type::row_major>& flux,
+    const QLength& wavelength_unit,
+    const QSpectralFluxDensity& flux_unit,
+    FluxDensityType flux_type) const {
+    if (flux.size() != wavelength.size()){
+        throw std::runtime_error("flux must be defined on the wavelength");
+    }
+    return this->dispatch_weighting(flux_type, [&](auto weighting){
+        return this->template integrate_flux<Integration, decltype(weighting)>(
+            wavelength.data(), wavelength.size(), flux.data(), wavelength_unit, flux_unit);
+    });
+}
+
+/**
+ * @brief Integrate the flux of spectra held in existing buffers
+ *
+ * Same as `Filter::get_flux` on views (see `cphot::ArrayView`), e.g., on
+ * `std::vector`, memory-mapped data or a strided column of a larger array.
+ * Nothing is copied.
+ *
+ * @tparam Integration      integration policy (default: trapezoid)
+ * @tparam T                storage type of the flux (double or float)
+ * @param wavelength        wavelength view (sorted, contiguous)
+ * @param flux              flux view (any stride)
+ * @param wavelength_unit   wavelength unit
+ * @param flux_unit         flux unit
+ * @param flux_type         flux density type of the spectrum (default: flam)
+ * @return integrated flux through the filter
+ * @throw std::runtime_error if the wavelength is strided or the sizes differ
+ */
+template <typename Integration, typename T>
+QSpectralFluxDensity Filter::get_flux(
+    const ArrayView<double>& wavelength,
+    const ArrayView<T>& flux,
+    const QLength& wavelength_unit,
+    const QSpectralFluxDensity& flux_unit,
+    FluxDensityType flux_type) const {
+    if (! wavelength.is_contiguous()){
+        throw std::runtime_error("wavelength must be contiguous");
+    }
+    if (flux.size() != wavelength.size()){
+        throw std::runtime_error("flux must be defined on the wavelength");
+    }
+    return this->dispatch_weighting(flux_type, [&](auto weighting){
+        using Detector = decltype(weighting);
+        if (flux.is_contiguous()){
+            return this->template integrate_flux<Integration, Detector>(
+                wavelength.data(), wavelength.size(), flux.data(), wavelength_unit, flux_unit);
+        }
+        return this->template integrate_flux<Integration, Detector>(
+            wavelength.data(), wavelength.size(), flux.strided_data(), wavelength_unit, flux_unit);
+    });
+}
+
+/**
+ * @brief Integrate the flux of a spectrum on its own wavelength grid
+ *
+ * Same as `Filter::get_flux` on views, for spectra that do not share their
+ * wavelength (e.g., observed spectra): the grid cache is skipped, and the
+ * temporary values of the integration use the buffers of workspace, so that
+ * a workspace reused across spectra stops allocating memory. The values are
+ * those of `Filter::get_flux` with the grid cache disabled (see
+ * `Filter::set_grid_cache_capacity`).
+ *
+ * @tparam Integration      integration policy
+ * @tparam T                storage type of the flux (double or float)
+ * @param wavelength        wavelength view (sorted, contiguous)
+ * @param flux              flux view (any stride)
+ * @param wavelength_unit   wavelength unit
+ * @param flux_unit         flux unit
+ * @param flux_type         flux density type of the spectrum
+ * @param workspace         scratch buffers (not shared between threads)
+ * @return integrated flux through the filter
+ * @throw std::runtime_error if the wavelength is strided or the sizes differ
+ */
+template <typename Integration, typename T>
+QSpectralFluxDensity Filter::get_flux(
+    const ArrayView<double>& wavelength,
+    const ArrayView<T>& flux,
+    const QLength& wavelength_unit,
+    const QSpectralFluxDensity& flux_unit,
+    FluxDensityType flux_type,
+    integration::Workspace& workspace) const {
+    if (! wavelength.is_contiguous()){
+        throw std::runtime_error("wavelength must be contiguous");
+    }
+    if (flux.size() != wavelength.size()){
+        throw std::runtime_error("flux must be defined on the wavelength");
+    }
+    return this->dispatch_weighting(flux_type, [&](auto weighting){
+        using Detector = decltype(weighting);
+        if (flux.is_contiguous()){
+            return this->template integrate_flux<Integration, Detector>(
+                wavelength.data(), wavelength.size(), flux.data(), wavelength_unit, flux_unit, workspace);
+        }
+        return this->template integrate_flux<Integration, Detector>(
+            wavelength.data(), wavelength.size(), flux.strided_data(), wavelength_unit, flux_unit, workspace);
+    });
+}
+
+/**
+ * @brief Integrate the flux of a spectrum given as quantity arrays
+ *
+ * Same as `Filter::get_flux` with the units carried by the arrays (see
+ * `cphot::QuantityArray`). The units are applied as conversion factors during
+ * the integration, the values are not scaled or copied. Swapping the
+ * wavelength and the flux does not compile.
+ *
+ * @tparam Integration      integration policy (default: trapezoid)
+ * @tparam T                storage type of the flux (double or float)
+ * @param wavelength        wavelength array (sorted)
+ * @param flux              flux array
+ * @param flux_type         flux density type of the spectrum (default: flam)
+ * @return integrated flux through the filter
+ * @throw std::runtime_error if the sizes differ
+ */
+template <typename Integration, typename T>
+QSpectralFluxDensity Filter::get_flux(
+    const QuantityArray<QLength>& wavelength,
+    const QuantityArray<QSpectralFluxDensity, T>& flux,
+    FluxDensityType flux_type) const {
+    if (flux.size() != wavelength.size()){
+        throw std::runtime_error("flux must be defined on the wavelength");
+    }
+    return this->get_flux<Integration, T>(wavelength.get_values(), flux.get_values(),
+                                          wavelength.get_unit(), flux.get_unit(), flux_type);
+}
 
-    // Check overlaps
-    if ((xt::amin(filt_wave)[0] > xt::amax(wavelength)[0])
-        || (xt::amax(filt_wave)[0] < xt::amin(wavelength)[0])) {
+/**
+ * @brief Integrate the flux within the filter for a given detector type
+ *
+ * Implementation of `Filter::get_flux`, with the detector weighting resolved
+ * at compile time (see `cphot::TypedFilter`).
+ *
+ * @tparam Integration      integration policy
+ * @tparam Detector         detector (or weighting) tag, see `cphot::Weighting`
+ * @tparam Flux             pointer to the flux values (`const T*` or `StridedPointer<T>`)
+ * @param wavelength        wavelength values (sorted)
+ * @param n_wave            number of wavelength (and flux) values
+ * @param flux              flux values
+ * @param wavelength_unit   wavelength unit
+ * @param flux_unit         flux unit
+ * @return integrated flux through the filter
+ */
+template <typename Integration, typename Detector, typename Flux>
+QSpectralFluxDensity Filter::integrate_flux(
+    const double* wavelength,
+    size_t n_wave,
+    Flux flux,
+    const QLength& wavelength_unit,
+    const QSpectralFluxDensity& flux_unit) const {
+    if (std::is_same<Integration, integration::Trapezoid>::value
+        && (this->grid_cache_capacity > 0)){
+        const auto grid = this->get_resampled_grid<Detector>(wavelength, n_wave, wavelength_unit);
+        if ((! grid) || (grid->denominator <= 0)){
+            return 0. * flux_unit;
+        }
+        const double numerator = kernels::cached_flux_numerator(
+            grid->wavelength.data(), flux + grid->start,
+            grid->transmission.data(), grid->wavelength.size());
+        return numerator / grid->denominator * flux_unit;
+    }
+    integration::Workspace workspace;
+    return this->template integrate_flux<Integration, Detector, Flux>(
+        wavelength, n_wave, flux, wavelength_unit, flux_unit, workspace);
+}
+
+/**
+ * @brief Integrate the flux within the filter without the grid cache
+ *
+ * Resamples the filter on the spectrum points within its support, using the
+ * buffers of workspace for the temporary values of the integration policy.
+ *
+ * @tparam Integration      integration policy
+ * @tparam Detector         detector (or weighting) tag, see `cphot::Weighting`
+ * @tparam Flux             pointer to the flux values (`const T*` or `StridedPointer<T>`)
+ * @param wavelength        wavelength values (sorted)
+ * @param n_wave            number of wavelength (and flux) values
+ * @param flux              flux values
+ * @param wavelength_unit   wavelength unit
+ * @param flux_unit         flux unit
+ * @param workspace         scratch buffers
+ * @return integrated flux through the filter
+ */
+template <typename Integration, typename Detector, typename Flux>
+QSpectralFluxDensity Filter::integrate_flux(
+    const double* wavelength,
+    size_t n_wave,
+    Flux flux,
+    const QLength& wavelength_unit,
+    const QSpectralFluxDensity& flux_unit,
+    integration::Workspace& workspace) const {
+    // only the points within the filter support contribute
+    const auto window = this->get_support_window(wavelength, n_wave, wavelength_unit);
+    if (window.second < window.first + 2) {
         return 0. * flux_unit;
     }
 
-    // reinterpolate the transmission to the spectrum wavelength
-    auto new_trans = xt::interp(wavelength, filt_wave, filt_trans, 0., 0.);
+    //filter on wavelength units (converted once per unit)
+    const auto filt_wave_units = this->get_cached_wavelength(wavelength_unit);
+    const DMatrix& filt_wave = *filt_wave_units;
+    const size_t first = this->data->support_first;
+    const size_t n_knots = this->data->support_last - first + 1;
+
+    const double* x = wavelength + window.first;
+    const Flux f = flux + window.first;
+    const size_t n = window.second - window.first;
+    const double* xp = filt_wave.data() + first;
+    const double* fp = this->data->transmission.data() + first;
+
+    const kernels::FluxIntegrals integrals = Integration::template flux_integrals<Detector>(
+        x, f, n, xp, fp, n_knots, workspace);
 
     // check transmission is not null everywhere
-    if (! xt::any(new_trans > 0)){
+    if (integrals.denominator <= 0){
         return 0. * flux_unit;
     }
-    // Calculate the flux depending on detector type
-    if (this->is_photon_type()){
-        double a = xt::trapz(wavelength * new_trans * flux, wavelength)[0];
-        double b = xt::trapz(wavelength * new_trans, wavelength)[0];
-        return a / b * flux_unit;
-    } else {
-        double a = xt::trapz(new_trans * flux, wavelength)[0];
-        double b = xt::trapz(new_trans, wavelength)[0];
+    return integrals.numerator / integrals.denominator * flux_unit;
+}
+
+/**
+ * @brief Integrate the flux of a Spectrum within the filter
+ *
+ * Same definition as `Filter::get_flux` on the spectrum arrays. The integrals
+ * are evaluated with `Spectrum::moment`, i.e., one binary search per filter
+ * knot when the spectrum has its moment index (see `Spectrum::build_index`),
+ * which makes the cost independent of the length of the spectrum.
+ *
+ * @param spectrum  spectrum to integrate
+ * @return integrated flux through the filter
+ */
+QSpectralFluxDensity Filter::get_flux(const Spectrum& spectrum) const {
+    const size_t power = this->is_photon_type() ? 1 : 0;
+    double a = spectrum.moment(this->data->wavelength_nm, this->data->transmission, power);
+    double b = spectrum.moment(this->data->wavelength_nm, this->data->transmission, power, false);
+    if (b <= 0){
+        return 0. * flam;
+    }
+    return a / b * flam;
+}
+
+/**
+ * @brief Integrate the flux of a spectrum defined on a wavelength grid
+ *
+ * Same definition as `Filter::get_flux`. On uniform and log-uniform grids,
+ * the points within the filter are located arithmetically and the trapezoid
+ * weights are constant or geometric (see `cphot::WavelengthGrid`).
+ *
+ * @tparam T          storage type of the flux (double or float)
+ * @param grid        wavelength grid
+ * @param flux        flux array on the grid
+ * @param flux_unit   flux unit
+ * @param flux_type   flux density type of the spectrum (default: flam)
+ * @return integrated flux through the filter
+ * @throw std::runtime_error if the flux does not match the grid
+ */
+template <typename T>
+QSpectralFluxDensity Filter::get_flux(const WavelengthGrid& grid,
+                                      const xt::xarray<T, xt::layout_type::row_major>& flux,
+                                      const QSpectralFluxDensity& flux_unit,
+                                      FluxDensityType flux_type) const {
+    if (flux.size() != grid.size()){
+        throw std::runtime_error("flux must be defined on the wavelength grid");
+    }
+    const double* x = grid.data();
+    const T* f = flux.data();
+    return this->dispatch_weighting(flux_type, [&](auto weighting){
+        using Detector = decltype(weighting);
+        double a = 0.;
+        double b = 0.;
+        this->for_each_grid_transmission(grid, [&](size_t i, double t){
+            const double w = grid.trapezoid_weight(i) * t;
+            const double wt = Detector::weight(x[i]) * w;
+            a += wt * static_cast<double>(f[i]);
+            b += wt;
+        });
+        if (b <= 0){
+            return 0. * flux_unit;
+        }
         return a / b * flux_unit;
+    });
+}
+
+/**
+ * @brief Normalized integration weights of the filter on a wavelength grid
+ *
+ * The filter is interpolated on the grid and folded with the trapezoidal
+ * weights \f$\delta\lambda_i = (\lambda_{i+1} - \lambda_{i-1}) / 2\f$ into
+ *
+ * - for photon detectors:
+ * \f[ w_i = \frac{\lambda_i T(\lambda_i) \delta\lambda_i}{\sum_j \lambda_j T(\lambda_j) \delta\lambda_j} \f]
+ *
+ * - for energy detectors:
+ * \f[ w_i = \frac{T(\lambda_i) \delta\lambda_i}{\sum_j T(\lambda_j) \delta\lambda_j} \f]
+ *
+ * such that the flux of any spectrum on that grid is \f$\sum_i w_i f_i\f$,
+ * i.e., the same as `Filter::get_flux`.
+ * Only the range where the weights are non zero is stored.
+ *
+ * Other integration rules replace \f$\delta\lambda_i\f$ by their own
+ * weights (see `cphot::integration`). The weights are computed on the
+ * wavelength values directly; the overload taking a `cphot::WavelengthGrid`
+ * uses the fast paths of regular grids. For spectra per unit frequency or in
+ * photons, the \f$\lambda^{-p}\f$ factor of `flux_type` is folded into
+ * \f$w_i\f$ (see `cphot::FluxDensityType`).
+ *
+ * @tparam Integration      integration policy (default: trapezoid)
+ * @param wavelength        wavelength array (sorted)
+ * @param wavelength_unit   wavelength unit
+ * @param flux_type         flux density type of the spectra (default: flam)
+ * @return weights (empty if the filter does not overlap the grid)
+ * @throw std::runtime_error if the wavelength is not sorted
+ */
+template <typename Integration>
+GridWeights Filter::get_grid_weights(const DMatrix& wavelength,
+                                     const QLength& wavelength_unit,
+                                     FluxDensityType flux_type) const {
+    if (! interpolate::is_sorted(wavelength.data(), wavelength.size())){
+        throw std::runtime_error("wavelength must be sorted");
+    }
+    // only the points within the filter support can have non zero weights
+    const auto window = this->get_support_window(wavelength.data(), wavelength.size(),
+                                                 wavelength_unit);
+    if (window.second < window.first + 2) {
+        return GridWeights();
+    }
+    const auto filt_wave_units = this->get_cached_wavelength(wavelength_unit);
+    const DMatrix& filt_wave = *filt_wave_units;
+    const size_t first = this->data->support_first;
+    const size_t n_knots = this->data->support_last - first + 1;
+    std::vector<double> values(window.second - window.first);
+    this->dispatch_weighting(flux_type, [&](auto weighting){
+        Integration::template grid_weights<decltype(weighting)>(
+            wavelength.data() + window.first, values.size(),
+            filt_wave.data() + first, this->data->transmission.data() + first,
+            n_knots, values.data());
+    });
+    return normalized_grid_weights(window.first, values);
+}
+
+/**
+ * @brief Normalized integration weights of the filter on a wavelength grid
+ *
+ * Same as `Filter::get_grid_weights` on the grid values, with the arithmetic
+ * locations and closed form trapezoid weights of regular grids.
+ *
+ * @param grid       wavelength grid
+ * @param flux_type  flux density type of the spectra (default: flam)
+ * @return weights (empty if the filter does not overlap the grid)
+ */
+GridWeights Filter::get_grid_weights(const WavelengthGrid& grid, FluxDensityType flux_type) const {
+    GridWeights weights;
+    if (grid.size() < 2){
+        return weights;
+    }
+    const double* x = grid.data();
+
+    // weights of the points within the support
+    const double convfac = nm.to(grid.get_wavelength_unit());
+    const size_t window_start = grid.lower_bound(this->data->wavelength_nm[this->data->support_first] * convfac);
+    const size_t window_end = grid.upper_bound(this->data->wavelength_nm[this->data->support_last] * convfac);
+    if (window_end <= window_start){
+        return weights;
+    }
+    std::vector<double> values(window_end - window_start, 0.);
+    this->dispatch_weighting(flux_type, [&](auto weighting){
+        using Detector = decltype(weighting);
+        this->for_each_grid_transmission(grid, [&](size_t i, double t){
+            const double w = grid.trapezoid_weight(i) * t;
+            values[i - window_start] = Detector::weight(x[i]) * w;
+        });
+    });
+
+    return normalized_grid_weights(window_start, values);
+}
+
+/**
+ * @brief Normalize weights and keep only the range where they are non zero
+ *
+ * @param offset    index of values[0] on the grid
+ * @param values    unnormalized weights
+ * @return weights (empty if the weights are all null)
+ */
+GridWeights Filter::normalized_grid_weights(size_t offset,
+                                            const std::vector<double>& values){
+    GridWeights weights;
+    // only keep the range where the kernel is non zero.
+    size_t first = values.size();
+    size_t last = 0;
+    for (size_t i = 0; i < values.size(); ++i){
+        if (values[i] != 0.){
+            first = std::min(first, i);
+            last = i;
+        }
+    }
+    // check transmission is not null everywhere
+    if (first > last){
+        return weights;
+    }
+    weights.offset = offset + first;
+    weights.values.assign(values.begin() + first, values.begin() + last + 1);
+
+    double norm = 0.;
+    for (const auto& w: weights.values){
+        norm += w;
+    }
+    if (norm == 0.){
+        weights.values.clear();
+        return weights;
+    }
+    for (auto & w: weights.values){
+        w /= norm;
+    }
+    return weights;
+}
+
+/**
+ * @brief Integrate many spectra sharing the same wavelength definition
+ *
+ * Same calculation as `Filter::get_flux` but for a block of spectra. The
+ * filter is interpolated only once on the common wavelength grid (see
+ * `Filter::get_grid_weights`) so that each spectrum reduces to one dot
+ * product over the filter support.
+ *
+ * Single precision spectra (`cphot::FMatrix`) halve the memory traffic. With
+ * double accumulators (default), the relative difference with the double
+ * precision fluxes is bounded by the rounding of the flux values,
+ * \f$2^{-24} \approx 6\times10^{-8}\f$, for positive spectra. Single
+ * precision accumulators add up to \f$n\,2^{-24}\f$ for n points within
+ * the filter.
+ *
+ * @tparam Integration      integration policy (default: trapezoid)
+ * @tparam Acc              accumulator type (default: double)
+ * @tparam T                storage type of the flux (double or float)
+ * @param wavelength        wavelength array (n_wavelength)
+ * @param flux              flux array (n_spectra, n_wavelength) in row major order,
+ *                          a 1d array is understood as a single spectrum
+ * @param wavelength_unit   wavelength unit
+ * @param flux_unit         flux unit
+ * @param flux_type         flux density type of the spectra (default: flam)
+ * @return integrated flux through the filter of every spectrum
+ * @throw std::runtime_error if flux and wavelength shapes do not match
+ */
+template <typename Integration, typename Acc, typename T>
+std::vector<QSpectralFluxDensity> Filter::get_flux_batch(
+    const DMatrix& wavelength,
+    const xt::xarray<T, xt::layout_type::row_major>& flux,
+    const QLength& wavelength_unit,
+    const QSpectralFluxDensity& flux_unit,
+    FluxDensityType flux_type) const {
+
+    const size_t n_wave = wavelength.size();
+    const size_t n_spectra = (flux.dimension() == 1) ? 1 : flux.shape()[0];
+    if ((flux.dimension() > 2) || (n_spectra * n_wave != flux.size())) {
+        throw std::runtime_error("flux must be of shape (n_spectra, n_wavelength)");
+    }
+    std::vector<QSpectralFluxDensity> result(n_spectra, 0. * flux_unit);
+
+    const GridWeights weights = this->get_grid_weights<Integration>(wavelength, wavelength_unit,
+                                                                    flux_type);
+    if (weights.values.empty()){
+        return result;
     }
+
+    const T * flux_data = flux.data() + weights.offset;
+    const size_t n_weights = weights.values.size();
+    const std::vector<Acc> w(weights.values.begin(), weights.values.end());
+    for (size_t s = 0; s < n_spectra; ++s){
+        const T * row = flux_data + s * n_wave;
+        Acc a = 0.;
+        for (size_t i = 0; i < n_weights; ++i){
+            a += w[i] * static_cast<Acc>(row[i]);
+        }
+        result[s] = static_cast<double>(a) * flux_unit;
+    }
+    return result;
 }
 
 /**
@@ -439,11 +1526,11 @@ QSpectralFluxDensity Filter::get_flux(
  * @param new_wavelength_nm    wavelength definition in nm
  * @return new filter interpolated to match the new wavelength definition
  */
-Filter Filter::reinterp(const DMatrix& new_wavelength_nm){
+Filter Filter::reinterp(const DMatrix& new_wavelength_nm) const {
     const DMatrix& filt_wave = this->get_wavelength();
     const DMatrix& filt_trans = this->get_transmission();
-    auto new_trans = xt::interp(new_wavelength_nm, filt_wave, filt_trans, 0., 0.);
-    return Filter(new_wavelength_nm, new_trans, nm, this->dtype, this->name);
+    auto new_trans = interpolate::linear(new_wavelength_nm, filt_wave, filt_trans, 0., 0.);
+    return Filter(new_wavelength_nm, new_trans, nm, this->get_dtype(), this->data->name);
 }
 
 /**
@@ -453,32 +1540,47 @@ Filter Filter::reinterp(const DMatrix& new_wavelength_nm){
  * @param new_wavelength_unit  wavelength unit
  * @return new filter interpolated to match the new wavelength definition
  */
-Filter Filter::reinterp(const DMatrix& new_wavelength, const QLength& new_wavelength_unit){
+Filter Filter::reinterp(const DMatrix& new_wavelength, const QLength& new_wavelength_unit) const {
     const DMatrix& filt_wave = this->get_wavelength(new_wavelength_unit);
     const DMatrix& filt_trans = this->get_transmission();
-    auto new_trans = xt::interp(new_wavelength, filt_wave, filt_trans, 0., 0.);
+    auto new_trans = interpolate::linear(new_wavelength, filt_wave, filt_trans, 0., 0.);
     return Filter(new_wavelength, new_trans, new_wavelength_unit,
-                  this->dtype, this->name);
+                  this->get_dtype(), this->data->name);
+}
+
+/**
+ * @brief New filter interpolated to match a wavelength grid
+ *
+ * @param grid    wavelength grid
+ * @return new filter interpolated to match the grid
+ */
+Filter Filter::reinterp(const WavelengthGrid& grid) const {
+    DMatrix new_trans = xt::zeros<double>({grid.size()});
+    this->for_each_grid_transmission(grid, [&new_trans](size_t i, double t){
+        new_trans[i] = t;
+    });
+    return Filter(grid.get_wavelength(), new_trans, grid.get_wavelength_unit(),
+                  this->get_dtype(), this->data->name);
 }
 
 /**
  * @brief Display some information on cout
  */
-void Filter::info(){
-    size_t n_points = this->transmission.size();
+void Filter::info() const {
+    size_t n_points = this->data->transmission.size();
     std::cout << "Filter Object information:\n"
-            << "    name:                 " << this->name << "\n"
-            << "    detector type:        " << this->dtype << "\n"
+            << "    name:                 " << this->data->name << "\n"
+            << "    detector type:        " << this->get_dtype() << "\n"
             << "    wavelength units:     " << "nm  (internally set)" << "\n"
-            << "    central wavelength:   " << this->cl  << " nm" << "\n"
-            << "    pivot wavelength:     " << this->lpivot << " nm" << "\n"
-            << "    effective wavelength: " << this->leff << " nm" << "\n"
-            << "    photon wavelength:    " << this->lphot << " nm" << "\n"
-            << "    minimum wavelength:   " << this->lmin << " nm" << "\n"
-            << "    maximum wavelength:   " << this->lmax << " nm" << "\n"
-            << "    norm:                 " << this->norm << "\n"
-            << "    effective width:      " << this->width << " nm" << "\n"
-            << "    fullwidth half-max:   " << this->fwhm  << " nm" << "\n"
+            << "    central wavelength:   " << this->data->cl  << " nm" << "\n"
+            << "    pivot wavelength:     " << this->data->lpivot << " nm" << "\n"
+            << "    effective wavelength: " << this->get_leff().to(nm) << " nm" << "\n"
+            << "    photon wavelength:    " << this->get_lphot().to(nm) << " nm" << "\n"
+            << "    minimum wavelength:   " << this->data->lmin << " nm" << "\n"
+            << "    maximum wavelength:   " << this->data->lmax << " nm" << "\n"
+            << "    norm:                 " << this->data->norm << "\n"
+            << "    effective width:      " << this->data->width << " nm" << "\n"
+            << "    fullwidth half-max:   " << this->data->fwhm  << " nm" << "\n"
             << "    definition contains " << n_points << " points" << "\n"
             << " \n"
             << "  Zeropoints \n"
@@ -501,7 +1603,7 @@ void Filter::info(){
  *
  * @return central wavelength in nm
  */
-QLength Filter::get_cl(){ return this->cl * this->wavelength_unit;}
+QLength Filter::get_cl() const { return this->data->cl * this->wavelength_unit;}
 
 /**
  * @brief  Pivot wavelength in nm
@@ -514,21 +1616,21 @@ QLength Filter::get_cl(){ return this->cl * this->wavelength_unit;}
  *
  * @return pivot wavelength in nm
  */
-QLength Filter::get_lpivot(){ return this->lpivot * this->wavelength_unit;}
+QLength Filter::get_lpivot() const { return this->data->lpivot * this->wavelength_unit;}
 
 /**
  * @brief the first λ value with a transmission at least 1% of maximum transmission
  *
  * @return min wavelength in nm
  */
-QLength Filter::get_lmin(){ return this->lmin * this->wavelength_unit;}
+QLength Filter::get_lmin() const { return this->data->lmin * this->wavelength_unit;}
 
 /**
  * @brief the last λ value with a transmission at least 1% of maximum transmission
  *
  * @return max wavelength in nm
  */
-QLength Filter::get_lmax(){ return this->lmax * this->wavelength_unit;}
+QLength Filter::get_lmax() const { return this->data->lmax * this->wavelength_unit;}
 
 /**
  * @brief the norm of the passband
@@ -537,7 +1639,7 @@ QLength Filter::get_lmax(){ return this->lmax * this->wavelength_unit;}
  *
  * @return norm
  */
-double Filter::get_norm(){ return this->norm; }
+double Filter::get_norm() const { return this->data->norm; }
 
 /**
  * @brief  Effective width
@@ -546,7 +1648,7 @@ double Filter::get_norm(){ return this->norm; }
  *
  * @return width in nm
  */
-QLength Filter::get_width(){ return this->width * this->wavelength_unit;}
+QLength Filter::get_width() const { return this->data->width * this->wavelength_unit;}
 
 /**
  * @brief the difference between the two wavelengths for which filter
@@ -558,7 +1660,7 @@ QLength Filter::get_width(){ return this->width * this->wavelength_unit;}
  *
  * @return fwhm in nm
  */
-QLength Filter::get_fwhm(){ return this->fwhm * this->wavelength_unit;}
+QLength Filter::get_fwhm() const { return this->data->fwhm * this->wavelength_unit;}
 
 /**
  * @brief Photon distribution based effective wavelength.
@@ -568,7 +1670,7 @@ QLength Filter::get_fwhm(){ return this->fwhm * this->wavelength_unit;}
  *
  * @return QLength
  */
-QLength Filter::get_lphot(){ return this->lphot * this->wavelength_unit;}
+QLength Filter::get_lphot() const { return this->get_sed_properties().lphot * this->wavelength_unit;}
 
 /**
  * @brief Effective wavelength
@@ -577,15 +1679,15 @@ QLength Filter::get_lphot(){ return this->lphot * this->wavelength_unit;}
  *
  * @return Effective wavelenth
  */
-QLength Filter::get_leff(){ return this->leff * this->wavelength_unit;}
+QLength Filter::get_leff() const { return this->get_sed_properties().leff * this->wavelength_unit;}
 
 /**
  * @brief Get the wavelength in nm
  *
  * @return wavelegnth in nm
  */
-DMatrix Filter::get_wavelength() {
-    return this->wavelength_nm;
+const DMatrix& Filter::get_wavelength() const {
+    return this->data->wavelength_nm;
 }
 
 /**
@@ -594,8 +1696,8 @@ DMatrix Filter::get_wavelength() {
  * @param in  units to convert to
  * @return  wavelegnth in requested units
  */
-DMatrix Filter::get_wavelength(const QLength& in) {
-    return this->wavelength_nm * nm.to(in);
+DMatrix Filter::get_wavelength(const QLength& in) const {
+    return this->data->wavelength_nm * nm.to(in);
 }
 
 /**
@@ -603,8 +1705,8 @@ DMatrix Filter::get_wavelength(const QLength& in) {
  *
  * @return Transmission (unitless)
  */
-DMatrix Filter::get_transmission() {
-    return this->transmission;
+const DMatrix& Filter::get_transmission() const {
+    return this->data->transmission;
 }
 
 /**
@@ -613,8 +1715,170 @@ DMatrix Filter::get_transmission() {
  * @return true   photon
  * @return false  energy
  */
-bool Filter::is_photon_type() {
-    return (this->dtype.compare("photon") == 0);
+bool Filter::is_photon_type() const {
+    return (this->data->detector == DetectorType::photon);
+}
+
+/**
+ * @brief Call a function with the detector tag of the filter
+ *
+ * Runtime to compile-time dispatch of the detector type, once per call, so
+ * that the λ weighting does not branch in the loops of `func`.
+ *
+ * @param func  callable on `PhotonCounter` or `EnergyCounter`
+ * @return result of func
+ */
+template <typename Func>
+auto Filter::dispatch_detector(Func&& func) const -> decltype(func(PhotonCounter())) {
+    if (this->is_photon_type()){
+        return func(PhotonCounter());
+    }
+    return func(EnergyCounter());
+}
+
+/**
+ * @brief Call a function with the weighting tag of the filter and a flux density type
+ *
+ * See `Filter::dispatch_detector` and `cphot::dispatch_density`.
+ *
+ * @param flux_type  flux density type of the spectra
+ * @param func       callable on the weighting tags
+ * @return result of func
+ */
+template <typename Func>
+auto Filter::dispatch_weighting(FluxDensityType flux_type,
+                                Func&& func) const -> decltype(func(PhotonCounter())) {
+    return this->dispatch_detector([&](auto detector){
+        return dispatch_density<decltype(detector)>(flux_type, func);
+    });
+}
+
+/**
+ * @ingroup FILTER
+ * @brief Filter with its detector type fixed at compile time.
+ *
+ * Same as `cphot::Filter`, but `get_flux` goes directly to the integration
+ * kernels of the detector without any runtime dispatch.
+ *
+ * ```cpp
+ * cphot::TypedFilter<cphot::PhotonCounter> filter(wavelength, transmission, nm, "B");
+ * auto f = filter.get_flux(wavelength, flux, nm, flam);
+ * ```
+ *
+ * @tparam Detector  `cphot::PhotonCounter` or `cphot::EnergyCounter`
+ */
+template <typename Detector>
+class TypedFilter : public Filter {
+    public:
+        TypedFilter(const DMatrix& wavelength,
+                    const DMatrix& transmission,
+                    const QLength& wavelength_unit,
+                    const std::string name);
+        explicit TypedFilter(const Filter& filter);
+
+        using Filter::get_flux;
+        QSpectralFluxDensity get_flux(const DMatrix& wavelength,
+                                      const DMatrix& flux,
+                                      const QLength& wavelength_unit,
+                                      const QSpectralFluxDensity& flux_unit,
+                                      IntegrationMode mode=IntegrationMode::trapezoid,
+                                      FluxDensityType flux_type=FluxDensityType::flam) const;
+        template <typename Integration=integration::Trapezoid, typename T=double>
+        QSpectralFluxDensity get_flux(const DMatrix& wavelength,
+                                      const xt::xarray<T, xt::layout_type::row_major>& flux,
+                                      const QLength& wavelength_unit,
+                                      const QSpectralFluxDensity& flux_unit,
+                                      FluxDensityType flux_type=FluxDensityType::flam) const;
+};
+
+/**
+ * @brief Construct a new TypedFilter object
+ *
+ * @param wavelength       wavelength definition
+ * @param transmission     transmission on the wavelength
+ * @param wavelength_unit  units of the wavelength definition
+ * @param name             name of the passband
+ */
+template <typename Detector>
+TypedFilter<Detector>::TypedFilter(const DMatrix& wavelength,
+                                   const DMatrix& transmission,
+                                   const QLength& wavelength_unit,
+                                   const std::string name)
+    : Filter(wavelength, transmission, wavelength_unit, Detector::name, name) {}
+
+/**
+ * @brief TypedFilter from a Filter (e.g., loaded from a library)
+ *
+ * @param filter  filter with the same detector type
+ * @throw std::runtime_error if the detector types differ
+ */
+template <typename Detector>
+TypedFilter<Detector>::TypedFilter(const Filter& filter) : Filter(filter) {
+    if (this->get_detector_type() != Detector::type){
+        throw std::runtime_error("detector type of the filter is not " + std::string(Detector::name));
+    }
+}
+
+/**
+ * @brief Integrate the flux within the filter (see `Filter::get_flux`)
+ *
+ * @param wavelength        wavelength array
+ * @param flux              flux array
+ * @param wavelength_unit   wavelength unit
+ * @param flux_unit         flux unit
+ * @param mode              integration mode (default: trapezoid)
+ * @param flux_type         flux density type of the spectrum (default: flam)
+ * @return integrated flux through the filter
+ */
+template <typename Detector>
+QSpectralFluxDensity TypedFilter<Detector>::get_flux(
+    const DMatrix& wavelength,
+    const DMatrix& flux,
+    const QLength& wavelength_unit,
+    const QSpectralFluxDensity& flux_unit,
+    IntegrationMode mode,
+    FluxDensityType flux_type) const {
+    switch (mode){
+        case IntegrationMode::simpson:
+            return this->template get_flux<integration::Simpson>(
+                wavelength, flux, wavelength_unit, flux_unit, flux_type);
+        case IntegrationMode::exact_linear:
+            return this->template get_flux<integration::ExactLinear>(
+                wavelength, flux, wavelength_unit, flux_unit, flux_type);
+        default:
+            return this->template get_flux<integration::Trapezoid>(
+                wavelength, flux, wavelength_unit, flux_unit, flux_type);
+    }
+}
+
+/**
+ * @brief Integrate the flux within the filter with a given integration rule
+ *
+ * @tparam Integration      integration policy (default: trapezoid)
+ * @tparam T                storage type of the flux (double or float)
+ * @param wavelength        wavelength array
+ * @param flux              flux array
+ * @param wavelength_unit   wavelength unit
+ * @param flux_unit         flux unit
+ * @param flux_type         flux density type of the spectrum (default: flam)
+ * @return integrated flux through the filter
+ * @throw std::runtime_error if the sizes differ
+ */
+template <typename Detector>
+template <typename Integration, typename T>
+QSpectralFluxDensity TypedFilter<Detector>::get_flux(
+    const DMatrix& wavelength,
+    const xt::xarray<T, xt::layout_type::row_major>& flux,
+    const QLength& wavelength_unit,
+    const QSpectralFluxDensity& flux_unit,
+    FluxDensityType flux_type) const {
+    if (flux.size() != wavelength.size()){
+        throw std::runtime_error("flux must be defined on the wavelength");
+    }
+    return dispatch_density<Detector>(flux_type, [&](auto weighting){
+        return this->template integrate_flux<Integration, decltype(weighting)>(
+            wavelength.data(), wavelength.size(), flux.data(), wavelength_unit, flux_unit);
+    });
 }
 
 }; // namespace cphot
\ No newline at end of file
@@ -0,0 +1,264 @@
+/**
+ * @defgroup FILTERBANK Filter bank
+ * @brief Contiguous storage of an entire library of filters
+ *
+ * A `cphot::FilterBank` stores the passbands of many filters as a structure
+ * of arrays: all the wavelengths (nm) and transmissions are concatenated in
+ * two buffers indexed by an offsets table, and the scalar properties (central,
+ * pivot, min and max wavelengths, norm, width, fwhm) are kept in parallel
+ * arrays. Scanning a library (e.g., selecting filters by pivot wavelength) or
+ * integrating a spectrum through all of its filters are then linear sweeps
+ * over memory.
+ *
+ * ```cpp
+ * cphot::HDF5Library lib(filename);
+ * cphot::FilterBank bank = lib.load_bank();
+ * const auto& lpivot = bank.get_lpivot();   // nm, one value per filter
+ * auto fluxes = bank.get_flux(wavelength, flux, angstrom, flam);
+ * ```
+ *
+ * `FilterBank::get_filter` returns an individual `cphot::Filter` when the
+ * full interface (zero points, reinterp, ...) is needed.
+ */
+#pragma once
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <xtensor/xarray.hpp>
+#include "detector.hpp"
+#include "filter.hpp"
+#include "flux_density.hpp"
+#include "integration.hpp"
+#include "rquantities.hpp"
+
+namespace cphot {
+
+using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
+
+/**
+ * @ingroup FILTERBANK
+ * @brief Filters stored in contiguous structure-of-arrays buffers.
+ *
+ * Filter `k` is defined by `wavelength_nm[offsets[k]:offsets[k+1]]` and
+ * `transmission[offsets[k]:offsets[k+1]]` (sorted by increasing wavelength).
+ */
+class FilterBank {
+    private:
+        std::vector<std::string> names;         ///< name of the filters
+        std::vector<DetectorType> detectors;    ///< detector type of the filters
+        std::vector<size_t> offsets {0};        ///< start of each filter in the buffers (size() + 1)
+        std::vector<double> wavelength_nm;      ///< all wavelengths in nm
+        std::vector<double> transmission;       ///< all transmissions
+        std::vector<size_t> support_first;      ///< first knot of the nonzero support (relative)
+        std::vector<size_t> support_last;       ///< last knot of the nonzero support (relative)
+        std::vector<double> cl;                 ///< central wavelengths in nm
+        std::vector<double> lpivot;             ///< pivot wavelengths in nm
+        std::vector<double> lmin;               ///< minimum wavelengths in nm
+        std::vector<double> lmax;               ///< maximum wavelengths in nm
+        std::vector<double> norm;               ///< norms of the passbands
+        std::vector<double> width;              ///< effective widths in nm
+        std::vector<double> fwhm;               ///< full widths at half maximum in nm
+
+    public:
+        FilterBank() = default;
+        explicit FilterBank(const std::vector<Filter>& filters);
+
+        void add(const Filter& filter);
+        void reserve(size_t n_filters, size_t n_points);
+
+        size_t size() const { return this->names.size(); }
+        size_t n_points(size_t k) const { return this->offsets[k + 1] - this->offsets[k]; }
+        size_t find(const std::string& name) const;
+
+        const std::vector<std::string>& get_names() const { return this->names; }
+        DetectorType get_detector_type(size_t k) const { return this->detectors[k]; }
+        const std::vector<size_t>& get_offsets() const { return this->offsets; }
+        const std::vector<double>& get_wavelength() const { return this->wavelength_nm; }
+        const std::vector<double>& get_transmission() const { return this->transmission; }
+        const double* get_wavelength(size_t k) const { return this->wavelength_nm.data() + this->offsets[k]; }
+        const double* get_transmission(size_t k) const { return this->transmission.data() + this->offsets[k]; }
+
+        const std::vector<double>& get_cl() const { return this->cl; }
+        const std::vector<double>& get_lpivot() const { return this->lpivot; }
+        const std::vector<double>& get_lmin() const { return this->lmin; }
+        const std::vector<double>& get_lmax() const { return this->lmax; }
+        const std::vector<double>& get_norm() const { return this->norm; }
+        const std::vector<double>& get_width() const { return this->width; }
+        const std::vector<double>& get_fwhm() const { return this->fwhm; }
+
+        Filter get_filter(size_t k) const;
+
+        template <typename Integration=integration::Trapezoid, typename T=double>
+        std::vector<QSpectralFluxDensity> get_flux(const DMatrix& wavelength,
+                                                   const xt::xarray<T, xt::layout_type::row_major>& flux,
+                                                   const QLength& wavelength_unit,
+                                                   const QSpectralFluxDensity& flux_unit,
+                                                   FluxDensityType flux_type=FluxDensityType::flam) const;
+};
+
+/**
+ * @brief Construct a bank from a set of filters
+ *
+ * @param filters   filters to store (in that order)
+ */
+FilterBank::FilterBank(const std::vector<Filter>& filters){
+    size_t n_points = 0;
+    for (const auto& filter: filters){
+        n_points += filter.get_wavelength().size();
+    }
+    this->reserve(filters.size(), n_points);
+    for (auto& filter: filters){
+        this->add(filter);
+    }
+}
+
+/**
+ * @brief Reserve the storage for a number of filters
+ *
+ * @param n_filters  total number of filters
+ * @param n_points   total number of definition points
+ */
+void FilterBank::reserve(size_t n_filters, size_t n_points){
+    this->names.reserve(n_filters);
+    this->detectors.reserve(n_filters);
+    this->offsets.reserve(n_filters + 1);
+    this->wavelength_nm.reserve(n_points);
+    this->transmission.reserve(n_points);
+    for (auto* values: {&this->cl, &this->lpivot, &this->lmin, &this->lmax,
+                        &this->norm, &this->width, &this->fwhm}){
+        values->reserve(n_filters);
+    }
+    this->support_first.reserve(n_filters);
+    this->support_last.reserve(n_filters);
+}
+
+/**
+ * @brief Append a filter to the bank
+ *
+ * @param filter  filter to append
+ */
+void FilterBank::add(const Filter& filter){
+    const DMatrix& wave = filter.get_wavelength();
+    const DMatrix& trans = filter.get_transmission();
+    this->names.push_back(filter.get_name());
+    this->detectors.push_back(filter.get_detector_type());
+    this->wavelength_nm.insert(this->wavelength_nm.end(), wave.begin(), wave.end());
+    this->transmission.insert(this->transmission.end(), trans.begin(), trans.end());
+    this->offsets.push_back(this->wavelength_nm.size());
+    const auto support = filter.get_support_knots();
+    this->support_first.push_back(support.first);
+    this->support_last.push_back(support.second);
+    this->cl.push_back(filter.get_cl().to(nm));
+    this->lpivot.push_back(filter.get_lpivot().to(nm));
+    this->lmin.push_back(filter.get_lmin().to(nm));
+    this->lmax.push_back(filter.get_lmax().to(nm));
+    this->norm.push_back(filter.get_norm());
+    this->width.push_back(filter.get_width().to(nm));
+    this->fwhm.push_back(filter.get_fwhm().to(nm));
+}
+
+/**
+ * @brief Index of a filter
+ *
+ * @param name  name of the filter
+ * @return index in the bank
+ * @throw std::runtime_error if the filter is not in the bank
+ */
+size_t FilterBank::find(const std::string& name) const {
+    const auto found = std::find(this->names.begin(), this->names.end(), name);
+    if (found == this->names.end()){
+        throw std::runtime_error("Filter " + name + " not in the bank");
+    }
+    return found - this->names.begin();
+}
+
+/**
+ * @brief Individual filter from the bank
+ *
+ * @param k  index of the filter
+ * @return Filter (with its own copy of the passband)
+ */
+Filter FilterBank::get_filter(size_t k) const {
+    const size_t n = this->n_points(k);
+    DMatrix wave = xt::zeros<double>({n});
+    DMatrix trans = xt::zeros<double>({n});
+    std::copy(this->get_wavelength(k), this->get_wavelength(k) + n, wave.begin());
+    std::copy(this->get_transmission(k), this->get_transmission(k) + n, trans.begin());
+    return Filter(wave, trans, nm, to_string(this->detectors[k]), this->names[k]);
+}
+
+/**
+ * @brief Integrate a spectrum through all the filters of the bank
+ *
+ * Same as `Filter::get_flux` for every filter (without the grid cache), in a
+ * single pass over the bank buffers. The wavelength is converted to nm once
+ * for all the filters, and the temporary values of the integration policy
+ * share one workspace.
+ *
+ * @tparam Integration      integration policy (default: trapezoid)
+ * @tparam T                storage type of the flux (double or float)
+ * @param wavelength        wavelength array (sorted)
+ * @param flux              flux array
+ * @param wavelength_unit   wavelength unit
+ * @param flux_unit         flux unit
+ * @param flux_type         flux density type of the spectrum (default: flam)
+ * @return integrated flux through every filter
+ * @throw std::runtime_error if the sizes differ
+ */
+template <typename Integration, typename T>
+std::vector<QSpectralFluxDensity> FilterBank::get_flux(const DMatrix& wavelength,
+                                                       const xt::xarray<T, xt::layout_type::row_major>& flux,
+                                                       const QLength& wavelength_unit,
+                                                       const QSpectralFluxDensity& flux_unit,
+                                                       FluxDensityType flux_type) const {
+    if (flux.size() != wavelength.size()){
+        throw std::runtime_error("flux must be defined on the wavelength");
+    }
+    std::vector<QSpectralFluxDensity> result(this->size(), 0. * flux_unit);
+    const double convfac = wavelength_unit.to(nm);
+    DMatrix converted;
+    if (convfac != 1.){
+        converted = wavelength * convfac;
+    }
+    const DMatrix& wave_nm = (convfac != 1.) ? converted : wavelength;
+    const double* w = wave_nm.data();
+    const T* f = flux.data();
+    const size_t n_wave = wave_nm.size();
+    integration::Workspace workspace;
+
+    for (size_t k = 0; k < this->size(); ++k){
+        const size_t first = this->support_first[k];
+        const size_t last = this->support_last[k];
+        if (last <= first){
+            continue;
+        }
+        const double* xp = this->get_wavelength(k) + first;
+        const double* fp = this->get_transmission(k) + first;
+        const size_t n_knots = last - first + 1;
+        // points within the support and their neighbors (see Filter::get_flux)
+        const size_t lower = std::lower_bound(w, w + n_wave, xp[0]) - w;
+        const size_t upper = std::upper_bound(w, w + n_wave, xp[n_knots - 1]) - w;
+        if ((lower >= n_wave) || (upper == 0)){
+            continue;
+        }
+        const size_t start = (lower > 0) ? lower - 1 : 0;
+        const size_t end = std::min(upper + 1, n_wave);
+        if (end < start + 2){
+            continue;
+        }
+        auto integrate = [&](auto weighting){
+            return Integration::template flux_integrals<decltype(weighting)>(
+                w + start, f + start, end - start, xp, fp, n_knots, workspace);
+        };
+        const kernels::FluxIntegrals integrals = (this->detectors[k] == DetectorType::photon)
+            ? dispatch_density<PhotonCounter>(flux_type, integrate)
+            : dispatch_density<EnergyCounter>(flux_type, integrate);
+        if (integrals.denominator > 0){
+            result[k] = integrals.numerator / integrals.denominator * flux_unit;
+        }
+    }
+    return result;
+}
+
+} // namespace cphot
@@ -0,0 +1,166 @@
+/**
+ * @defgroup FLUXDENSITY Flux density types
+ * @brief Spectra per unit frequency or in photons, integrated without conversion
+ *
+ * A spectrum can be given per unit wavelength (flam), per unit frequency
+ * (fnu, e.g., in Jy) or as a photon flux per unit wavelength or frequency
+ * (photlam, photnu). Each is related to \f$f_\lambda\f$ by a power of the
+ * wavelength,
+ *
+ * \f[ f_\lambda = K \lambda^{-p} q \f]
+ *
+ * with p = 0 (flam), 1 (photlam, K = hc), 2 (fnu, K = c) and 3
+ * (photnu, K = hc^2). The flux through a filter in the units of the spectrum
+ * is then
+ *
+ * \f[ \langle q \rangle = \frac{\int w(\lambda) \lambda^{-p} T(\lambda) q(\lambda) d\lambda}
+ *                              {\int w(\lambda) \lambda^{-p} T(\lambda) d\lambda} \f]
+ *
+ * i.e., the detector weight \f$w(\lambda)\f$ (see `cphot::PhotonCounter`) gains a
+ * factor \f$\lambda^{-p}\f$ and the spectrum goes through the same kernels
+ * without being converted. For fnu, this is the usual pivot wavelength
+ * relation \f$\langle f_\nu \rangle = \langle f_\lambda \rangle \lambda_p^2 / c\f$
+ * (with the pivot wavelength integrated on the spectrum wavelength). For
+ * photon counters and photlam, it is the mean photon flux density
+ * \f$\int T N_\lambda d\lambda / \int T d\lambda\f$.
+ *
+ * ```cpp
+ * // spectrum in Jy, flux in Jy
+ * auto f = filter.get_flux(wavelength, flux, angstrom, Jy, cphot::FluxDensityType::fnu);
+ * ```
+ */
+#pragma once
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include "detector.hpp"
+
+namespace cphot {
+
+/**
+ * @ingroup FLUXDENSITY
+ * @brief Type of flux density of a spectrum
+ */
+enum class FluxDensityType { flam, fnu, photlam, photnu };
+
+/**
+ * @ingroup FLUXDENSITY
+ * @brief Energy per unit wavelength (e.g., erg/s/cm^2/AA)
+ */
+struct Flam {
+    static constexpr FluxDensityType type = FluxDensityType::flam;
+    static constexpr int power = 0;     ///< f_λ ∝ λ^-power q
+    static constexpr const char* name = "flam";
+};
+
+/**
+ * @ingroup FLUXDENSITY
+ * @brief Energy per unit frequency (e.g., erg/s/cm^2/Hz, Jy)
+ */
+struct Fnu {
+    static constexpr FluxDensityType type = FluxDensityType::fnu;
+    static constexpr int power = 2;     ///< f_λ ∝ λ^-power q
+    static constexpr const char* name = "fnu";
+};
+
+/**
+ * @ingroup FLUXDENSITY
+ * @brief Photons per unit wavelength (e.g., photon/s/cm^2/AA)
+ */
+struct Photlam {
+    static constexpr FluxDensityType type = FluxDensityType::photlam;
+    static constexpr int power = 1;     ///< f_λ ∝ λ^-power q
+    static constexpr const char* name = "photlam";
+};
+
+/**
+ * @ingroup FLUXDENSITY
+ * @brief Photons per unit frequency (e.g., photon/s/cm^2/Hz)
+ */
+struct Photnu {
+    static constexpr FluxDensityType type = FluxDensityType::photnu;
+    static constexpr int power = 3;     ///< f_λ ∝ λ^-power q
+    static constexpr const char* name = "photnu";
+};
+
+/**
+ * @ingroup FLUXDENSITY
+ * @brief Detector tag with the weight of a flux density type
+ *
+ * Same members as the detector tags, with \f$w(\lambda) \lambda^{-p}\f$
+ * as weight (one division per point).
+ *
+ * @tparam Detector  `PhotonCounter` or `EnergyCounter`
+ * @tparam Density   `Fnu`, `Photlam` or `Photnu`
+ */
+template <typename Detector, typename Density>
+struct DensityWeighting : Detector {
+    static constexpr int power = Detector::power - Density::power;   ///< power of λ in the weight
+    static constexpr double weight(double x){ return wavelength_power<power>(x); }
+};
+
+/**
+ * @ingroup FLUXDENSITY
+ * @brief Tag of a detector for a flux density type (the detector itself for flam)
+ */
+template <typename Detector, typename Density>
+using Weighting = typename std::conditional<Density::power == 0, Detector,
+                                            DensityWeighting<Detector, Density>>::type;
+
+/**
+ * @ingroup FLUXDENSITY
+ * @brief Call a function with the weighting tag of a detector and flux density type
+ *
+ * Runtime to compile-time dispatch, once per call, like the detector type in
+ * `cphot::Filter`.
+ *
+ * @tparam Detector  `PhotonCounter` or `EnergyCounter`
+ * @param type       flux density type
+ * @param func       callable on the weighting tags
+ * @return result of func
+ */
+template <typename Detector, typename Func>
+auto dispatch_density(FluxDensityType type, Func&& func) -> decltype(func(Detector())) {
+    switch (type){
+        case FluxDensityType::fnu: return func(Weighting<Detector, Fnu>());
+        case FluxDensityType::photlam: return func(Weighting<Detector, Photlam>());
+        case FluxDensityType::photnu: return func(Weighting<Detector, Photnu>());
+        default: return func(Detector());
+    }
+}
+
+/**
+ * @ingroup FLUXDENSITY
+ * @brief Name of a flux density type
+ *
+ * @param type  flux density type
+ * @return "flam", "fnu", "photlam" or "photnu"
+ */
+std::string to_string(FluxDensityType type){
+    switch (type){
+        case FluxDensityType::fnu: return Fnu::name;
+        case FluxDensityType::photlam: return Photlam::name;
+        case FluxDensityType::photnu: return Photnu::name;
+        default: return Flam::name;
+    }
+}
+
+/**
+ * @ingroup FLUXDENSITY
+ * @brief Flux density type from its name
+ *
+ * @param name  "flam", "fnu", "photlam" or "photnu"
+ * @return FluxDensityType
+ * @throw std::runtime_error if the name is invalid
+ */
+FluxDensityType parse_flux_density_type(const std::string& name){
+    for (const auto type: {FluxDensityType::flam, FluxDensityType::fnu,
+                           FluxDensityType::photlam, FluxDensityType::photnu}){
+        if (name.compare(to_string(type)) == 0){
+            return type;
+        }
+    }
+    throw std::runtime_error("only flam, fnu, photlam and photnu allowed");
+}
+
+} // namespace cphot
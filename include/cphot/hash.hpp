@@ -0,0 +1,68 @@
+/**
+ * @defgroup HASH Hashing
+ * @brief Content hashes of the arrays used as cache keys
+ *
+ * The caches of resampled filters (`cphot::Filter::get_flux`,
+ * `cphot::WeightsCache`) identify filters and wavelength definitions by a
+ * 64-bit FNV-1a hash of their values. The hash is not cryptographic but is
+ * stable across runs and platforms of the same endianness, so it can name
+ * files.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace cphot {
+
+/**
+ * @ingroup HASH
+ * @brief Incremental 64-bit FNV-1a hash
+ *
+ * ```cpp
+ * cphot::Fnv1a hash;
+ * hash.add(wavelength.data(), wavelength.size());
+ * hash.add(convfac);
+ * uint64_t key = hash.value;
+ * ```
+ */
+struct Fnv1a {
+    uint64_t value = 14695981039346656037ULL;   ///< current hash
+
+    /**
+     * @brief Hash raw bytes
+     *
+     * @param bytes     first byte
+     * @param n_bytes   number of bytes
+     */
+    void add_bytes(const void* bytes, size_t n_bytes){
+        const unsigned char* b = static_cast<const unsigned char*>(bytes);
+        for (size_t i = 0; i < n_bytes; ++i){
+            this->value ^= b[i];
+            this->value *= 1099511628211ULL;
+        }
+    }
+
+    /**
+     * @brief Hash the bytes of n values
+     *
+     * @param values    first value
+     * @param n         number of values
+     */
+    template <typename T>
+    void add(const T* values, size_t n){
+        this->add_bytes(values, n * sizeof(T));
+    }
+
+    /**
+     * @brief Hash the bytes of a value
+     *
+     * @param value     value (trivially copyable)
+     */
+    template <typename T>
+    void add(const T& value){
+        this->add_bytes(&value, sizeof(T));
+    }
+};
+
+} // namespace cphot
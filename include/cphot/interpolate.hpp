@@ -0,0 +1,182 @@
+/**
+ * @defgroup INTERPOLATE Interpolation
+ * @brief Linear interpolation between sorted wavelength definitions
+ *
+ * Drop-in replacement for `xt::interp` when the evaluation points are sorted,
+ * which is always the case for wavelength definitions. Instead of a binary
+ * search per point, the knots are located once with a binary search and then
+ * followed with a two-pointer walk, i.e., O(n + m) instead of O(n log m) and
+ * without unpredictable branches.
+ *
+ * ```cpp
+ * // transmission of a filter on the spectrum wavelength
+ * DMatrix T = cphot::interpolate::linear(wavelength, filt_wave, filt_trans, 0., 0.);
+ * ```
+ *
+ * Unsorted evaluation points are still supported (with one binary search per
+ * point), the check is done once per call unless the caller already knows the
+ * answer.
+ */
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include <xtensor/xarray.hpp>
+
+namespace cphot {
+
+using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
+
+namespace interpolate {
+
+/**
+ * @ingroup INTERPOLATE
+ * @brief Check that values are sorted in increasing order
+ *
+ * @param x  values
+ * @param n  number of values
+ * @return true if x[i] <= x[i + 1] for all i
+ */
+bool is_sorted(const double* x, size_t n){
+    return std::is_sorted(x, x + n);
+}
+
+/**
+ * @ingroup INTERPOLATE
+ * @brief Linear interpolation at a single point from a known segment
+ *
+ * @param xi    evaluation point, xp[k] <= xi <= xp[k + 1]
+ * @param xp    knots (sorted)
+ * @param fp    values at the knots
+ * @param k     index of the segment
+ * @return interpolated value
+ */
+inline double segment_value(double xi, const double* xp, const double* fp, size_t k){
+    const double dx = xp[k + 1] - xp[k];
+    if (dx <= 0){
+        return fp[k + 1];
+    }
+    const double fl = (xp[k + 1] - xi) / dx;
+    const double fr = (xi - xp[k]) / dx;
+    return fl * fp[k] + fr * fp[k + 1];
+}
+
+/**
+ * @ingroup INTERPOLATE
+ * @brief Linear interpolation of sorted points (merge walk)
+ *
+ * @param x      evaluation points (sorted)
+ * @param n      number of evaluation points
+ * @param xp     knots (sorted)
+ * @param fp     values at the knots
+ * @param m      number of knots (at least 1)
+ * @param left   value for x < xp[0]
+ * @param right  value for x > xp[m - 1]
+ * @param out    output values (n)
+ */
+void linear_sorted(const double* x, size_t n,
+                   const double* xp, const double* fp, size_t m,
+                   double left, double right, double* out){
+    if (m < 2){
+        for (size_t i = 0; i < n; ++i){
+            out[i] = (x[i] < xp[0]) ? left : (x[i] > xp[0]) ? right : fp[0];
+        }
+        return;
+    }
+    // first segment with a single binary search
+    size_t i = 0;
+    for (; (i < n) && (x[i] < xp[0]); ++i){
+        out[i] = left;
+    }
+    if (i == n){
+        return;
+    }
+    size_t k = std::upper_bound(xp, xp + m, x[i]) - xp;
+    k = (k > 0) ? std::min(k - 1, m - 2) : 0;
+    for (; (i < n) && (x[i] <= xp[m - 1]); ++i){
+        while ((k + 2 < m) && (xp[k + 1] <= x[i])){
+            ++k;
+        }
+        out[i] = segment_value(x[i], xp, fp, k);
+    }
+    for (; i < n; ++i){
+        out[i] = right;
+    }
+}
+
+/**
+ * @ingroup INTERPOLATE
+ * @brief Linear interpolation of arbitrary points (one binary search per point)
+ *
+ * @param x      evaluation points
+ * @param n      number of evaluation points
+ * @param xp     knots (sorted)
+ * @param fp     values at the knots
+ * @param m      number of knots (at least 1)
+ * @param left   value for x < xp[0]
+ * @param right  value for x > xp[m - 1]
+ * @param out    output values (n)
+ */
+void linear_unsorted(const double* x, size_t n,
+                     const double* xp, const double* fp, size_t m,
+                     double left, double right, double* out){
+    for (size_t i = 0; i < n; ++i){
+        if (x[i] < xp[0]){
+            out[i] = left;
+        } else if (x[i] > xp[m - 1]){
+            out[i] = right;
+        } else if (m < 2) {
+            out[i] = fp[0];
+        } else {
+            size_t k = std::upper_bound(xp, xp + m, x[i]) - xp;
+            out[i] = segment_value(x[i], xp, fp, std::min(k - 1, m - 2));
+        }
+    }
+}
+
+/**
+ * @ingroup INTERPOLATE
+ * @brief Linear interpolation (same as `xt::interp(x, xp, fp, left, right)`)
+ *
+ * @param x         evaluation points
+ * @param xp        knots (sorted)
+ * @param fp        values at the knots
+ * @param left      value for x < xp[0]
+ * @param right     value for x > xp[-1]
+ * @param x_sorted  whether x is known to be sorted (skips the check)
+ * @return interpolated values, same shape as x
+ */
+DMatrix linear(const DMatrix& x, const DMatrix& xp, const DMatrix& fp,
+               double left, double right, bool x_sorted=false){
+    DMatrix out = xt::zeros<double>(x.shape());
+    if (xp.size() == 0){
+        return out;
+    }
+    if (x_sorted || is_sorted(x.data(), x.size())){
+        linear_sorted(x.data(), x.size(), xp.data(), fp.data(), xp.size(),
+                      left, right, out.data());
+    } else {
+        linear_unsorted(x.data(), x.size(), xp.data(), fp.data(), xp.size(),
+                        left, right, out.data());
+    }
+    return out;
+}
+
+/**
+ * @ingroup INTERPOLATE
+ * @brief Linear interpolation extended with the edge values (same as `xt::interp(x, xp, fp)`)
+ *
+ * @param x         evaluation points
+ * @param xp        knots (sorted)
+ * @param fp        values at the knots
+ * @return interpolated values, same shape as x
+ */
+DMatrix linear(const DMatrix& x, const DMatrix& xp, const DMatrix& fp){
+    if (fp.size() == 0){
+        return xt::zeros<double>(x.shape());
+    }
+    return linear(x, xp, fp, fp[0], fp[fp.size() - 1]);
+}
+
+} // namespace interpolate
+} // namespace cphot
@@ -0,0 +1,527 @@
+/**
+ * @defgroup KERNELS Photometry kernels
+ * @brief Fused interpolation and integration kernels with runtime CPU dispatch
+ *
+ * `cphot::Filter::get_flux` needs two integrals of the filter transmission
+ * interpolated on the spectrum wavelength:
+ *
+ * \f[ a = \int w(\lambda) T(\lambda) f(\lambda) d\lambda, \quad
+ *     b = \int w(\lambda) T(\lambda) d\lambda \f]
+ *
+ * with \f$w(\lambda) = \lambda\f$ for photon counters and \f$w = 1\f$ for
+ * energy counters (`Detector::weight`, times \f$\lambda^{-p}\f$ for spectra
+ * per unit frequency or in photons, see `cphot::FluxDensityType`). The
+ * kernels in this module compute both with the trapezoidal rule in a single
+ * streaming pass over the spectrum, without allocating the interpolated
+ * transmission: the transmission is evaluated by walking the filter knots
+ * alongside the spectrum wavelength, one block of points at a time, and the
+ * block is then reduced with vector instructions.
+ *
+ * Variants compiled for AVX-512 and AVX2 are selected at runtime on x86
+ * processors that support them, with a portable fallback otherwise. All
+ * variants run the same sequence of IEEE operations (fixed number of partial
+ * sums, no fused multiply-add), so their results are bit-identical.
+ *
+ * `exact_linear_flux_integrals` computes the same integrals without
+ * resampling: both curves are taken as piecewise linear and their product is
+ * integrated exactly (for weights that are polynomials of λ), which suits
+ * spectra coarser than the filter.
+ *
+ * The flux values are read through any pointer-like type: `const double*`,
+ * `const float*`, which halves the memory traffic of large spectra, or a
+ * `cphot::StridedPointer` into a larger buffer. Each value is widened to
+ * double when read and all the sums are accumulated in double precision.
+ */
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include "detector.hpp"
+
+namespace cphot {
+namespace kernels {
+
+/**
+ * @ingroup KERNELS
+ * @brief Numerator and denominator of the flux through a filter.
+ */
+struct FluxIntegrals {
+    double numerator = 0.;      ///< int w T f dλ
+    double denominator = 0.;    ///< int w T dλ
+};
+
+/**
+ * @ingroup KERNELS
+ * @brief Instruction sets the kernels are compiled for.
+ */
+enum class SimdLevel { scalar, avx2, avx512 };
+
+//! number of independent partial sums (one AVX-512 register of doubles)
+constexpr size_t n_lanes = 8;
+//! number of spectrum points whose transmission is evaluated at once
+constexpr size_t block_size = 256;
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+// keep a * b + c as two roundings in every variant
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+/**
+ * @ingroup KERNELS
+ * @brief Filter transmission at xi (0 outside of the filter)
+ *
+ * The current filter segment k only moves forward, so that successive calls
+ * with increasing xi walk the filter knots once.
+ *
+ * @param xi    wavelength
+ * @param xp    filter wavelength (sorted, same units as xi)
+ * @param fp    filter transmission
+ * @param m     number of filter points
+ * @param k     current filter segment (updated)
+ */
+static inline __attribute__((always_inline))
+double walk_transmission(double xi, const double* xp, const double* fp, size_t m, size_t& k){
+    double t = 0.;
+    if ((xi >= xp[0]) && (xi <= xp[m - 1])){
+        while ((k + 2 < m) && (xp[k + 1] <= xi)){
+            ++k;
+        }
+        const double dxp = xp[k + 1] - xp[k];
+        t = (dxp > 0) ? fp[k] + (xi - xp[k]) * ((fp[k + 1] - fp[k]) / dxp) : fp[k + 1];
+    }
+    return t;
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Body of the fused kernel shared by all instruction set variants.
+ *
+ * @tparam Detector  `PhotonCounter` or `EnergyCounter`
+ * @tparam Flux      pointer to the flux values (double or float), possibly strided
+ * @param x         spectrum wavelength (sorted)
+ * @param f         spectrum flux
+ * @param n         number of spectrum points
+ * @param xp        filter wavelength (sorted, same units as x)
+ * @param fp        filter transmission
+ * @param m         number of filter points
+ */
+template <typename Detector, typename Flux>
+static inline __attribute__((always_inline))
+FluxIntegrals fused_flux_integrals_body(const double* x, Flux f, size_t n,
+                                        const double* xp, const double* fp, size_t m){
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+    FluxIntegrals result;
+    if ((n < 2) || (m < 2)){
+        return result;
+    }
+    double acc_num[n_lanes] = {};
+    double acc_den[n_lanes] = {};
+    double y_den[block_size + 1];
+    double y_num[block_size + 1];
+
+    size_t k = 0;   // current filter segment: xp[k] <= x < xp[k + 1]
+    for (size_t start = 0; start + 1 < n; start += block_size){
+        const size_t n_intervals = (start + block_size < n) ? block_size : n - 1 - start;
+
+        // transmission of the block points (and the first point of the next block)
+        for (size_t j = 0; j <= n_intervals; ++j){
+            const double xi = x[start + j];
+            const double t = walk_transmission(xi, xp, fp, m, k);
+            const double wt = Detector::weight(xi) * t;
+            y_den[j] = wt;
+            y_num[j] = wt * static_cast<double>(f[start + j]);
+        }
+
+        // trapezoids, interval i goes into the partial sum i % n_lanes
+        const double* xb = x + start;
+        size_t j = 0;
+        for (; j + n_lanes <= n_intervals; j += n_lanes){
+            for (size_t l = 0; l < n_lanes; ++l){
+                const double dx = xb[j + l + 1] - xb[j + l];
+                acc_num[l] += dx * (y_num[j + l] + y_num[j + l + 1]);
+                acc_den[l] += dx * (y_den[j + l] + y_den[j + l + 1]);
+            }
+        }
+        for (size_t l = 0; j + l < n_intervals; ++l){
+            const double dx = xb[j + l + 1] - xb[j + l];
+            acc_num[l] += dx * (y_num[j + l] + y_num[j + l + 1]);
+            acc_den[l] += dx * (y_den[j + l] + y_den[j + l + 1]);
+        }
+    }
+    for (size_t l = 0; l < n_lanes; ++l){
+        result.numerator += acc_num[l];
+        result.denominator += acc_den[l];
+    }
+    result.numerator *= 0.5;
+    result.denominator *= 0.5;
+    return result;
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Portable variant of the fused kernel
+ */
+template <typename Detector, typename Flux>
+FluxIntegrals fused_flux_integrals_scalar(const double* x, Flux f, size_t n,
+                                          const double* xp, const double* fp, size_t m){
+    return fused_flux_integrals_body<Detector>(x, f, n, xp, fp, m);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Resample the (λ weighted) transmission of a filter on a spectrum wavelength
+ *
+ * First half of the fused kernel, for callers that integrate many spectra on
+ * the same wavelength (see `cached_flux_numerator`).
+ *
+ * @tparam Detector  `PhotonCounter` or `EnergyCounter`
+ * @param x         spectrum wavelength (sorted)
+ * @param n         number of spectrum points
+ * @param xp        filter wavelength (sorted, same units as x)
+ * @param fp        filter transmission
+ * @param m         number of filter points
+ * @param wt        w T on x (n)
+ * @return denominator int w T dλ, bit-identical to the one of `fused_flux_integrals`
+ */
+template <typename Detector>
+double resample_weighted_transmission(const double* x, size_t n,
+                                      const double* xp, const double* fp, size_t m,
+                                      double* wt){
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+    if ((n < 2) || (m < 2)){
+        std::fill(wt, wt + n, 0.);
+        return 0.;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i){
+        const double t = walk_transmission(x[i], xp, fp, m, k);
+        wt[i] = Detector::weight(x[i]) * t;
+    }
+    double acc[n_lanes] = {};
+    size_t i = 0;
+    for (; i + n_lanes < n; i += n_lanes){
+        for (size_t l = 0; l < n_lanes; ++l){
+            acc[l] += (x[i + l + 1] - x[i + l]) * (wt[i + l] + wt[i + l + 1]);
+        }
+    }
+    for (size_t l = 0; i + l + 1 < n; ++l){
+        acc[l] += (x[i + l + 1] - x[i + l]) * (wt[i + l] + wt[i + l + 1]);
+    }
+    double denominator = 0.;
+    for (size_t l = 0; l < n_lanes; ++l){
+        denominator += acc[l];
+    }
+    return 0.5 * denominator;
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Body of the cached numerator kernel shared by all instruction set variants.
+ *
+ * Same trapezoids and partial sums as `fused_flux_integrals_body`, with the
+ * transmission read from `wt` instead of being interpolated.
+ */
+template <typename Flux>
+static inline __attribute__((always_inline))
+double cached_flux_numerator_body(const double* x, Flux f, const double* wt, size_t n){
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+    double acc[n_lanes] = {};
+    size_t i = 0;
+    for (; i + n_lanes < n; i += n_lanes){
+        for (size_t l = 0; l < n_lanes; ++l){
+            const double y0 = wt[i + l] * static_cast<double>(f[i + l]);
+            const double y1 = wt[i + l + 1] * static_cast<double>(f[i + l + 1]);
+            acc[l] += (x[i + l + 1] - x[i + l]) * (y0 + y1);
+        }
+    }
+    for (size_t l = 0; i + l + 1 < n; ++l){
+        const double y0 = wt[i + l] * static_cast<double>(f[i + l]);
+        const double y1 = wt[i + l + 1] * static_cast<double>(f[i + l + 1]);
+        acc[l] += (x[i + l + 1] - x[i + l]) * (y0 + y1);
+    }
+    double numerator = 0.;
+    for (size_t l = 0; l < n_lanes; ++l){
+        numerator += acc[l];
+    }
+    return 0.5 * numerator;
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Portable variant of the cached numerator kernel
+ */
+template <typename Flux>
+double cached_flux_numerator_scalar(const double* x, Flux f, const double* wt, size_t n){
+    return cached_flux_numerator_body(x, f, wt, n);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPHOT_KERNELS_X86_DISPATCH 1
+
+/**
+ * @ingroup KERNELS
+ * @brief AVX2 variant of the fused kernel
+ */
+template <typename Detector, typename Flux>
+__attribute__((target("avx2")))
+FluxIntegrals fused_flux_integrals_avx2(const double* x, Flux f, size_t n,
+                                        const double* xp, const double* fp, size_t m){
+    return fused_flux_integrals_body<Detector>(x, f, n, xp, fp, m);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief AVX-512 variant of the fused kernel
+ */
+template <typename Detector, typename Flux>
+__attribute__((target("avx512f")))
+FluxIntegrals fused_flux_integrals_avx512(const double* x, Flux f, size_t n,
+                                          const double* xp, const double* fp, size_t m){
+    return fused_flux_integrals_body<Detector>(x, f, n, xp, fp, m);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief AVX2 variant of the cached numerator kernel
+ */
+template <typename Flux>
+__attribute__((target("avx2")))
+double cached_flux_numerator_avx2(const double* x, Flux f, const double* wt, size_t n){
+    return cached_flux_numerator_body(x, f, wt, n);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief AVX-512 variant of the cached numerator kernel
+ */
+template <typename Flux>
+__attribute__((target("avx512f")))
+double cached_flux_numerator_avx512(const double* x, Flux f, const double* wt, size_t n){
+    return cached_flux_numerator_body(x, f, wt, n);
+}
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+
+/**
+ * @ingroup KERNELS
+ * @brief Best instruction set supported by the running CPU (detected once)
+ *
+ * @return SimdLevel
+ */
+SimdLevel get_simd_level(){
+#ifdef CPHOT_KERNELS_X86_DISPATCH
+    static const SimdLevel level = __builtin_cpu_supports("avx512f") ? SimdLevel::avx512
+                                 : __builtin_cpu_supports("avx2") ? SimdLevel::avx2
+                                 : SimdLevel::scalar;
+    return level;
+#else
+    return SimdLevel::scalar;
+#endif
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Fused interpolation and trapezoidal integration of a filter and a spectrum
+ *
+ * Equivalent to
+ * ```cpp
+ * T = xt::interp(x, xp, fp, 0., 0.);
+ * numerator = xt::trapz(w * T * f, x);
+ * denominator = xt::trapz(w * T, x);
+ * ```
+ * with w = x for photon counters and 1 otherwise.
+ *
+ * @tparam Detector  `PhotonCounter` or `EnergyCounter`
+ * @tparam Flux      pointer to the flux values (double or float), possibly strided
+ * @param x         spectrum wavelength (sorted)
+ * @param f         spectrum flux
+ * @param n         number of spectrum points
+ * @param xp        filter wavelength (sorted, same units as x)
+ * @param fp        filter transmission
+ * @param m         number of filter points
+ * @param level     variant to use (default: best supported by the CPU)
+ * @return numerator and denominator integrals
+ */
+template <typename Detector, typename Flux>
+FluxIntegrals fused_flux_integrals(const double* x, Flux f, size_t n,
+                                   const double* xp, const double* fp, size_t m,
+                                   SimdLevel level=get_simd_level()){
+#ifdef CPHOT_KERNELS_X86_DISPATCH
+    if ((level == SimdLevel::avx512) && __builtin_cpu_supports("avx512f")){
+        return fused_flux_integrals_avx512<Detector>(x, f, n, xp, fp, m);
+    }
+    if ((level == SimdLevel::avx2) && __builtin_cpu_supports("avx2")){
+        return fused_flux_integrals_avx2<Detector>(x, f, n, xp, fp, m);
+    }
+#endif
+    return fused_flux_integrals_scalar<Detector>(x, f, n, xp, fp, m);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Fused interpolation and trapezoidal integration (detector given at runtime)
+ *
+ * @tparam Flux      pointer to the flux values (double or float), possibly strided
+ * @param x         spectrum wavelength (sorted)
+ * @param f         spectrum flux
+ * @param n         number of spectrum points
+ * @param xp        filter wavelength (sorted, same units as x)
+ * @param fp        filter transmission
+ * @param m         number of filter points
+ * @param photon    weight the integrands by λ
+ * @param level     variant to use (default: best supported by the CPU)
+ * @return numerator and denominator integrals
+ */
+template <typename Flux>
+FluxIntegrals fused_flux_integrals(const double* x, Flux f, size_t n,
+                                   const double* xp, const double* fp, size_t m,
+                                   bool photon,
+                                   SimdLevel level=get_simd_level()){
+    return photon ? fused_flux_integrals<PhotonCounter>(x, f, n, xp, fp, m, level)
+                  : fused_flux_integrals<EnergyCounter>(x, f, n, xp, fp, m, level);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Numerator of the flux from a resampled transmission
+ *
+ * With `wt` and the denominator from `resample_weighted_transmission`, the
+ * results are bit-identical to `fused_flux_integrals` on the same x, at the
+ * cost of a single pass over the flux (no interpolation).
+ *
+ * @tparam Flux      pointer to the flux values (double or float), possibly strided
+ * @param x         spectrum wavelength (sorted)
+ * @param f         spectrum flux
+ * @param wt        resampled w T on x
+ * @param n         number of spectrum points
+ * @param level     variant to use (default: best supported by the CPU)
+ * @return int w T f dλ
+ */
+template <typename Flux>
+double cached_flux_numerator(const double* x, Flux f, const double* wt, size_t n,
+                             SimdLevel level=get_simd_level()){
+#ifdef CPHOT_KERNELS_X86_DISPATCH
+    if ((level == SimdLevel::avx512) && __builtin_cpu_supports("avx512f")){
+        return cached_flux_numerator_avx512(x, f, wt, n);
+    }
+    if ((level == SimdLevel::avx2) && __builtin_cpu_supports("avx2")){
+        return cached_flux_numerator_avx2(x, f, wt, n);
+    }
+#endif
+    return cached_flux_numerator_scalar(x, f, wt, n);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Sweep the merged breakpoints of two piecewise-linear curves
+ *
+ * Calls `func(a, b, i, k)` for every interval [a, b] between consecutive
+ * breakpoints of the range covered by both curves, where `i` and `k` are the
+ * segments of the spectrum and of the filter containing the interval. The
+ * breakpoints are swept once after two binary searches.
+ *
+ * @param x         spectrum wavelength (sorted)
+ * @param n         number of spectrum points
+ * @param xp        filter wavelength (sorted, same units as x)
+ * @param m         number of filter points
+ * @param func      callable (double, double, size_t, size_t)
+ */
+template <typename Func>
+void sweep_linear_overlap(const double* x, size_t n,
+                          const double* xp, size_t m,
+                          Func&& func){
+    if ((n < 2) || (m < 2)){
+        return;
+    }
+    const double lo = std::max(x[0], xp[0]);
+    const double hi = std::min(x[n - 1], xp[m - 1]);
+    if (hi <= lo){
+        return;
+    }
+    // segments containing lo
+    size_t i = std::min(static_cast<size_t>(std::upper_bound(x, x + n, lo) - x), n - 1) - 1;
+    size_t k = std::min(static_cast<size_t>(std::upper_bound(xp, xp + m, lo) - xp), m - 1) - 1;
+
+    double a = lo;
+    while (a < hi){
+        const double b = std::min(std::min(x[i + 1], xp[k + 1]), hi);
+        if (b > a){
+            func(a, b, i, k);
+        }
+        a = b;
+        while ((i + 2 < n) && (x[i + 1] <= a)){ ++i; }
+        while ((k + 2 < m) && (xp[k + 1] <= a)){ ++k; }
+    }
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Value at z of the segment j of a piecewise-linear curve
+ */
+template <typename Values>
+inline double linear_segment_value(double z, const double* xs, Values ys, size_t j){
+    const double dx = xs[j + 1] - xs[j];
+    const double y0 = ys[j];
+    const double y1 = ys[j + 1];
+    return (dx > 0) ? y0 + (z - xs[j]) * ((y1 - y0) / dx) : y1;
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Exact integrals of the product of two piecewise-linear curves
+ *
+ * The spectrum and the filter are both considered linear between their
+ * points. With a weight \f$w(\lambda) = \lambda^q\f$, q = 0 or 1 (flam
+ * spectra, and photlam spectra with photon counters), the integrands are
+ * polynomials of degree at most 3 between consecutive points of the merged
+ * set of breakpoints (see `sweep_linear_overlap`), which Simpson's rule
+ * integrates exactly. The other flux density types have q < 0 (e.g.,
+ * \f$\lambda^{-1}\f$ for fnu with photon counters): the integrands are not
+ * polynomials, and the relative error of each interval [a, b] is of order
+ * \f$((b - a) / a)^4\f$, negligible for any realistic sampling but not
+ * zero. The integrals are restricted to the range covered by both curves.
+ *
+ * The cost is O(m + number of spectrum points within the filter).
+ *
+ * @tparam Detector  `PhotonCounter` or `EnergyCounter`
+ * @tparam Flux      pointer to the flux values (double or float), possibly strided
+ * @param x         spectrum wavelength (sorted)
+ * @param f         spectrum flux
+ * @param n         number of spectrum points
+ * @param xp        filter wavelength (sorted, same units as x)
+ * @param fp        filter transmission
+ * @param m         number of filter points
+ * @return numerator and denominator integrals
+ */
+template <typename Detector, typename Flux>
+FluxIntegrals exact_linear_flux_integrals(const double* x, Flux f, size_t n,
+                                          const double* xp, const double* fp, size_t m){
+    FluxIntegrals result;
+    sweep_linear_overlap(x, n, xp, m, [&](double a, double b, size_t i, size_t k){
+        const double z[3] = {a, 0.5 * (a + b), b};
+        double num = 0.;
+        double den = 0.;
+        for (size_t j = 0; j < 3; ++j){
+            const double coeff = (j == 1) ? 4. : 1.;
+            const double t = linear_segment_value(z[j], xp, fp, k);
+            const double wt = Detector::weight(z[j]) * t;
+            den += coeff * wt;
+            num += coeff * wt * linear_segment_value(z[j], x, f, i);
+        }
+        result.numerator += (b - a) / 6. * num;
+        result.denominator += (b - a) / 6. * den;
+    });
+    return result;
+}
+
+} // namespace kernels
+} // namespace cphot
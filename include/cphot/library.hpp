@@ -11,6 +11,7 @@
 #pragma once
 #include <H5Cpp.h>
 #include <cphot/filter.hpp>
+#include <cphot/filter_bank.hpp>
 #include <cphot/rquantities.hpp>
 #include <highfive/H5Easy.hpp>
 #include <highfive/H5File.hpp>
@@ -142,6 +143,8 @@ namespace cphot {
             HDF5Library(const std::string & filename);
             std::vector<std::string> get_content();
             Filter load_filter(const std::string & filter_name);
+            FilterBank load_bank();
+            FilterBank load_bank(const std::vector<std::string> & filter_names);
             std::vector<std::string> find (const std::string & name,
                                            bool case_sensitive=true);
             std::string get_source();
@@ -181,6 +184,33 @@ namespace cphot {
         return get_filter_from_hdf5_library(this->source, filter_name);
     }
 
+    /**
+     * @brief Load the entire library into a contiguous filter bank
+     *
+     * @return FilterBank with all the filters of the library
+     */
+    FilterBank HDF5Library::load_bank(){
+        return this->load_bank(this->content);
+    }
+
+    /**
+     * @brief Load a set of filters into a contiguous filter bank
+     *
+     * The filters are read one at a time and appended to the bank, so that
+     * only one passband is held outside of the bank at any time.
+     *
+     * @param filter_names  normalized names according to the library
+     * @return FilterBank with the filters in the given order
+     */
+    FilterBank HDF5Library::load_bank(const std::vector<std::string> & filter_names){
+        FilterBank bank;
+        for (const auto & filter_name: filter_names){
+            Filter filter = this->load_filter(filter_name);
+            bank.add(filter);
+        }
+        return bank;
+    }
+
     /**
      * @brief Look for filter names
      *
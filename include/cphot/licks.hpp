@@ -39,7 +39,9 @@
  */
 #include <cmath>
 #include <vector>
+#include <cphot/interpolate.hpp>
 #include <cphot/rquantities.hpp>
+#include <cphot/wavelength_grid.hpp>
 #include <cphot/hardcoded_data/licks_data.hpp>
 
 namespace cphot{
@@ -50,28 +52,29 @@ using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
  * @ingroup LICKS
  * @brief Adapt the resolution of the spectra to match the lick definitions.
  *
- * Lick definitions have different resolution elements as function of wavelength.
- * These definition are hard-coded in this function
+ * The flux at the sampling points of the convolution kernel is located
+ * arithmetically on uniform and log-uniform grids (see `cphot::WavelengthGrid`).
  *
- * @param w
- *         wavelength definition in Angstrom
+ * @param grid
+ *         wavelength definition
  * @param flux
  *         spectra to convert
  * @param fwhm0
- *         initial broadening in the spectra `fi`
+ *         initial broadening in the spectra `fi` in AA
  * @param sigma_floor
  *         minimal dispersion to consider
  * @return flux_red reduced spectra
- *
  */
-DMatrix reduce_resolution(const DMatrix& w, const DMatrix& flux, double fwhm0, double sigma_floor){
+DMatrix reduce_resolution(const WavelengthGrid& grid, const DMatrix& flux, double fwhm0, double sigma_floor){
     // all in AA
+    const double convfac = grid.get_wavelength_unit().to(angstrom);
+    const DMatrix w = grid.get_wavelength() * convfac;
     const DMatrix w_lick_res {4000., 4400., 4900., 5400., 6000.};  // Lick resolution anchor points in AA
     const DMatrix lick_res   {11.5, 9.2, 8.4, 8.4, 9.8};           // FWHM in AA
 
     // Linear interpolation of lick_res over w
     // TODO: need to add extrapolation
-    DMatrix res = xt::interp(w, w_lick_res, lick_res);
+    DMatrix res = interpolate::linear(w, w_lick_res, lick_res);
 
     // Compute width from fwhm
     double constant = 2. * std::sqrt(2. * std::log(2));     // constant that converts fwhm --> sigma
@@ -86,14 +89,38 @@ DMatrix reduce_resolution(const DMatrix& w, const DMatrix& flux, double fwhm0, d
         // sampling floor: min (0.2, sigma * 0.1)
         double delta = std::min(sigma_floor, sigma * 0.1);
         DMatrix delta_wj = xt::arange(-maxsigma, + maxsigma, delta);
-        auto wj = delta_wj + w[i];
-        auto fluxj = xt::interp(wj, w, flux, 0., 0.);
+        // sampling points in the grid unit
+        DMatrix wj = (delta_wj + w[i]) / convfac;
+        DMatrix fluxj = xt::zeros<double>({wj.size()});
+        grid.sample(flux.data(), wj.data(), wj.size(), 0., 0., fluxj.data());
         flux_red[i] = xt::sum(fluxj * delta * xt::exp(-0.5 * xt::pow(delta_wj / sigma, 2)))();
     }
     flux_red /= lick_sigma * constant;
     return flux_red;
 }
 
+/**
+ * @ingroup LICKS
+ * @brief Adapt the resolution of the spectra to match the lick definitions.
+ *
+ * Lick definitions have different resolution elements as function of wavelength.
+ * These definition are hard-coded in this function
+ *
+ * @param w
+ *         wavelength definition in Angstrom
+ * @param flux
+ *         spectra to convert
+ * @param fwhm0
+ *         initial broadening in the spectra `fi`
+ * @param sigma_floor
+ *         minimal dispersion to consider
+ * @return flux_red reduced spectra
+ *
+ */
+DMatrix reduce_resolution(const DMatrix& w, const DMatrix& flux, double fwhm0, double sigma_floor){
+    return reduce_resolution(WavelengthGrid(w, angstrom), flux, fwhm0, sigma_floor);
+}
+
 /**
  * @ingroup LICKS
  * @brief Define a Lick Index similarily to a Filter object
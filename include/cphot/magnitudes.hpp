@@ -0,0 +1,698 @@
+/**
+ * @defgroup MAGNITUDES Magnitudes
+ * @brief Batch conversions between fluxes and magnitudes
+ *
+ * Converts tables of fluxes (objects x filters, row major) to magnitudes in
+ * the Vega, AB or ST systems and back, using the zero points of the filters
+ * (see `cphot::Filter::get_Vega_zero_mag`):
+ *
+ * \f[ mag = -2.5 \log_{10}(f_\lambda) - zp, \quad
+ *     \sigma_{mag} = \frac{2.5}{\ln 10} \left|\frac{\sigma_f}{f}\right| \f]
+ *
+ * The zero points are computed once per filter in a `cphot::ZeroPoints` table.
+ * The flux unit is folded into the zero points, so the values are never
+ * converted. Fluxes per unit frequency (`cphot::FluxDensityType::fnu`, e.g.,
+ * in Jy) are related to \f$f_\lambda\f$ by the pivot wavelength of each
+ * filter, \f$f_\lambda = f_\nu\,c / \lambda_p^2\f$, as in
+ * `cphot::Filter::get_AB_zero_Jy`. The errors, when given, are propagated in
+ * the same pass.
+ *
+ * ```cpp
+ * cphot::ZeroPoints zp(filters);
+ * cphot::DMatrix mag = cphot::flux_to_mag(flux_jy, zp, cphot::MagnitudeSystem::ab, Jy,
+ *                                         cphot::FluxDensityType::fnu);
+ * auto with_errors = cphot::flux_to_mag(flux, flux_err, zp, cphot::MagnitudeSystem::vega);
+ * cphot::DMatrix back = cphot::mag_to_flux(mag, zp, cphot::MagnitudeSystem::ab, Jy,
+ *                                          cphot::FluxDensityType::fnu);
+ * ```
+ *
+ * The logarithms and exponentials are evaluated by branch-free polynomial
+ * kernels that the compiler vectorizes, with the same runtime CPU dispatch
+ * as `cphot::kernels`. They agree with `std::log10` and `std::pow(10, x)`
+ * within a few units in the last place. Zero fluxes give infinite
+ * magnitudes and negative fluxes give NaN, as with `std::log10`.
+ */
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <xtensor/xarray.hpp>
+#include "filter.hpp"
+#include "flux_density.hpp"
+#include "kernels.hpp"
+#include "rquantities.hpp"
+
+namespace cphot {
+
+using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
+
+/**
+ * @ingroup MAGNITUDES
+ * @brief Photometric system of magnitudes
+ */
+enum class MagnitudeSystem { vega, ab, st };
+
+/**
+ * @ingroup MAGNITUDES
+ * @brief Name of a magnitude system
+ *
+ * @param system  magnitude system
+ * @return "vega", "ab" or "st"
+ */
+std::string to_string(MagnitudeSystem system){
+    switch (system){
+        case MagnitudeSystem::ab: return "ab";
+        case MagnitudeSystem::st: return "st";
+        default: return "vega";
+    }
+}
+
+/**
+ * @ingroup MAGNITUDES
+ * @brief Magnitude system from its name (case insensitive)
+ *
+ * @param name  "vega", "ab" or "st"
+ * @return MagnitudeSystem
+ * @throw std::runtime_error if the name is invalid
+ */
+MagnitudeSystem parse_magnitude_system(const std::string& name){
+    std::string lower = name;
+    std::transform(lower.begin(), lower.end(), lower.begin(),
+                   [](unsigned char c){ return std::tolower(c); });
+    for (const auto system: {MagnitudeSystem::vega, MagnitudeSystem::ab, MagnitudeSystem::st}){
+        if (lower.compare(to_string(system)) == 0){
+            return system;
+        }
+    }
+    throw std::runtime_error("only vega, ab and st allowed");
+}
+
+/**
+ * @ingroup MAGNITUDES
+ * @brief Zero point magnitudes of a set of filters in every system
+ *
+ * Column k of a flux table corresponds to filter k.
+ */
+class ZeroPoints {
+    private:
+        std::vector<std::string> names;     ///< name of the filters
+        std::vector<double> vega;           ///< Vega zero points (mag, flam)
+        std::vector<double> ab;             ///< AB zero points (mag, flam)
+        std::vector<double> st;             ///< ST zero points (mag, flam)
+        std::vector<double> lpivot;         ///< pivot wavelengths (angstrom)
+
+    public:
+        ZeroPoints() = default;
+        explicit ZeroPoints(const std::vector<Filter>& filters);
+
+        void add(const Filter& filter);
+        void add(const std::string& name, double vega_mag, double ab_mag, double st_mag,
+                 const QLength& lpivot);
+
+        size_t size() const { return this->names.size(); }
+        const std::vector<std::string>& get_names() const { return this->names; }
+        const std::vector<double>& get_zero_mags(MagnitudeSystem system) const;
+        std::vector<double> get_offsets(MagnitudeSystem system,
+                                        const QSpectralFluxDensity& flux_unit,
+                                        FluxDensityType flux_type=FluxDensityType::flam) const;
+};
+
+/**
+ * @brief Zero points of a set of filters
+ *
+ * @param filters   filters (one column of the flux tables each)
+ */
+ZeroPoints::ZeroPoints(const std::vector<Filter>& filters){
+    for (auto& filter: filters){
+        this->add(filter);
+    }
+}
+
+/**
+ * @brief Append the zero points of a filter
+ *
+ * @param filter  filter
+ */
+void ZeroPoints::add(const Filter& filter){
+    this->add(filter.get_name(), filter.get_Vega_zero_mag(),
+              filter.get_AB_zero_mag(), filter.get_ST_zero_mag(), filter.get_lpivot());
+}
+
+/**
+ * @brief Append precomputed zero points
+ *
+ * @param name      name of the filter
+ * @param vega_mag  Vega zero point (mag, flam)
+ * @param ab_mag    AB zero point (mag, flam)
+ * @param st_mag    ST zero point (mag, flam)
+ * @param lpivot    pivot wavelength (for fluxes per unit frequency)
+ */
+void ZeroPoints::add(const std::string& name, double vega_mag, double ab_mag, double st_mag,
+                     const QLength& lpivot){
+    this->names.push_back(name);
+    this->vega.push_back(vega_mag);
+    this->ab.push_back(ab_mag);
+    this->st.push_back(st_mag);
+    this->lpivot.push_back(lpivot.to(angstrom));
+}
+
+/**
+ * @brief Zero point magnitudes of the filters
+ *
+ * @param system  magnitude system
+ * @return zp such that mag = -2.5 log10(flux in flam) - zp
+ */
+const std::vector<double>& ZeroPoints::get_zero_mags(MagnitudeSystem system) const {
+    switch (system){
+        case MagnitudeSystem::ab: return this->ab;
+        case MagnitudeSystem::st: return this->st;
+        default: return this->vega;
+    }
+}
+
+/**
+ * @brief Zero points for fluxes in a given unit
+ *
+ * Fluxes per unit frequency are converted with the pivot wavelength of each
+ * filter: in erg/s/cm^2/Hz, \f$f_\lambda = f_\nu\,c / \lambda_p^2\f$ (c in
+ * angstrom/s). Photon fluxes have no such relation and are rejected.
+ *
+ * @param system      magnitude system
+ * @param flux_unit   unit of the fluxes
+ * @param flux_type   flux density type of the fluxes (flam or fnu)
+ * @return zp such that mag = -2.5 log10(flux in flux_unit) - zp
+ * @throw std::runtime_error if the fluxes are photon fluxes
+ */
+std::vector<double> ZeroPoints::get_offsets(MagnitudeSystem system,
+                                            const QSpectralFluxDensity& flux_unit,
+                                            FluxDensityType flux_type) const {
+    if ((flux_type != FluxDensityType::flam) && (flux_type != FluxDensityType::fnu)){
+        throw std::runtime_error("magnitudes are defined for flam or fnu fluxes, not "
+                                 + to_string(flux_type));
+    }
+    // Jy is 1e-23 flam, i.e., erg/s/cm^2/Hz are counted as flam
+    const double unit_mag = 2.5 * std::log10(flux_unit.to(flam));
+    const double c = speed_of_light.to(angstrom / second);
+    std::vector<double> offsets = this->get_zero_mags(system);
+    for (size_t k = 0; k < offsets.size(); ++k){
+        offsets[k] += unit_mag;
+        if (flux_type == FluxDensityType::fnu){
+            offsets[k] += 2.5 * std::log10(c / (this->lpivot[k] * this->lpivot[k]));
+        }
+    }
+    return offsets;
+}
+
+namespace kernels {
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+// no fused multiply-add; the selects of special values may evaluate both sides
+#pragma GCC optimize ("fp-contract=off", "no-trapping-math")
+#endif
+
+//! reinterpret the bits of a double
+static inline __attribute__((always_inline))
+uint64_t as_bits(double x){
+    uint64_t b;
+    std::memcpy(&b, &x, sizeof(b));
+    return b;
+}
+
+//! double from its bits
+static inline __attribute__((always_inline))
+double from_bits(uint64_t b){
+    double x;
+    std::memcpy(&x, &b, sizeof(x));
+    return x;
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Branch-free log10(x)
+ *
+ * x = 2^e m with m in [sqrt(1/2), sqrt(2)), and
+ * ln(m) = 2 atanh(s) with s = (m - 1) / (m + 1), |s| < 0.172, evaluated with
+ * the odd series up to s^21. Integer conversions go through the mantissa of
+ * 2^52 so that every operation has a vector equivalent.
+ */
+static inline __attribute__((always_inline))
+double vector_log10(double x){
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+    constexpr double ln2_hi = 6.93147180369123816490e-01;
+    constexpr double ln2_lo = 1.90821492927058770002e-10;
+    constexpr double log10_e = 0.43429448190325182765;
+    constexpr double sqrt2 = 1.41421356237309504880;
+    constexpr double two52 = 4503599627370496.;
+    // subnormals are scaled into the normal range first
+    const bool tiny = x < std::numeric_limits<double>::min();
+    const double xs = x * (tiny ? 18014398509481984. : 1.);  // 2^54
+    const uint64_t bits = as_bits(xs);
+    const double biased = from_bits((bits >> 52) | as_bits(two52)) - two52;
+    double m = from_bits((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+    const bool big = m > sqrt2;
+    m *= big ? 0.5 : 1.;
+    const double e = biased - (tiny ? 1023. + 54. : 1023.) + (big ? 1. : 0.);
+    const double s = (m - 1.) / (m + 1.);
+    const double s2 = s * s;
+    const double p = s2 * (1. / 3. + s2 * (1. / 5. + s2 * (1. / 7. + s2 * (1. / 9. + s2 * (1. / 11.
+                     + s2 * (1. / 13. + s2 * (1. / 15. + s2 * (1. / 17. + s2 * (1. / 19. + s2 * (1. / 21.))))))))));
+    const double ln = e * ln2_hi + ((2. * s + 2. * s * p) + e * ln2_lo);
+    const double result = ln * log10_e;
+    // special values as std::log10
+    const double inf = std::numeric_limits<double>::infinity();
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const bool zero = x == 0.;
+    const bool infinite = x == inf;
+    const bool positive = x > 0.;
+    const double special = zero ? -inf : infinite ? inf : nan;
+    return (positive && ! infinite) ? result : special;
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Branch-free 10^y
+ *
+ * 10^y = 2^k 10^r with k = round(y log2(10)) and |r| <= log10(2) / 2, the
+ * reduction being split in two terms (Cody and Waite). 10^r = exp(r ln 10)
+ * is a Taylor polynomial of degree 13, and 2^k is applied in two factors
+ * so that subnormal results are not flushed.
+ */
+static inline __attribute__((always_inline))
+double vector_exp10(double y){
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+    constexpr double log2_10 = 3.32192809488736234787;
+    constexpr double log10_2_hi = 3.01029995549470186234e-01;   // 32 bits, k * hi is exact
+    constexpr double log10_2_lo = 1.14511008980218380e-10;
+    constexpr double ln10 = 2.30258509299404568402;
+    constexpr double round_shift = 6755399441055744.;    // 1.5 * 2^52
+    constexpr double two52 = 4503599627370496.;
+    const bool low = y < -400.;
+    const bool high = y > 400.;
+    const double yc = low ? -400. : high ? 400. : y;
+    const double k = (yc * log2_10 + round_shift) - round_shift;
+    const double r = (yc - k * log10_2_hi) - k * log10_2_lo;
+    const double z = r * ln10;
+    double p = 1. / 6227020800.;            // 1 / 13!
+    p = 1. / 479001600. + z * p;
+    p = 1. / 39916800. + z * p;
+    p = 1. / 3628800. + z * p;
+    p = 1. / 362880. + z * p;
+    p = 1. / 40320. + z * p;
+    p = 1. / 5040. + z * p;
+    p = 1. / 720. + z * p;
+    p = 1. / 120. + z * p;
+    p = 1. / 24. + z * p;
+    p = 1. / 6. + z * p;
+    p = 0.5 + z * p;
+    p = 1. + z * p;
+    p = 1. + z * p;
+    // 2^k = 2^k1 2^k2 with k1, k2 in [-1022, 1023]
+    const double k1 = (0.5 * k + round_shift) - round_shift;
+    const double k2 = k - k1;
+    const double scale1 = from_bits(as_bits(k1 + (1023. + two52)) << 52);
+    const double scale2 = from_bits(as_bits(k2 + (1023. + two52)) << 52);
+    const double result = (p * scale1) * scale2;
+    return (y != y) ? y : result;
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Body of the flux to magnitude kernel shared by all instruction set variants.
+ *
+ * The table is processed in chunks of whole rows of about `block_size`
+ * values: the logarithms are computed over the flat chunk, n_lanes at a
+ * time, then the zero points and the errors are applied while the chunk is
+ * in cache.
+ *
+ * @param flux      fluxes (n_rows x n_cols, row major)
+ * @param flux_err  flux errors (same layout) or nullptr
+ * @param n_rows    number of objects
+ * @param n_cols    number of filters
+ * @param offset    zero point of every column
+ * @param mag       magnitudes (output)
+ * @param mag_err   magnitude errors (output, unused without flux_err)
+ */
+static inline __attribute__((always_inline))
+void flux_to_mag_body(const double* __restrict flux, const double* __restrict flux_err,
+                      size_t n_rows, size_t n_cols, const double* __restrict offset,
+                      double* __restrict mag, double* __restrict mag_err){
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+    constexpr double pogson = 1.08573620475812959537;     // 2.5 / ln(10)
+    const size_t chunk_rows = std::max<size_t>(1, block_size / std::max<size_t>(1, n_cols));
+    for (size_t row = 0; row < n_rows; row += chunk_rows){
+        const size_t start = row * n_cols;
+        const size_t n = std::min(chunk_rows, n_rows - row) * n_cols;
+        const double* f = flux + start;
+        double* m = mag + start;
+        size_t i = 0;
+        for (; i + n_lanes <= n; i += n_lanes){
+            for (size_t l = 0; l < n_lanes; ++l){
+                m[i + l] = -2.5 * vector_log10(f[i + l]);
+            }
+        }
+        for (; i < n; ++i){
+            m[i] = -2.5 * vector_log10(f[i]);
+        }
+        for (size_t j = 0; j < n; j += n_cols){
+            for (size_t k = 0; k < n_cols; ++k){
+                m[j + k] -= offset[k];
+            }
+        }
+        if (flux_err != nullptr){
+            const double* fe = flux_err + start;
+            double* me = mag_err + start;
+            for (size_t j = 0; j < n; ++j){
+                me[j] = pogson * std::fabs(fe[j] / f[j]);
+            }
+        }
+    }
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Body of the magnitude to flux kernel shared by all instruction set variants.
+ *
+ * Same chunks as `flux_to_mag_body`.
+ *
+ * @param mag       magnitudes (n_rows x n_cols, row major)
+ * @param mag_err   magnitude errors (same layout) or nullptr
+ * @param n_rows    number of objects
+ * @param n_cols    number of filters
+ * @param offset    zero point of every column
+ * @param flux      fluxes (output)
+ * @param flux_err  flux errors (output, unused without mag_err)
+ */
+static inline __attribute__((always_inline))
+void mag_to_flux_body(const double* __restrict mag, const double* __restrict mag_err,
+                      size_t n_rows, size_t n_cols, const double* __restrict offset,
+                      double* __restrict flux, double* __restrict flux_err){
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+    constexpr double inv_pogson = 0.92103403719761827361;  // ln(10) / 2.5
+    const size_t chunk_rows = std::max<size_t>(1, block_size / std::max<size_t>(1, n_cols));
+    for (size_t row = 0; row < n_rows; row += chunk_rows){
+        const size_t start = row * n_cols;
+        const size_t n = std::min(chunk_rows, n_rows - row) * n_cols;
+        const double* m = mag + start;
+        double* f = flux + start;
+        for (size_t j = 0; j < n; j += n_cols){
+            for (size_t k = 0; k < n_cols; ++k){
+                f[j + k] = -0.4 * (m[j + k] + offset[k]);
+            }
+        }
+        size_t i = 0;
+        for (; i + n_lanes <= n; i += n_lanes){
+            for (size_t l = 0; l < n_lanes; ++l){
+                f[i + l] = vector_exp10(f[i + l]);
+            }
+        }
+        for (; i < n; ++i){
+            f[i] = vector_exp10(f[i]);
+        }
+        if (mag_err != nullptr){
+            const double* me = mag_err + start;
+            double* fe = flux_err + start;
+            for (size_t j = 0; j < n; ++j){
+                fe[j] = inv_pogson * me[j] * f[j];
+            }
+        }
+    }
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Portable variant of the flux to magnitude kernel
+ */
+void flux_to_mag_scalar(const double* flux, const double* flux_err, size_t n_rows, size_t n_cols,
+                        const double* offset, double* mag, double* mag_err){
+    flux_to_mag_body(flux, flux_err, n_rows, n_cols, offset, mag, mag_err);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Portable variant of the magnitude to flux kernel
+ */
+void mag_to_flux_scalar(const double* mag, const double* mag_err, size_t n_rows, size_t n_cols,
+                        const double* offset, double* flux, double* flux_err){
+    mag_to_flux_body(mag, mag_err, n_rows, n_cols, offset, flux, flux_err);
+}
+
+#ifdef CPHOT_KERNELS_X86_DISPATCH
+/**
+ * @ingroup KERNELS
+ * @brief AVX2 variant of the flux to magnitude kernel
+ */
+__attribute__((target("avx2")))
+void flux_to_mag_avx2(const double* flux, const double* flux_err, size_t n_rows, size_t n_cols,
+                      const double* offset, double* mag, double* mag_err){
+    flux_to_mag_body(flux, flux_err, n_rows, n_cols, offset, mag, mag_err);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief AVX-512 variant of the flux to magnitude kernel
+ */
+__attribute__((target("avx512f")))
+void flux_to_mag_avx512(const double* flux, const double* flux_err, size_t n_rows, size_t n_cols,
+                        const double* offset, double* mag, double* mag_err){
+    flux_to_mag_body(flux, flux_err, n_rows, n_cols, offset, mag, mag_err);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief AVX2 variant of the magnitude to flux kernel
+ */
+__attribute__((target("avx2")))
+void mag_to_flux_avx2(const double* mag, const double* mag_err, size_t n_rows, size_t n_cols,
+                      const double* offset, double* flux, double* flux_err){
+    mag_to_flux_body(mag, mag_err, n_rows, n_cols, offset, flux, flux_err);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief AVX-512 variant of the magnitude to flux kernel
+ */
+__attribute__((target("avx512f")))
+void mag_to_flux_avx512(const double* mag, const double* mag_err, size_t n_rows, size_t n_cols,
+                        const double* offset, double* flux, double* flux_err){
+    mag_to_flux_body(mag, mag_err, n_rows, n_cols, offset, flux, flux_err);
+}
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+
+/**
+ * @ingroup KERNELS
+ * @brief Magnitudes (and their errors) of a table of fluxes
+ *
+ * @param flux      fluxes (n_rows x n_cols, row major)
+ * @param flux_err  flux errors (same layout) or nullptr
+ * @param n_rows    number of objects
+ * @param n_cols    number of filters
+ * @param offset    zero point of every column
+ * @param mag       magnitudes (output)
+ * @param mag_err   magnitude errors (output, unused without flux_err)
+ * @param level     variant to use (default: best supported by the CPU)
+ */
+void flux_to_mag(const double* flux, const double* flux_err, size_t n_rows, size_t n_cols,
+                 const double* offset, double* mag, double* mag_err,
+                 SimdLevel level=get_simd_level()){
+#ifdef CPHOT_KERNELS_X86_DISPATCH
+    if ((level == SimdLevel::avx512) && __builtin_cpu_supports("avx512f")){
+        return flux_to_mag_avx512(flux, flux_err, n_rows, n_cols, offset, mag, mag_err);
+    }
+    if ((level == SimdLevel::avx2) && __builtin_cpu_supports("avx2")){
+        return flux_to_mag_avx2(flux, flux_err, n_rows, n_cols, offset, mag, mag_err);
+    }
+#endif
+    flux_to_mag_scalar(flux, flux_err, n_rows, n_cols, offset, mag, mag_err);
+}
+
+/**
+ * @ingroup KERNELS
+ * @brief Fluxes (and their errors) of a table of magnitudes
+ *
+ * @param mag       magnitudes (n_rows x n_cols, row major)
+ * @param mag_err   magnitude errors (same layout) or nullptr
+ * @param n_rows    number of objects
+ * @param n_cols    number of filters
+ * @param offset    zero point of every column
+ * @param flux      fluxes (output)
+ * @param flux_err  flux errors (output, unused without mag_err)
+ * @param level     variant to use (default: best supported by the CPU)
+ */
+void mag_to_flux(const double* mag, const double* mag_err, size_t n_rows, size_t n_cols,
+                 const double* offset, double* flux, double* flux_err,
+                 SimdLevel level=get_simd_level()){
+#ifdef CPHOT_KERNELS_X86_DISPATCH
+    if ((level == SimdLevel::avx512) && __builtin_cpu_supports("avx512f")){
+        return mag_to_flux_avx512(mag, mag_err, n_rows, n_cols, offset, flux, flux_err);
+    }
+    if ((level == SimdLevel::avx2) && __builtin_cpu_supports("avx2")){
+        return mag_to_flux_avx2(mag, mag_err, n_rows, n_cols, offset, flux, flux_err);
+    }
+#endif
+    mag_to_flux_scalar(mag, mag_err, n_rows, n_cols, offset, flux, flux_err);
+}
+
+} // namespace kernels
+
+/**
+ * @ingroup MAGNITUDES
+ * @brief Values of a table with their errors
+ */
+struct Measurements {
+    DMatrix values;     ///< magnitudes or fluxes
+    DMatrix errors;     ///< 1-sigma errors (same shape)
+};
+
+/**
+ * @ingroup MAGNITUDES
+ * @brief Number of rows of a table whose last axis runs over the filters
+ *
+ * @param values      table (n_objects x n_filters, or n_filters)
+ * @param n_filters   number of filters
+ * @return number of objects
+ * @throw std::runtime_error if the last axis does not match the filters
+ */
+size_t check_table_shape(const DMatrix& values, size_t n_filters){
+    if ((values.dimension() == 0) || (values.shape().back() != n_filters)){
+        throw std::runtime_error("the last axis must run over the "
+                                 + std::to_string(n_filters) + " filters");
+    }
+    return values.size() / n_filters;
+}
+
+/**
+ * @ingroup MAGNITUDES
+ * @brief Magnitudes of a table of fluxes
+ *
+ * @param flux        fluxes (n_objects x n_filters)
+ * @param zero_points zero points of the filters
+ * @param system      magnitude system
+ * @param flux_unit   unit of the fluxes (default: flam)
+ * @param flux_type   flux density type of the fluxes (flam or fnu, default: flam)
+ * @return magnitudes (same shape)
+ * @throw std::runtime_error if the table does not match the zero points,
+ *        or for photon fluxes
+ */
+DMatrix flux_to_mag(const DMatrix& flux,
+                    const ZeroPoints& zero_points,
+                    MagnitudeSystem system,
+                    const QSpectralFluxDensity& flux_unit=flam,
+                    FluxDensityType flux_type=FluxDensityType::flam){
+    const size_t n_cols = zero_points.size();
+    const size_t n_rows = check_table_shape(flux, n_cols);
+    const std::vector<double> offsets = zero_points.get_offsets(system, flux_unit, flux_type);
+    DMatrix mag = DMatrix::from_shape(flux.shape());
+    kernels::flux_to_mag(flux.data(), nullptr, n_rows, n_cols, offsets.data(), mag.data(), nullptr);
+    return mag;
+}
+
+/**
+ * @ingroup MAGNITUDES
+ * @brief Magnitudes and their errors from a table of fluxes
+ *
+ * @param flux        fluxes (n_objects x n_filters)
+ * @param flux_err    flux errors (same shape and unit)
+ * @param zero_points zero points of the filters
+ * @param system      magnitude system
+ * @param flux_unit   unit of the fluxes (default: flam)
+ * @param flux_type   flux density type of the fluxes (flam or fnu, default: flam)
+ * @return magnitudes and magnitude errors
+ * @throw std::runtime_error if the tables do not match the zero points,
+ *        or for photon fluxes
+ */
+Measurements flux_to_mag(const DMatrix& flux,
+                         const DMatrix& flux_err,
+                         const ZeroPoints& zero_points,
+                         MagnitudeSystem system,
+                         const QSpectralFluxDensity& flux_unit=flam,
+                         FluxDensityType flux_type=FluxDensityType::flam){
+    const size_t n_cols = zero_points.size();
+    const size_t n_rows = check_table_shape(flux, n_cols);
+    if (flux_err.shape() != flux.shape()){
+        throw std::runtime_error("flux errors must have the shape of the fluxes");
+    }
+    const std::vector<double> offsets = zero_points.get_offsets(system, flux_unit, flux_type);
+    Measurements result {DMatrix::from_shape(flux.shape()), DMatrix::from_shape(flux.shape())};
+    kernels::flux_to_mag(flux.data(), flux_err.data(), n_rows, n_cols, offsets.data(),
+                         result.values.data(), result.errors.data());
+    return result;
+}
+
+/**
+ * @ingroup MAGNITUDES
+ * @brief Fluxes of a table of magnitudes
+ *
+ * @param mag         magnitudes (n_objects x n_filters)
+ * @param zero_points zero points of the filters
+ * @param system      magnitude system
+ * @param flux_unit   unit of the fluxes (default: flam)
+ * @param flux_type   flux density type of the fluxes (flam or fnu, default: flam)
+ * @return fluxes in flux_unit (same shape)
+ * @throw std::runtime_error if the table does not match the zero points,
+ *        or for photon fluxes
+ */
+DMatrix mag_to_flux(const DMatrix& mag,
+                    const ZeroPoints& zero_points,
+                    MagnitudeSystem system,
+                    const QSpectralFluxDensity& flux_unit=flam,
+                    FluxDensityType flux_type=FluxDensityType::flam){
+    const size_t n_cols = zero_points.size();
+    const size_t n_rows = check_table_shape(mag, n_cols);
+    const std::vector<double> offsets = zero_points.get_offsets(system, flux_unit, flux_type);
+    DMatrix flux = DMatrix::from_shape(mag.shape());
+    kernels::mag_to_flux(mag.data(), nullptr, n_rows, n_cols, offsets.data(), flux.data(), nullptr);
+    return flux;
+}
+
+/**
+ * @ingroup MAGNITUDES
+ * @brief Fluxes and their errors from a table of magnitudes
+ *
+ * @param mag         magnitudes (n_objects x n_filters)
+ * @param mag_err     magnitude errors (same shape)
+ * @param zero_points zero points of the filters
+ * @param system      magnitude system
+ * @param flux_unit   unit of the fluxes (default: flam)
+ * @param flux_type   flux density type of the fluxes (flam or fnu, default: flam)
+ * @return fluxes and flux errors in flux_unit
+ * @throw std::runtime_error if the tables do not match the zero points,
+ *        or for photon fluxes
+ */
+Measurements mag_to_flux(const DMatrix& mag,
+                         const DMatrix& mag_err,
+                         const ZeroPoints& zero_points,
+                         MagnitudeSystem system,
+                         const QSpectralFluxDensity& flux_unit=flam,
+                         FluxDensityType flux_type=FluxDensityType::flam){
+    const size_t n_cols = zero_points.size();
+    const size_t n_rows = check_table_shape(mag, n_cols);
+    if (mag_err.shape() != mag.shape()){
+        throw std::runtime_error("magnitude errors must have the shape of the magnitudes");
+    }
+    const std::vector<double> offsets = zero_points.get_offsets(system, flux_unit, flux_type);
+    Measurements result {DMatrix::from_shape(mag.shape()), DMatrix::from_shape(mag.shape())};
+    kernels::mag_to_flux(mag.data(), mag_err.data(), n_rows, n_cols, offsets.data(),
+                         result.values.data(), result.errors.data());
+    return result;
+}
+
+} // namespace cphot
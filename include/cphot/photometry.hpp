@@ -0,0 +1,359 @@
+/**
+ * @defgroup PHOTOMETRY Parallel photometry
+ * @brief Photometry of many spectra through many filters on all cores
+ *
+ * `cphot::photometry` computes the (n_spectra, n_filters) table of fluxes
+ * on a `cphot::ThreadPool`. Each filter is first interpolated once on the
+ * common wavelength grid (see `cphot::Filter::get_grid_weights`), so that
+ * every flux is one dot product, with the same values as
+ * `cphot::Filter::get_flux_batch`. The table is then cut into tiles (a block
+ * of spectra times a block of filters): each tile keeps its spectra and
+ * weights in cache while they are multiplied, and each value is computed by
+ * a single dot product, in a single task. The results are therefore
+ * bit-identical whatever the number of threads, the tile sizes or the
+ * scheduling.
+ *
+ * ```cpp
+ * cphot::PhotometryOptions options;
+ * options.n_threads = 16;
+ * options.mode = cphot::IntegrationMode::simpson;
+ * // fluxes (n_spectra, n_filters) in the units of the input flux
+ * cphot::DMatrix fluxes = cphot::photometry(filters, wavelength, flux, nm, flam, options);
+ * ```
+ *
+ * Spectra with their own wavelength (e.g., observed spectra) are given as
+ * ragged arrays: all the wavelengths and fluxes concatenated in two buffers,
+ * and the start of each spectrum in an offsets table (as in
+ * `cphot::FilterBank`). The values are those of `cphot::Filter::get_flux`
+ * without the grid cache, and each thread reuses its own scratch buffers, so
+ * the number of allocations does not grow with the number of spectra.
+ *
+ * ```cpp
+ * // spectrum s: wavelength[offsets[s]:offsets[s+1]], flux[offsets[s]:offsets[s+1]]
+ * cphot::DMatrix fluxes = cphot::photometry(filters, wavelength, flux, offsets, angstrom, flam, options);
+ * ```
+ *
+ * Without `PhotometryOptions::pool`, each call starts and joins its own
+ * threads, so repeated calls (e.g., one per batch of spectra) should share a
+ * pool. Unlike `cphot::PhotometryMatrix`, which
+ * compiles the filters against one wavelength grid, the integration rules
+ * and flux density types of `cphot::Filter::get_flux` are all available.
+ */
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <xtensor/xarray.hpp>
+#include "array_view.hpp"
+#include "filter.hpp"
+#include "flux_density.hpp"
+#include "integration.hpp"
+#include "interpolate.hpp"
+#include "rquantities.hpp"
+#include "thread_pool.hpp"
+
+namespace cphot {
+
+using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
+
+/**
+ * @ingroup PHOTOMETRY
+ * @brief Settings of `cphot::photometry`
+ */
+struct PhotometryOptions {
+    size_t n_threads = 0;           ///< number of threads (0: all cores), ignored with a pool
+    bool pin_threads = false;       ///< bind thread i to CPU first_cpu + i (Linux)
+    size_t first_cpu = 0;           ///< CPU of the first thread when pinning
+    size_t spectra_per_task = 0;    ///< spectra per tile (0: automatic)
+    size_t filters_per_task = 0;    ///< filters per tile (0: automatic)
+    IntegrationMode mode = IntegrationMode::trapezoid;      ///< integration rule
+    FluxDensityType flux_type = FluxDensityType::flam;      ///< flux density type of the spectra
+    ThreadPool* pool = nullptr;     ///< existing pool to run on (recommended for repeated calls)
+};
+
+namespace detail {
+
+/**
+ * @brief Decomposition of a (n_spectra, n_filters) table into tiles
+ *
+ * Tile t covers the spectra block t / n_filter_blocks and the filter block
+ * t % n_filter_blocks, so that consecutive tiles share their spectra.
+ */
+struct PhotometryTiling {
+    size_t spectra_per_task = 1;    ///< spectra per tile
+    size_t filters_per_task = 1;    ///< filters per tile
+    size_t n_spectra_blocks = 0;    ///< number of spectra blocks
+    size_t n_filter_blocks = 0;     ///< number of filter blocks
+
+    size_t n_tasks() const { return this->n_spectra_blocks * this->n_filter_blocks; }
+};
+
+/**
+ * @brief Tile sizes of a photometry table
+ *
+ * Automatic spectra blocks hold about 1 MiB of flux (to stay in the L2
+ * cache) and give each thread several tiles to balance the load. When there
+ * are too few spectra for that, the filters are split as well.
+ *
+ * @param n_spectra         number of spectra
+ * @param n_filters         number of filters
+ * @param bytes_per_spectrum memory read per spectrum
+ * @param n_threads         number of threads
+ * @param options           requested tile sizes (0: automatic)
+ * @return tiling of the table
+ */
+PhotometryTiling make_photometry_tiling(size_t n_spectra, size_t n_filters,
+                                        size_t bytes_per_spectrum, size_t n_threads,
+                                        const PhotometryOptions& options){
+    constexpr size_t tile_bytes = size_t(1) << 20;
+    constexpr size_t tasks_per_thread = 4;
+    const size_t target_tasks = tasks_per_thread * std::max<size_t>(n_threads, 1);
+    auto ceil_div = [](size_t a, size_t b){ return (a + b - 1) / b; };
+
+    PhotometryTiling tiling;
+    if (options.spectra_per_task > 0){
+        tiling.spectra_per_task = options.spectra_per_task;
+    } else {
+        const size_t fit = std::max<size_t>(1, tile_bytes / std::max<size_t>(1, bytes_per_spectrum));
+        tiling.spectra_per_task = std::max<size_t>(1, std::min(fit, ceil_div(n_spectra, target_tasks)));
+    }
+    tiling.n_spectra_blocks = ceil_div(n_spectra, tiling.spectra_per_task);
+    if (options.filters_per_task > 0){
+        tiling.filters_per_task = options.filters_per_task;
+    } else {
+        const size_t n_blocks = std::min(std::max<size_t>(n_filters, 1),
+                                         ceil_div(target_tasks, std::max<size_t>(tiling.n_spectra_blocks, 1)));
+        tiling.filters_per_task = std::max<size_t>(1, ceil_div(n_filters, n_blocks));
+    }
+    tiling.n_filter_blocks = ceil_div(n_filters, tiling.filters_per_task);
+    return tiling;
+}
+
+/**
+ * @brief Number of threads a photometry call runs on
+ *
+ * @param options   pool or thread settings
+ * @return size of the pool, or the requested number of threads (0: all cores)
+ */
+size_t resolve_n_threads(const PhotometryOptions& options){
+    if (options.pool != nullptr){
+        return options.pool->size();
+    }
+    if (options.n_threads > 0){
+        return options.n_threads;
+    }
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+/**
+ * @brief Call func with the pool of the options, or with a pool of its own
+ *
+ * The pool of the call is started and joined here (threads are not kept
+ * between calls).
+ *
+ * @param options       pool or thread settings
+ * @param max_threads   no more threads than this in a new pool (e.g., the number of tasks)
+ * @param func          callable taking a `ThreadPool&`
+ */
+template <typename Func>
+void with_photometry_pool(const PhotometryOptions& options, size_t max_threads, Func&& func){
+    if (options.pool != nullptr){
+        func(*options.pool);
+    } else {
+        ThreadPool pool(std::max<size_t>(1, std::min(resolve_n_threads(options), max_threads)),
+                        options.pin_threads, options.first_cpu);
+        func(pool);
+    }
+}
+
+/**
+ * @brief Run the tiles of a photometry table on a pool
+ *
+ * @param tiling        tiling of the table
+ * @param n_spectra     number of spectra
+ * @param n_filters     number of filters
+ * @param pool          pool running the tiles
+ * @param func          callable (spectrum, filter, worker) computing one value
+ */
+template <typename Func>
+void run_photometry_tiles(const PhotometryTiling& tiling, size_t n_spectra, size_t n_filters,
+                          ThreadPool& pool, Func&& func){
+    auto tile = [&](size_t task, size_t worker){
+        const size_t s_begin = (task / tiling.n_filter_blocks) * tiling.spectra_per_task;
+        const size_t s_end = std::min(s_begin + tiling.spectra_per_task, n_spectra);
+        const size_t k_begin = (task % tiling.n_filter_blocks) * tiling.filters_per_task;
+        const size_t k_end = std::min(k_begin + tiling.filters_per_task, n_filters);
+        for (size_t s = s_begin; s < s_end; ++s){
+            for (size_t k = k_begin; k < k_end; ++k){
+                func(s, k, worker);
+            }
+        }
+    };
+    pool.parallel_for(tiling.n_tasks(), tile);
+}
+
+/**
+ * @brief Call func with the integration policy of a mode
+ *
+ * @param mode  integration mode
+ * @param func  callable taking a policy instance
+ */
+template <typename Func>
+auto dispatch_integration(IntegrationMode mode, Func&& func){
+    switch (mode){
+        case IntegrationMode::simpson:
+            return func(integration::Simpson());
+        case IntegrationMode::exact_linear:
+            return func(integration::ExactLinear());
+        default:
+            return func(integration::Trapezoid());
+    }
+}
+
+} // namespace detail
+
+/**
+ * @ingroup PHOTOMETRY
+ * @brief Photometry of spectra sharing a wavelength definition, in parallel
+ *
+ * Element (s, k) of the result is
+ * `filters[k].get_flux_batch<Integration>(wavelength, flux, wavelength_unit, flux_unit, options.flux_type)[s].to(flux_unit)`
+ * for the integration policy of `options.mode`, bit for bit, for any number
+ * of threads and tile sizes. It matches `cphot::Filter::get_flux` up to
+ * rounding. The weights of each filter are computed once per call, one
+ * filter per task.
+ *
+ * @param filters           filters
+ * @param wavelength        wavelength array (n_wavelength)
+ * @param flux              flux array (n_spectra, n_wavelength) or a single spectrum (n_wavelength)
+ * @param wavelength_unit   wavelength unit
+ * @param flux_unit         flux unit
+ * @param options           threads, tiles, integration rule and flux density type
+ * @return fluxes (n_spectra, n_filters) in flux_unit
+ * @throw std::runtime_error if the flux does not match the wavelength definition,
+ *        if the wavelength is not sorted, or the first error raised by a filter
+ */
+DMatrix photometry(const std::vector<Filter>& filters,
+                   const DMatrix& wavelength,
+                   const DMatrix& flux,
+                   const QLength& wavelength_unit,
+                   const QSpectralFluxDensity& flux_unit,
+                   const PhotometryOptions& options=PhotometryOptions()){
+    const size_t n_wave = wavelength.size();
+    const size_t n_filt = filters.size();
+    const size_t n_spectra = (flux.dimension() == 1) ? 1 : flux.shape()[0];
+    if ((flux.dimension() > 2) || (n_spectra * n_wave != flux.size())) {
+        throw std::runtime_error("flux must be of shape (n_spectra, n_wavelength)");
+    }
+
+    DMatrix result = xt::zeros<double>({n_spectra, n_filt});
+    if ((n_spectra == 0) || (n_filt == 0)){
+        return result;
+    }
+    const detail::PhotometryTiling tiling = detail::make_photometry_tiling(
+        n_spectra, n_filt, n_wave * sizeof(double), detail::resolve_n_threads(options), options);
+
+    // weights of each filter on the common grid, then one dot product per value
+    std::vector<GridWeights> weights(n_filt);
+    const double* flux_data = flux.data();
+    double* result_data = result.data();
+    detail::with_photometry_pool(options, std::max(n_filt, tiling.n_tasks()), [&](ThreadPool& pool){
+        detail::dispatch_integration(options.mode, [&](auto policy){
+            using Integration = decltype(policy);
+            pool.parallel_for(n_filt, [&](size_t k){
+                weights[k] = filters[k].template get_grid_weights<Integration>(
+                    wavelength, wavelength_unit, options.flux_type);
+            });
+        });
+        detail::run_photometry_tiles(tiling, n_spectra, n_filt, pool, [&](size_t s, size_t k, size_t){
+            const std::vector<double>& w = weights[k].values;
+            const double* row = flux_data + s * n_wave + weights[k].offset;
+            double a = 0.;
+            for (size_t i = 0; i < w.size(); ++i){
+                a += w[i] * row[i];
+            }
+            result_data[s * n_filt + k] = (a * flux_unit).to(flux_unit);
+        });
+    });
+    return result;
+}
+
+/**
+ * @ingroup PHOTOMETRY
+ * @brief Photometry of spectra on their own wavelength grids, in parallel
+ *
+ * Spectrum s is defined by `wavelength[offsets[s]:offsets[s+1]]` and
+ * `flux[offsets[s]:offsets[s+1]]` (each sorted by increasing wavelength).
+ * Element (s, k) of the result is the flux of `filters[k].get_flux` on that
+ * spectrum, computed without the grid cache (see the `cphot::Filter::get_flux`
+ * overload taking an `integration::Workspace`), bit for bit, for any number
+ * of threads and tile sizes.
+ *
+ * @param filters           filters
+ * @param wavelength        concatenated wavelengths of the spectra
+ * @param flux              concatenated fluxes of the spectra
+ * @param offsets           start of each spectrum in the buffers (n_spectra + 1)
+ * @param wavelength_unit   wavelength unit
+ * @param flux_unit         flux unit
+ * @param options           threads, tiles, integration rule and flux density type
+ * @return fluxes (n_spectra, n_filters) in flux_unit
+ * @throw std::runtime_error if the offsets do not start at 0, are not sorted or do not end at
+ *        the size of the buffers, if the wavelength of a spectrum is not sorted,
+ *        or the first error raised by a filter
+ */
+DMatrix photometry(const std::vector<Filter>& filters,
+                   const DMatrix& wavelength,
+                   const DMatrix& flux,
+                   const std::vector<size_t>& offsets,
+                   const QLength& wavelength_unit,
+                   const QSpectralFluxDensity& flux_unit,
+                   const PhotometryOptions& options=PhotometryOptions()){
+    if (flux.size() != wavelength.size()){
+        throw std::runtime_error("flux must be defined on the wavelength");
+    }
+    if (offsets.empty() || (offsets.front() != 0) || (offsets.back() != wavelength.size())
+        || (! std::is_sorted(offsets.begin(), offsets.end()))){
+        throw std::runtime_error("offsets must be sorted, start at 0 and end at the size of the buffers");
+    }
+    const size_t n_filt = filters.size();
+    const size_t n_spectra = offsets.size() - 1;
+    for (size_t s = 0; s < n_spectra; ++s){
+        if (! interpolate::is_sorted(wavelength.data() + offsets[s], offsets[s + 1] - offsets[s])){
+            throw std::runtime_error("the wavelength of each spectrum must be sorted");
+        }
+    }
+
+    DMatrix result = xt::zeros<double>({n_spectra, n_filt});
+    if ((n_spectra == 0) || (n_filt == 0)){
+        return result;
+    }
+    const size_t n_threads = detail::resolve_n_threads(options);
+    const size_t mean_size = offsets.back() / n_spectra;
+    const detail::PhotometryTiling tiling = detail::make_photometry_tiling(
+        n_spectra, n_filt, 2 * mean_size * sizeof(double), n_threads, options);
+
+    // scratch buffers of each worker, reused for all of its spectra
+    std::vector<integration::Workspace> workspaces(n_threads);
+    const double* wave_data = wavelength.data();
+    const double* flux_data = flux.data();
+    double* result_data = result.data();
+    detail::with_photometry_pool(options, tiling.n_tasks(), [&](ThreadPool& pool){
+        detail::dispatch_integration(options.mode, [&](auto policy){
+            using Integration = decltype(policy);
+            detail::run_photometry_tiles(tiling, n_spectra, n_filt, pool, [&](size_t s, size_t k, size_t worker){
+                const size_t n = offsets[s + 1] - offsets[s];
+                const ArrayView<double> wave_view(wave_data + offsets[s], n);
+                const ArrayView<double> spectrum(flux_data + offsets[s], n);
+                result_data[s * n_filt + k] = filters[k].template get_flux<Integration>(
+                    wave_view, spectrum, wavelength_unit, flux_unit, options.flux_type,
+                    workspaces[worker]).to(flux_unit);
+            });
+        });
+    });
+    return result;
+}
+
+} // namespace cphot
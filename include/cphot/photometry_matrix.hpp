@@ -0,0 +1,317 @@
+/**
+ * @defgroup PHOTMATRIX Photometry matrix
+ * @brief Compile a set of filters against a wavelength grid.
+ *
+ * Computing the photometry of many spectra in many filters with
+ * `cphot::Filter::get_flux` repeats the interpolation of every filter onto the
+ * spectrum wavelength for each call. When all spectra share the same
+ * wavelength definition (e.g., a grid of models), the integration through each
+ * filter is a linear operator on the flux values. `cphot::PhotometryMatrix`
+ * precomputes these operators once (see `cphot::Filter::get_grid_weights`)
+ * and stores them as a sparse matrix (n_filters x n_wavelength) in which
+ * each row is a contiguous band.
+ *
+ * The photometry of a block of spectra is then a single sparse matrix
+ * product.
+ *
+ * ```cpp
+ * std::vector<cphot::Filter> filters;
+ * for (const auto& name: lib.get_content()){
+ *     filters.push_back(lib.load_filter(name));
+ * }
+ * cphot::PhotometryMatrix pm(filters, wavelength, nm);
+ * // fluxes (n_spectra, n_filters) in the units of the input flux
+ * cphot::DMatrix fluxes = pm.get_flux(flux);
+ * ```
+ *
+ * The weights use the trapezoidal rule unless another integration policy is
+ * given, e.g., `PhotometryMatrix(filters, wavelength, nm, cphot::integration::Simpson())`.
+ * Spectra per unit frequency or in photons are integrated without
+ * conversion by matrices compiled for their `cphot::FluxDensityType`, e.g.,
+ * `PhotometryMatrix(filters, wavelength, nm, cphot::integration::Trapezoid(), cphot::FluxDensityType::fnu)`.
+ *
+ * Precision: `cphot::PhotometryMatrix` stores the weights in double precision
+ * and `cphot::PhotometryMatrixF` in single precision. Both accept single
+ * precision spectra (`cphot::FMatrix`), which halves the memory traffic of
+ * the product, and accumulate in the type given to
+ * `BasicPhotometryMatrix::get_flux` (double by default). For positive
+ * spectra, the relative difference with the double precision fluxes is
+ * bounded by
+ *
+ * - \f$u = 2^{-24} \approx 6\times10^{-8}\f$ per single precision operand
+ *   (weights and/or flux values) with double accumulators,
+ * - plus \f$n\,u\f$ with single precision accumulators, where n is the number
+ *   of non-zero weights of the filter.
+ *
+ * ```cpp
+ * cphot::PhotometryMatrixF pm(filters, wavelength, nm);
+ * cphot::FMatrix fluxes = pm.get_flux<float>(flux32);
+ * ```
+ *
+ * \note When compiled with `CPHOT_USE_BLAS`, `PhotometryMatrix::get_flux_dense`
+ * evaluates the same product with the BLAS `dgemm` routine on the dense version
+ * of the matrix, built on the first call and shared by the copies.
+ */
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <xtensor/xarray.hpp>
+#include "filter.hpp"
+#include "flux_density.hpp"
+#include "rquantities.hpp"
+
+#ifdef CPHOT_USE_BLAS
+extern "C" {
+    // Fortran BLAS interface (column major)
+    void dgemm_(const char* transa, const char* transb,
+                const int* m, const int* n, const int* k,
+                const double* alpha, const double* a, const int* lda,
+                const double* b, const int* ldb,
+                const double* beta, double* c, const int* ldc);
+}
+#endif
+
+namespace cphot {
+
+using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
+
+/**
+ * @ingroup PHOTMATRIX
+ * @brief Sparse (banded rows) weight matrix of a set of filters on a wavelength grid.
+ *
+ * Row `k` holds the normalized integration weights of the k-th filter: the
+ * non-zero values are contiguous from column `first_column[k]` and stored in
+ * `values[row_offsets[k]:row_offsets[k+1]]`.
+ *
+ * The weights are immutable and shared between copies of the matrix. They
+ * are held either in memory or in a file mapped by `cphot::WeightsCache`.
+ *
+ * @tparam Storage  storage type of the weights (double or float)
+ */
+template <typename Storage=double>
+class BasicPhotometryMatrix {
+    private:
+        std::vector<std::string> names;     ///< name of the filters (rows)
+        DMatrix wavelength;                 ///< wavelength definition (columns)
+        QLength wavelength_unit;            ///< unit of the wavelength definition
+        std::vector<size_t> row_offsets;    ///< start of each row in values (n_filters + 1)
+        std::vector<size_t> first_column;   ///< first non-zero column of each row
+        std::shared_ptr<const void> storage; ///< owner of the weights (vector or mapped file)
+        const Storage* values = nullptr;    ///< non-zero weights, row after row
+
+        static constexpr size_t block_size = 64;   ///< number of spectra processed together
+
+#ifdef CPHOT_USE_BLAS
+        //! dense weights in double precision, built once for the BLAS products
+        struct DenseWeights {
+            std::once_flag computed;    ///< guards the one-time conversion
+            DMatrix weights;            ///< weights (n_filters, n_wavelength)
+        };
+        std::shared_ptr<DenseWeights> dense = std::make_shared<DenseWeights>();
+#endif
+
+        BasicPhotometryMatrix(const std::vector<std::string>& names,
+                              const DMatrix& wavelength,
+                              const QLength& wavelength_unit,
+                              const std::vector<size_t>& row_offsets,
+                              const std::vector<size_t>& first_column,
+                              std::shared_ptr<const void> storage,
+                              const Storage* values);
+        friend class WeightsCache;
+
+    public:
+        template <typename Integration=integration::Trapezoid>
+        BasicPhotometryMatrix(const std::vector<Filter>& filters,
+                              const DMatrix& wavelength,
+                              const QLength& wavelength_unit,
+                              Integration integration=Integration(),
+                              FluxDensityType flux_type=FluxDensityType::flam);
+
+        size_t n_filters() const { return this->names.size(); }
+        size_t n_wavelength() const { return this->wavelength.size(); }
+        size_t n_nonzero() const { return this->row_offsets.back(); }
+        const std::vector<std::string>& get_names() const { return this->names; }
+        const DMatrix& get_wavelength() const { return this->wavelength; }
+
+        template <typename Acc=double, typename T=double>
+        xt::xarray<Acc, xt::layout_type::row_major> get_flux(
+            const xt::xarray<T, xt::layout_type::row_major>& flux) const;
+        xt::xarray<Storage, xt::layout_type::row_major> to_dense() const;
+#ifdef CPHOT_USE_BLAS
+        DMatrix get_flux_dense(const DMatrix& flux) const;
+#endif
+};
+
+//! weights in double precision
+using PhotometryMatrix = BasicPhotometryMatrix<double>;
+//! weights in single precision
+using PhotometryMatrixF = BasicPhotometryMatrix<float>;
+
+/**
+ * @brief Compile the filters against a wavelength definition
+ *
+ * @param filters          filters to compile (rows of the matrix)
+ * @param wavelength       wavelength definition of the spectra
+ * @param wavelength_unit  unit of the wavelength definition
+ * @param integration      integration policy (default: trapezoid, see `cphot::integration`)
+ * @param flux_type        flux density type of the spectra (default: flam)
+ */
+template <typename Storage>
+template <typename Integration>
+BasicPhotometryMatrix<Storage>::BasicPhotometryMatrix(const std::vector<Filter>& filters,
+                                                      const DMatrix& wavelength,
+                                                      const QLength& wavelength_unit,
+                                                      Integration /* integration */,
+                                                      FluxDensityType flux_type)
+        : wavelength(wavelength), wavelength_unit(wavelength_unit) {
+
+    auto nonzero = std::make_shared<std::vector<Storage>>();
+    this->row_offsets.push_back(0);
+    for (auto& filter: filters){
+        const GridWeights weights = filter.get_grid_weights<Integration>(wavelength, wavelength_unit,
+                                                                         flux_type);
+        this->names.push_back(filter.get_name());
+        this->first_column.push_back(weights.offset);
+        nonzero->insert(nonzero->end(), weights.values.begin(), weights.values.end());
+        this->row_offsets.push_back(nonzero->size());
+    }
+    this->values = nonzero->data();
+    this->storage = nonzero;
+}
+
+/**
+ * @brief Matrix on existing weights (see `cphot::WeightsCache`)
+ *
+ * @param names            name of the filters (rows)
+ * @param wavelength       wavelength definition (columns)
+ * @param wavelength_unit  unit of the wavelength definition
+ * @param row_offsets      start of each row in values (n_filters + 1)
+ * @param first_column     first non-zero column of each row
+ * @param storage          owner of the weights
+ * @param values           non-zero weights, row after row
+ */
+template <typename Storage>
+BasicPhotometryMatrix<Storage>::BasicPhotometryMatrix(const std::vector<std::string>& names,
+                                                      const DMatrix& wavelength,
+                                                      const QLength& wavelength_unit,
+                                                      const std::vector<size_t>& row_offsets,
+                                                      const std::vector<size_t>& first_column,
+                                                      std::shared_ptr<const void> storage,
+                                                      const Storage* values)
+        : names(names), wavelength(wavelength), wavelength_unit(wavelength_unit),
+          row_offsets(row_offsets), first_column(first_column),
+          storage(std::move(storage)), values(values) {}
+
+/**
+ * @brief Integrate spectra through all the filters
+ *
+ * The spectra are processed in blocks, so that each block stays in cache while
+ * the rows of the matrix are applied to it.
+ *
+ * @tparam Acc  accumulator and output type (default: double)
+ * @tparam T    storage type of the flux (double or float)
+ * @param flux  flux array (n_spectra, n_wavelength) or a single spectrum (n_wavelength)
+ * @return fluxes (n_spectra, n_filters) in the same units as the input flux
+ * @throw std::runtime_error if the flux does not match the wavelength definition
+ */
+template <typename Storage>
+template <typename Acc, typename T>
+xt::xarray<Acc, xt::layout_type::row_major> BasicPhotometryMatrix<Storage>::get_flux(
+        const xt::xarray<T, xt::layout_type::row_major>& flux) const {
+    const size_t n_wave = this->n_wavelength();
+    const size_t n_filt = this->n_filters();
+    const size_t n_spectra = (flux.dimension() == 1) ? 1 : flux.shape()[0];
+    if ((flux.dimension() > 2) || (n_spectra * n_wave != flux.size())) {
+        throw std::runtime_error("flux must be of shape (n_spectra, n_wavelength)");
+    }
+
+    xt::xarray<Acc, xt::layout_type::row_major> result = xt::zeros<Acc>({n_spectra, n_filt});
+    const T * flux_data = flux.data();
+    Acc * result_data = result.data();
+
+    for (size_t block = 0; block < n_spectra; block += block_size){
+        const size_t block_end = std::min(block + block_size, n_spectra);
+        for (size_t k = 0; k < n_filt; ++k){
+            const Storage * weights = this->values + this->row_offsets[k];
+            const size_t n_weights = this->row_offsets[k + 1] - this->row_offsets[k];
+            const size_t offset = this->first_column[k];
+            for (size_t s = block; s < block_end; ++s){
+                const T * row = flux_data + s * n_wave + offset;
+                Acc a = 0.;
+                for (size_t i = 0; i < n_weights; ++i){
+                    a += static_cast<Acc>(weights[i]) * static_cast<Acc>(row[i]);
+                }
+                result_data[s * n_filt + k] = a;
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Dense version of the matrix
+ *
+ * @return weights (n_filters, n_wavelength)
+ */
+template <typename Storage>
+xt::xarray<Storage, xt::layout_type::row_major> BasicPhotometryMatrix<Storage>::to_dense() const {
+    const size_t n_wave = this->n_wavelength();
+    xt::xarray<Storage, xt::layout_type::row_major> dense = xt::zeros<Storage>({this->n_filters(), n_wave});
+    Storage * data = dense.data();
+    for (size_t k = 0; k < this->n_filters(); ++k){
+        std::copy(this->values + this->row_offsets[k],
+                  this->values + this->row_offsets[k + 1],
+                  data + k * n_wave + this->first_column[k]);
+    }
+    return dense;
+}
+
+#ifdef CPHOT_USE_BLAS
+/**
+ * @brief Integrate spectra through all the filters using BLAS
+ *
+ * Same as `PhotometryMatrix::get_flux` but with one `dgemm` call on the dense
+ * matrix (in double precision). This is worth it when the filters cover most
+ * of the wavelength grid. The dense matrix is built on the first call and
+ * kept (n_filters x n_wavelength doubles, shared by the copies of the
+ * matrix), so that repeated batches only pay for the product.
+ *
+ * @param flux  flux array (n_spectra, n_wavelength) or a single spectrum (n_wavelength)
+ * @return fluxes (n_spectra, n_filters) in the same units as the input flux
+ * @throw std::runtime_error if the flux does not match the wavelength definition
+ */
+template <typename Storage>
+DMatrix BasicPhotometryMatrix<Storage>::get_flux_dense(const DMatrix& flux) const {
+    const size_t n_wave = this->n_wavelength();
+    const size_t n_filt = this->n_filters();
+    const size_t n_spectra = (flux.dimension() == 1) ? 1 : flux.shape()[0];
+    if ((flux.dimension() > 2) || (n_spectra * n_wave != flux.size())) {
+        throw std::runtime_error("flux must be of shape (n_spectra, n_wavelength)");
+    }
+    std::call_once(this->dense->computed, [this](){
+        this->dense->weights = this->to_dense();
+    });
+    const DMatrix& weights = this->dense->weights;
+    DMatrix result = xt::zeros<double>({n_spectra, n_filt});
+
+    // row major (n_spectra, n_filters) is column major (n_filters, n_spectra):
+    // result^T = W . flux^T
+    const char transa = 'T';
+    const char transb = 'N';
+    const int m = static_cast<int>(n_filt);
+    const int n = static_cast<int>(n_spectra);
+    const int k = static_cast<int>(n_wave);
+    const double alpha = 1.;
+    const double beta = 0.;
+    dgemm_(&transa, &transb, &m, &n, &k,
+           &alpha, weights.data(), &k, flux.data(), &k,
+           &beta, result.data(), &m);
+    return result;
+}
+#endif
+
+} // namespace cphot
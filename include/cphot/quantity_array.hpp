@@ -0,0 +1,126 @@
+/**
+ * @defgroup QUANTITYARRAY Quantity arrays
+ * @brief Arrays of values with a unit checked at compile time
+ *
+ * A `cphot::QuantityArray<Q>` extends the dimension checks of the scalar
+ * quantities (see `rquantities.hpp`) to arrays. It holds shared, immutable
+ * values together with the unit they are expressed in (a scalar of type
+ * `Q`). Changing units or multiplying by a scalar quantity only changes that
+ * scalar: the values are multiplied once, when they are read with `to`, or
+ * never when they are passed to the photometry functions, which take the
+ * unit as an argument anyway.
+ *
+ * ```cpp
+ * cphot::QuantityArray<QLength> wavelength(wave, angstrom);
+ * cphot::QuantityArray<QSpectralFluxDensity> flux(values, Jy);
+ * auto f = filter.get_flux(wavelength, flux, cphot::FluxDensityType::fnu);
+ * auto nm_values = wavelength.to(nm);       // DMatrix, one multiplication
+ * auto area = wavelength * wavelength[0];   // QuantityArray<QArea>, no copy
+ * // filter.get_flux(flux, wavelength);     // does not compile
+ * ```
+ */
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <xtensor/xarray.hpp>
+#include "rquantities.hpp"
+
+namespace cphot {
+
+/**
+ * @ingroup QUANTITYARRAY
+ * @brief Array of values in a unit of dimension Q
+ *
+ * The element i is the quantity `get_values()[i] * get_unit()`. Copies and
+ * products with scalars share the values.
+ *
+ * @tparam Q  quantity type of the elements (e.g., `QLength`)
+ * @tparam T  storage type of the values (double or float)
+ */
+template <typename Q, typename T=double>
+class QuantityArray {
+    public:
+        using Values = xt::xarray<T, xt::layout_type::row_major>;   ///< storage of the values
+        using quantity_type = Q;                                     ///< quantity type of the elements
+
+        QuantityArray(const Values& values, const Q& unit)
+            : values(std::make_shared<const Values>(values)), unit(unit) {}
+        QuantityArray(Values&& values, const Q& unit)
+            : values(std::make_shared<const Values>(std::move(values))), unit(unit) {}
+        QuantityArray(std::shared_ptr<const Values> values, const Q& unit)
+            : values(std::move(values)), unit(unit) {}
+
+        size_t size() const { return this->values->size(); }
+        const Values& get_values() const { return *this->values; }
+        std::shared_ptr<const Values> get_shared_values() const { return this->values; }
+        const Q& get_unit() const { return this->unit; }
+        Q operator[](size_t i) const { return static_cast<double>((*this->values)[i]) * this->unit; }
+
+        xt::xarray<double, xt::layout_type::row_major> to(const Q& new_unit) const;
+
+    private:
+        std::shared_ptr<const Values> values;   ///< values in the unit
+        Q unit;                                 ///< unit of the values (deferred scale factor)
+};
+
+/**
+ * @brief Values in a given unit
+ *
+ * @param new_unit  requested unit (same dimension)
+ * @return values in new_unit (copied, multiplied only if the units differ)
+ */
+template <typename Q, typename T>
+xt::xarray<double, xt::layout_type::row_major> QuantityArray<Q, T>::to(const Q& new_unit) const {
+    const double factor = this->unit.to(new_unit);
+    xt::xarray<double, xt::layout_type::row_major> result = *this->values;
+    if (factor != 1.){
+        result *= factor;
+    }
+    return result;
+}
+
+/**
+ * @ingroup QUANTITYARRAY
+ * @brief Product of an array and a scalar quantity (e.g., flux times a distance factor)
+ *
+ * @param lhs   array of quantities
+ * @param rhs   scalar quantity
+ * @return array of the product dimension sharing the values of lhs
+ */
+template <typename Q, typename T, typename M, typename l, typename Ti, typename A,
+          typename C, typename L, typename S, typename D>
+auto operator*(const QuantityArray<Q, T>& lhs, const RQuantity<M, l, Ti, A, C, L, S, D>& rhs)
+    -> QuantityArray<decltype(Q() * rhs), T> {
+    return {lhs.get_shared_values(), lhs.get_unit() * rhs};
+}
+
+/**
+ * @ingroup QUANTITYARRAY
+ * @brief Quotient of an array and a scalar quantity
+ *
+ * @param lhs   array of quantities
+ * @param rhs   scalar quantity
+ * @return array of the quotient dimension sharing the values of lhs
+ */
+template <typename Q, typename T, typename M, typename l, typename Ti, typename A,
+          typename C, typename L, typename S, typename D>
+auto operator/(const QuantityArray<Q, T>& lhs, const RQuantity<M, l, Ti, A, C, L, S, D>& rhs)
+    -> QuantityArray<decltype(Q() / rhs), T> {
+    return {lhs.get_shared_values(), lhs.get_unit() / rhs};
+}
+
+/**
+ * @ingroup QUANTITYARRAY
+ * @brief Array scaled by a number
+ *
+ * @param lhs   array of quantities
+ * @param rhs   scale factor
+ * @return array sharing the values of lhs
+ */
+template <typename Q, typename T>
+QuantityArray<Q, T> operator*(const QuantityArray<Q, T>& lhs, double rhs){
+    return {lhs.get_shared_values(), rhs * lhs.get_unit()};
+}
+
+} // namespace cphot
@@ -0,0 +1,173 @@
+/**
+ * @defgroup REFSPEC Reference spectra
+ * @brief Process-wide registry of reference spectra (Vega, Sun, ...)
+ *
+ * Reference spectra are immutable: they are built once per process and shared
+ * by every `cphot::Vega`, `cphot::Sun` or `cphot::Filter` that needs them.
+ *
+ * Each reference spectrum is a `cphot::Spectrum` with its moment index
+ * built, so that the zero point of a filter costs one binary search per
+ * filter knot instead of an interpolation and integration over the entire
+ * reference grid.
+ *
+ * Built-in spectra:
+ * - `vega`: Vega synthetic spectrum from Bohlin 2007
+ * - `sun_theoretical`: Kurucz'93 model of the Sun at 1 au
+ * - `sun_observed`: observed solar spectrum at 1 au (calspec)
+ *
+ * Users can register their own with `cphot::register_reference_spectrum`.
+ */
+#pragma once
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <xtensor/xadapt.hpp>
+#include <xtensor/xarray.hpp>
+#include "rquantities.hpp"
+#include "spectrum.hpp"
+#include <cphot/hardcoded_data/vega_data.hpp>
+#include <cphot/hardcoded_data/sun_data.hpp>
+
+namespace cphot {
+
+using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
+
+/**
+ * @ingroup REFSPEC
+ * @brief Named immutable spectrum with its moment index always built.
+ */
+class ReferenceSpectrum: public Spectrum {
+    public:
+        ReferenceSpectrum(const std::string& name,
+                          const DMatrix& wavelength,
+                          const DMatrix& flux,
+                          const QLength& wavelength_unit,
+                          const QSpectralFluxDensity& flux_unit);
+
+        std::string get_name() const { return this->name; }
+
+    private:
+        std::string name;         ///< name of the spectrum
+};
+
+/**
+ * @brief Construct a new Reference Spectrum and its cumulative integrals
+ *
+ * @param name             name of the spectrum
+ * @param wavelength       wavelength array (sorted)
+ * @param flux             flux array
+ * @param wavelength_unit  wavelength unit
+ * @param flux_unit        flux unit
+ * @throw std::runtime_error if the arrays do not match or are not sorted
+ */
+ReferenceSpectrum::ReferenceSpectrum(const std::string& name,
+                                     const DMatrix& wavelength,
+                                     const DMatrix& flux,
+                                     const QLength& wavelength_unit,
+                                     const QSpectralFluxDensity& flux_unit)
+        : Spectrum(wavelength, flux, wavelength_unit, flux_unit, true),
+          name(name) {}
+
+/**
+ * @ingroup REFSPEC
+ * @brief Storage of the registered reference spectra
+ */
+struct ReferenceSpectraRegistry {
+    std::mutex lock;    ///< guards the content
+    std::map<std::string, std::shared_ptr<const ReferenceSpectrum>> content;   ///< registered spectra
+
+    ReferenceSpectraRegistry(){
+        auto add = [this](const std::string& name,
+                          const std::vector<double>& wavelength,
+                          const std::vector<double>& flux,
+                          const QLength& wavelength_unit,
+                          const QSpectralFluxDensity& flux_unit){
+            std::vector<std::size_t> shape = { wavelength.size() };
+            this->content[name] = std::make_shared<const ReferenceSpectrum>(
+                name, xt::adapt(wavelength, shape), xt::adapt(flux, shape),
+                wavelength_unit, flux_unit);
+        };
+        add("vega", cphot_vega::wavelength_nm, cphot_vega::flux_flam, nm, flam);
+        add("sun_theoretical",
+            cphot_sun_theoretical::wavelength, cphot_sun_theoretical::flux,
+            cphot_sun_theoretical::wavelength_unit, cphot_sun_theoretical::flux_unit);
+        add("sun_observed",
+            cphot_sun_observed::wavelength, cphot_sun_observed::flux,
+            cphot_sun_observed::wavelength_unit, cphot_sun_observed::flux_unit);
+    }
+};
+
+/**
+ * @ingroup REFSPEC
+ * @brief The process-wide registry (built on first use)
+ */
+ReferenceSpectraRegistry& get_reference_spectra_registry(){
+    static ReferenceSpectraRegistry registry;
+    return registry;
+}
+
+/**
+ * @ingroup REFSPEC
+ * @brief Get a registered reference spectrum
+ *
+ * @param name  name of the spectrum (e.g., "vega")
+ * @return shared immutable spectrum
+ * @throw std::runtime_error if the name is not registered
+ */
+std::shared_ptr<const ReferenceSpectrum> get_reference_spectrum(const std::string& name){
+    auto& registry = get_reference_spectra_registry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    auto found = registry.content.find(name);
+    if (found == registry.content.end()){
+        throw std::runtime_error("Reference spectrum " + name + " not registered");
+    }
+    return found->second;
+}
+
+/**
+ * @ingroup REFSPEC
+ * @brief Register (or replace) a reference spectrum
+ *
+ * Spectra already handed out remain valid when they are replaced.
+ *
+ * @param name             name of the spectrum
+ * @param wavelength       wavelength array (sorted)
+ * @param flux             flux array
+ * @param wavelength_unit  wavelength unit
+ * @param flux_unit        flux unit
+ * @return the registered spectrum
+ */
+std::shared_ptr<const ReferenceSpectrum> register_reference_spectrum(
+        const std::string& name,
+        const DMatrix& wavelength,
+        const DMatrix& flux,
+        const QLength& wavelength_unit,
+        const QSpectralFluxDensity& flux_unit){
+    auto spectrum = std::make_shared<const ReferenceSpectrum>(
+        name, wavelength, flux, wavelength_unit, flux_unit);
+    auto& registry = get_reference_spectra_registry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    registry.content[name] = spectrum;
+    return spectrum;
+}
+
+/**
+ * @ingroup REFSPEC
+ * @brief Names of the registered reference spectra
+ *
+ * @return std::vector<std::string> names
+ */
+std::vector<std::string> get_reference_spectra_names(){
+    auto& registry = get_reference_spectra_registry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    std::vector<std::string> names;
+    for (const auto& entry: registry.content){
+        names.push_back(entry.first);
+    }
+    return names;
+}
+
+} // namespace cphot
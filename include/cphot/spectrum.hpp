@@ -0,0 +1,254 @@
+/**
+ * @defgroup SPECTRUM Spectrum
+ * @brief Spectra with optional cumulative integrals for fast band integrations
+ *
+ * A `cphot::Spectrum` stores a wavelength (nm) and flux (flam) definition.
+ * It can optionally build a moment index: the cumulative sums of the
+ * trapezoidal integrands \f$f\f$, \f$\lambda f\f$, \f$\lambda^2 f\f$ and
+ * \f$\lambda^3 f\f$ (and the same without \f$f\f$) over its grid.
+ *
+ * For a piecewise-linear transmission \f$T(\lambda) = \alpha_k + \beta_k
+ * \lambda\f$ between two knots, the integral of \f$\lambda^p T f\f$ over that
+ * segment is then \f$\alpha_k \Delta F_p + \beta_k \Delta F_{p+1}\f$. The
+ * integration of a passband (filter, box, Lick band) therefore costs one
+ * binary search per knot, regardless of the length of the spectrum.
+ *
+ * ```cpp
+ * cphot::Spectrum spec(wavelength, flux, angstrom, flam, true);
+ * for (auto& filter: filters){
+ *      auto f = filter.get_flux(spec);
+ * }
+ * // mean flux in a box
+ * auto f_band = spec.get_mean_flux(4847.875 * angstrom, 4876.625 * angstrom);
+ * ```
+ *
+ * \note The results are identical (to rounding) to interpolating the
+ * passband on the spectrum wavelength and integrating with the trapezoidal
+ * rule. The index is stored in double precision, so a band covering a small
+ * fraction \f$\epsilon\f$ of a very long spectrum has a relative precision of
+ * order \f$10^{-16} / \epsilon\f$.
+ */
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <xtensor/xarray.hpp>
+#include "rquantities.hpp"
+
+namespace cphot {
+
+using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
+
+/**
+ * @ingroup SPECTRUM
+ * @brief Spectrum with an optional moment index.
+ */
+class Spectrum {
+    public:
+        //! highest power of λ available in `Spectrum::moment`
+        static constexpr size_t max_power = 2;
+
+        Spectrum(const DMatrix& wavelength,
+                 const DMatrix& flux,
+                 const QLength& wavelength_unit,
+                 const QSpectralFluxDensity& flux_unit,
+                 bool with_index=false);
+
+        const DMatrix& get_wavelength() const { return this->wavelength_nm; }
+        const DMatrix& get_flux() const { return this->flux_flam; }
+        size_t size() const { return this->wavelength_nm.size(); }
+
+        void build_index();
+        bool has_index() const { return this->indexed; }
+
+        double moment(const DMatrix& knots_nm,
+                      const DMatrix& values,
+                      size_t power,
+                      bool flux_weighted=true) const;
+        QSpectralFluxDensity get_mean_flux(const QLength& lmin,
+                                           const QLength& lmax) const;
+
+    protected:
+        DMatrix wavelength_nm;    ///< Wavelength in nm
+        DMatrix flux_flam;        ///< flux in flam
+        bool indexed = false;     ///< whether the cumulative sums are available
+        //! cumulative sums of λ^p f dλ (p = 0..3) over the grid nodes
+        std::array<std::vector<double>, max_power + 2> flux_prefix;
+        //! cumulative sums of λ^p dλ (p = 0..3) over the grid nodes
+        std::array<std::vector<double>, max_power + 2> grid_prefix;
+
+        double node_sum(size_t start, size_t end, double alpha, double beta,
+                        size_t power, bool flux_weighted) const;
+};
+
+/**
+ * @brief Construct a new Spectrum
+ *
+ * Non finite flux values (e.g., missing parts of a model) are considered
+ * missing and do not contribute to the integrals.
+ *
+ * @param wavelength       wavelength array (sorted)
+ * @param flux             flux array
+ * @param wavelength_unit  wavelength unit
+ * @param flux_unit        flux unit
+ * @param with_index       build the cumulative integrals immediately
+ * @throw std::runtime_error if the arrays do not match or are not sorted
+ */
+Spectrum::Spectrum(const DMatrix& wavelength,
+                   const DMatrix& flux,
+                   const QLength& wavelength_unit,
+                   const QSpectralFluxDensity& flux_unit,
+                   bool with_index) {
+    if (wavelength.size() != flux.size()){
+        throw std::runtime_error("Spectrum: wavelength and flux sizes differ");
+    }
+    if (! std::is_sorted(wavelength.begin(), wavelength.end())){
+        throw std::runtime_error("Spectrum: wavelength must be sorted");
+    }
+    this->wavelength_nm = wavelength * wavelength_unit.to(nm);
+    this->flux_flam = flux * flux_unit.to(flam);
+    if (with_index){
+        this->build_index();
+    }
+}
+
+/**
+ * @brief Build the cumulative sums of the trapezoidal integrands
+ *
+ * Costs one pass over the spectrum and 8 doubles per wavelength point.
+ */
+void Spectrum::build_index(){
+    // trapz(y, x) = sum_i y_i * dx_i with dx_i = (x_{i+1} - x_{i-1}) / 2
+    const auto& x = this->wavelength_nm;
+    const auto& f = this->flux_flam;
+    const size_t n = x.size();
+    for (size_t p = 0; p <= max_power + 1; ++p){
+        this->flux_prefix[p].assign(n + 1, 0.);
+        this->grid_prefix[p].assign(n + 1, 0.);
+    }
+    std::array<long double, max_power + 2> flux_acc {};
+    std::array<long double, max_power + 2> grid_acc {};
+    for (size_t i = 0; i < n; ++i){
+        double dx = (n > 1) ? 0.5 * (x[std::min(i + 1, n - 1)] - x[(i > 0) ? i - 1 : 0]) : 0.;
+        double fi = std::isfinite(f[i]) ? f[i] : 0.;
+        double xp = 1.;
+        for (size_t p = 0; p <= max_power + 1; ++p){
+            grid_acc[p] += xp * dx;
+            flux_acc[p] += xp * fi * dx;
+            this->grid_prefix[p][i + 1] = static_cast<double>(grid_acc[p]);
+            this->flux_prefix[p][i + 1] = static_cast<double>(flux_acc[p]);
+            xp *= x[i];
+        }
+    }
+    this->indexed = true;
+}
+
+/**
+ * @brief Sum of (alpha + beta x_i) x_i^p [f_i] dx_i over nodes [start, end)
+ *
+ * Short ranges (or all ranges without index) are summed directly, which is
+ * both cheaper and more accurate than differencing the cumulative sums.
+ */
+double Spectrum::node_sum(size_t start, size_t end, double alpha, double beta,
+                          size_t power, bool flux_weighted) const {
+    constexpr size_t direct_threshold = 32;
+    if (this->indexed && (end - start > direct_threshold)){
+        const auto& prefix = flux_weighted ? this->flux_prefix : this->grid_prefix;
+        return alpha * (prefix[power][end] - prefix[power][start])
+             + beta * (prefix[power + 1][end] - prefix[power + 1][start]);
+    }
+    const auto& x = this->wavelength_nm;
+    const auto& f = this->flux_flam;
+    const size_t n = x.size();
+    double total = 0.;
+    for (size_t i = start; i < end; ++i){
+        double dx = 0.5 * (x[std::min(i + 1, n - 1)] - x[(i > 0) ? i - 1 : 0]);
+        double y = (alpha + beta * x[i]) * std::pow(x[i], power) * dx;
+        if (flux_weighted){
+            y *= std::isfinite(f[i]) ? f[i] : 0.;
+        }
+        total += y;
+    }
+    return total;
+}
+
+/**
+ * @brief Integral of a piecewise-linear curve times λ^p (times the flux)
+ *
+ * Computes
+ * \f[ \int \lambda^p T(\lambda) f(\lambda) d\lambda \f]
+ * (or \f$\int \lambda^p T(\lambda) d\lambda\f$ if `flux_weighted` is false)
+ * where \f$T\f$ is the linear interpolation of (knots_nm, values) and zero
+ * outside of the knots. The result is identical to interpolating \f$T\f$ onto
+ * the spectrum wavelength and integrating with the trapezoidal rule.
+ *
+ * With the index, the cost is one binary search per knot. Without it, only
+ * the nodes within the knots are visited.
+ *
+ * @param knots_nm        sorted wavelengths of the curve in nm
+ * @param values          values of the curve at the knots
+ * @param power           power p of λ (0 <= p <= max_power)
+ * @param flux_weighted   include the flux of the spectrum in the integrand
+ * @return the integral (in flam nm^(p+1) or nm^(p+1))
+ */
+double Spectrum::moment(const DMatrix& knots_nm,
+                        const DMatrix& values,
+                        size_t power,
+                        bool flux_weighted) const {
+    if (power > max_power){
+        throw std::runtime_error("Spectrum::moment: power must be <= "
+                                 + std::to_string(max_power));
+    }
+    const size_t n_knots = knots_nm.size();
+    if (n_knots < 2){
+        return 0.;
+    }
+    const auto x_begin = this->wavelength_nm.cbegin();
+    const auto x_end = this->wavelength_nm.cend();
+
+    double total = 0.;
+    auto start = std::lower_bound(x_begin, x_end, knots_nm[0]);
+    for (size_t k = 0; k + 1 < n_knots; ++k){
+        const double x0 = knots_nm[k];
+        const double x1 = knots_nm[k + 1];
+        // nodes in [x0, x1), the last segment also includes x1
+        auto end = (k + 2 == n_knots) ? std::upper_bound(start, x_end, x1)
+                                      : std::lower_bound(start, x_end, x1);
+        if ((end > start) && (x1 > x0)){
+            const double beta = (values[k + 1] - values[k]) / (x1 - x0);
+            const double alpha = values[k] - beta * x0;
+            total += this->node_sum(start - x_begin, end - x_begin,
+                                    alpha, beta, power, flux_weighted);
+        }
+        start = end;
+    }
+    return total;
+}
+
+/**
+ * @brief Mean flux within a box passband [lmin, lmax]
+ *
+ * Useful for the bands and continua of Lick indices (see
+ * `cphot_licks::lickdefs`).
+ *
+ * \f[ \bar{f} = \frac{\int_{l_{min}}^{l_{max}} f d\lambda}{\int_{l_{min}}^{l_{max}} d\lambda} \f]
+ *
+ * @param lmin   lower edge of the box
+ * @param lmax   upper edge of the box
+ * @return mean flux (0 if the box contains no wavelength point)
+ */
+QSpectralFluxDensity Spectrum::get_mean_flux(const QLength& lmin,
+                                             const QLength& lmax) const {
+    const DMatrix knots {lmin.to(nm), lmax.to(nm)};
+    const DMatrix box {1., 1.};
+    double norm = this->moment(knots, box, 0, false);
+    if (norm <= 0){
+        return 0. * flam;
+    }
+    return this->moment(knots, box, 0) / norm * flam;
+}
+
+} // namespace cphot
@@ -27,7 +27,8 @@
 #include <string>
 #include <xtensor/xadapt.hpp>
 #include <xtensor/xarray.hpp>
-#include <cphot/hardcoded_data/sun_data.hpp>
+#include "quantity_array.hpp"
+#include "reference_spectra.hpp"
 
 
 
@@ -39,11 +40,12 @@ using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
  * @ingroup SUN
  * @brief Class that handles the Sun's spectrum and references.
  *
+ * The spectra are the shared `sun_theoretical` and `sun_observed` reference
+ * spectra (see `cphot::get_reference_spectrum`), given at 1 au.
  */
 class Sun{
     private:
-        DMatrix wavelength_nm;       ///< Wavelength in nm
-        DMatrix flux_flam;           ///< flux in flam
+        std::shared_ptr<const ReferenceSpectrum> spectrum;   ///< wavelength in nm and flux in flam at 1 au
         QLength distance;            ///< distance to the sun
         double distance_conversion;  ///< conversion factor for distance
 
@@ -51,10 +53,13 @@ class Sun{
         Sun(const QLength & distance=1 * au,
             const std::string & flavor="theoretical");
 
-        DMatrix get_wavelength();
-        DMatrix get_wavelength(const QLength& in);
-        DMatrix get_flux();
-        DMatrix get_flux(const QSpectralFluxDensity& in);
+        const DMatrix& get_wavelength() const;
+        DMatrix get_wavelength(const QLength& in) const;
+        DMatrix get_flux() const;
+        DMatrix get_flux(const QSpectralFluxDensity& in) const;
+        QuantityArray<QLength> get_wavelength_quantity() const;
+        QuantityArray<QSpectralFluxDensity> get_flux_quantity() const;
+        std::shared_ptr<const ReferenceSpectrum> get_spectrum() const;
 
 };
 
@@ -69,17 +74,12 @@ Sun::Sun(const QLength & distance,
 
     this->distance = distance;
     if (flavor.compare("theoretical") == 0){
-        // read the theoretical spectrum
-        this->wavelength_nm = xt::adapt(cphot_sun_theoretical::wavelength) * cphot_sun_theoretical::wavelength_unit.to(nm);
-        this->flux_flam = xt::adapt(cphot_sun_theoretical::flux) * cphot_sun_theoretical::flux_unit.to(flam);
-        // distance_conversion = (default distance / distance) ** 2
-        this->distance_conversion = std::pow((cphot_sun_theoretical::distance/distance).value, 2);
+        this->spectrum = get_reference_spectrum("sun_theoretical");
     } else {
-        // read the theoretical spectrum
-        this->wavelength_nm = xt::adapt(cphot_sun_observed::wavelength) * cphot_sun_observed::wavelength_unit.to(nm);
-        this->flux_flam = xt::adapt(cphot_sun_observed::flux) * cphot_sun_observed::flux_unit.to(flam);
-        this->distance_conversion = std::pow((cphot_sun_theoretical::distance/distance).value, 2);
+        this->spectrum = get_reference_spectrum("sun_observed");
     }
+    // distance_conversion = (default distance / distance) ** 2
+    this->distance_conversion = std::pow((cphot_sun_theoretical::distance/distance).value, 2);
 }
 
 /**
@@ -87,8 +87,8 @@ Sun::Sun(const QLength & distance,
  *
  * @return Sun wavelength in nm
  */
-DMatrix Sun::get_wavelength() {
-    return this->wavelength_nm;
+const DMatrix& Sun::get_wavelength() const {
+    return this->spectrum->get_wavelength();
 }
 
 /**
@@ -97,17 +97,20 @@ DMatrix Sun::get_wavelength() {
  * @param in  requested units for the wavelength
  * @return Sun wavelength units of in
  */
-DMatrix Sun::get_wavelength(const QLength& in) {
-    return this->wavelength_nm * nm.to(in);
+DMatrix Sun::get_wavelength(const QLength& in) const {
+    return this->spectrum->get_wavelength() * nm.to(in);
 }
 
 /**
  * @brief Get the internal flux in flam
  *
+ * The flux is scaled to the distance of the object, hence copied. The flux at
+ * 1 au is `get_spectrum()->get_flux()`, without copy.
+ *
  * @return Sun flux in flam
  */
-DMatrix Sun::get_flux() {
-    return this->flux_flam * this->distance_conversion;
+DMatrix Sun::get_flux() const {
+    return this->spectrum->get_flux() * this->distance_conversion;
 }
 
 /**
@@ -116,8 +119,38 @@ DMatrix Sun::get_flux() {
  * @param in  requested units for the flux
  * @return Sun flux units of in
  */
-DMatrix Sun::get_flux(const QSpectralFluxDensity& in) {
-    return this->flux_flam * flam.to(in) * this->distance_conversion;;
+DMatrix Sun::get_flux(const QSpectralFluxDensity& in) const {
+    return this->spectrum->get_flux() * flam.to(in) * this->distance_conversion;
+}
+
+/**
+ * @brief Get the internal wavelength with its unit
+ *
+ * @return wavelength in nm, sharing the reference spectrum data
+ */
+QuantityArray<QLength> Sun::get_wavelength_quantity() const {
+    return {std::shared_ptr<const DMatrix>(this->spectrum, &this->spectrum->get_wavelength()), nm};
+}
+
+/**
+ * @brief Get the flux at the distance of the Sun with its unit
+ *
+ * The distance scaling is part of the unit, the values are the ones of the
+ * spectrum at 1 au (not copied).
+ *
+ * @return flux in flam (scaled to the distance)
+ */
+QuantityArray<QSpectralFluxDensity> Sun::get_flux_quantity() const {
+    return {std::shared_ptr<const DMatrix>(this->spectrum, &this->spectrum->get_flux()), this->distance_conversion * flam};
+}
+
+/**
+ * @brief Get the underlying reference spectrum (at 1 au)
+ *
+ * @return shared immutable spectrum with its cumulative integrals
+ */
+std::shared_ptr<const ReferenceSpectrum> Sun::get_spectrum() const {
+    return this->spectrum;
 }
 
 
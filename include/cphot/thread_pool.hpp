@@ -0,0 +1,280 @@
+/**
+ * @defgroup THREADPOOL Thread pool
+ * @brief Fixed set of worker threads with work stealing
+ *
+ * `cphot::ThreadPool` runs the independent tasks of a `parallel_for` on a
+ * fixed number of threads. The tasks are first split into one contiguous
+ * range per worker, so that neighbouring tasks (e.g., tiles of the same
+ * spectra) run on the same core. A worker that runs out of tasks steals
+ * the last ones of another worker's range.
+ *
+ * ```cpp
+ * cphot::ThreadPool pool(8);               // 8 workers, not pinned
+ * pool.parallel_for(n_tasks, [&](size_t task){ ... });
+ * // with the index of the worker in [0, pool.size()), e.g., for scratch buffers
+ * pool.parallel_for(n_tasks, [&](size_t task, size_t worker){ ... });
+ * ```
+ *
+ * The threads are created once and wait between calls, so a pool can be
+ * reused for many batches. A task may call `parallel_for` on its own pool
+ * (e.g., photometry of a library from inside a parallel loop): the nested
+ * loop then runs on the calling worker. Workers can be pinned to consecutive CPUs
+ * (Linux only) to stay within the cores given to a process, e.g., one MPI
+ * rank per node or per socket.
+ */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cphot {
+
+/**
+ * @ingroup THREADPOOL
+ * @brief Worker threads running parallel loops of independent tasks
+ *
+ * One `parallel_for` runs at a time (concurrent calls are serialized). A
+ * pool of a single thread runs the tasks on the calling thread, and so does
+ * a `parallel_for` called from a task of the same pool, with the index of
+ * the calling worker, instead of waiting for the running loop.
+ */
+class ThreadPool {
+    public:
+        explicit ThreadPool(size_t n_threads=0, bool pin_threads=false, size_t first_cpu=0);
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        size_t size() const { return this->n_threads; }
+
+        template <typename Func>
+        void parallel_for(size_t n_tasks, Func&& func);
+
+    private:
+        /**
+         * @brief Tasks of one worker, taken from the front by the owner and
+         * from the back by thieves.
+         */
+        struct TaskQueue {
+            std::mutex lock;            ///< guards the tasks
+            std::deque<size_t> tasks;   ///< indices of the remaining tasks
+        };
+
+        //! pool and index of the worker running on a thread
+        struct CurrentWorker {
+            const ThreadPool* pool = nullptr;   ///< pool of the thread (none outside workers)
+            size_t worker = 0;                  ///< index of the worker in the pool
+        };
+
+        size_t n_threads = 1;                               ///< number of workers
+        std::vector<std::thread> workers;                   ///< worker threads (none for 1)
+        std::vector<std::unique_ptr<TaskQueue>> queues;     ///< one queue per worker
+        std::mutex run_lock;                                ///< serializes parallel_for
+        std::mutex lock;                                    ///< guards the job state below
+        std::condition_variable job_ready;                  ///< a job started or the pool stops
+        std::condition_variable job_done;                   ///< the last worker finished
+        std::function<void(size_t, size_t)> job;            ///< task of the current job (task, worker)
+        size_t generation = 0;                              ///< number of jobs started
+        size_t running = 0;                                 ///< workers still in the current job
+        bool stopping = false;                              ///< the pool is destroyed
+        std::exception_ptr error;                           ///< first exception of the job
+        std::atomic<bool> failed{false};                    ///< a task of the job threw
+
+        static CurrentWorker& current_worker();
+        void worker_loop(size_t worker, bool pin_thread, size_t cpu);
+        bool next_task(size_t worker, size_t& task);
+};
+
+/**
+ * @brief Start the worker threads
+ *
+ * @param n_threads     number of workers (0: std::thread::hardware_concurrency)
+ * @param pin_threads   bind worker i to CPU first_cpu + i (Linux only)
+ * @param first_cpu     CPU of the first worker
+ */
+ThreadPool::ThreadPool(size_t n_threads, bool pin_threads, size_t first_cpu){
+    if (n_threads == 0){
+        n_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    this->n_threads = n_threads;
+    if (n_threads == 1){
+        return;
+    }
+    for (size_t w = 0; w < n_threads; ++w){
+        this->queues.push_back(std::make_unique<TaskQueue>());
+    }
+    for (size_t w = 0; w < n_threads; ++w){
+        this->workers.emplace_back(&ThreadPool::worker_loop, this, w, pin_threads, first_cpu + w);
+    }
+}
+
+/**
+ * @brief Stop and join the worker threads
+ */
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->job_ready.notify_all();
+    for (auto& worker: this->workers){
+        worker.join();
+    }
+}
+
+/**
+ * @brief Run func(task) for every task in [0, n_tasks)
+ *
+ * Returns when all the tasks are done. Each task runs exactly once, on any
+ * worker, so func must only write to outputs owned by its task, or to
+ * per-worker state when it also takes the index of the worker. Called from
+ * a task of this pool, the tasks run in order on the calling worker.
+ *
+ * @param n_tasks   number of tasks
+ * @param func      callable (task) or (task, worker)
+ * @throw the first exception thrown by a task (the remaining tasks are skipped)
+ */
+template <typename Func>
+void ThreadPool::parallel_for(size_t n_tasks, Func&& func){
+    if (n_tasks == 0){
+        return;
+    }
+    auto call = [&func](size_t task, size_t worker){
+        if constexpr (std::is_invocable<Func&, size_t, size_t>::value){
+            func(task, worker);
+        } else {
+            (void) worker;
+            func(task);
+        }
+    };
+    const CurrentWorker& current = current_worker();
+    if (this->workers.empty() || (current.pool == this)){
+        const size_t worker = (current.pool == this) ? current.worker : 0;
+        for (size_t task = 0; task < n_tasks; ++task){
+            call(task, worker);
+        }
+        return;
+    }
+    std::lock_guard<std::mutex> run_guard(this->run_lock);
+    const size_t n_workers = this->workers.size();
+    for (size_t w = 0; w < n_workers; ++w){
+        TaskQueue& queue = *this->queues[w];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        for (size_t task = w * n_tasks / n_workers; task < (w + 1) * n_tasks / n_workers; ++task){
+            queue.tasks.push_back(task);
+        }
+    }
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->job = call;
+    this->error = nullptr;
+    this->failed.store(false, std::memory_order_relaxed);
+    this->running = n_workers;
+    ++this->generation;
+    this->job_ready.notify_all();
+    this->job_done.wait(guard, [this](){ return this->running == 0; });
+    this->job = nullptr;
+    if (this->error){
+        std::rethrow_exception(this->error);
+    }
+}
+
+/**
+ * @brief Next task of a worker, its own first and then stolen
+ *
+ * @param worker    index of the worker
+ * @param task      next task (output)
+ * @return false when all the queues are empty
+ */
+bool ThreadPool::next_task(size_t worker, size_t& task){
+    const size_t n_workers = this->queues.size();
+    for (size_t i = 0; i < n_workers; ++i){
+        TaskQueue& queue = *this->queues[(worker + i) % n_workers];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (! queue.tasks.empty()){
+            if (i == 0){
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            } else {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Pool and index of the worker running on the calling thread
+ */
+ThreadPool::CurrentWorker& ThreadPool::current_worker(){
+    thread_local CurrentWorker current;
+    return current;
+}
+
+/**
+ * @brief Wait for jobs and run their tasks
+ *
+ * @param worker        index of the worker
+ * @param pin_thread    bind the thread to cpu
+ * @param cpu           CPU of the thread
+ */
+void ThreadPool::worker_loop(size_t worker, bool pin_thread, size_t cpu){
+#if defined(__linux__)
+    if (pin_thread){
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu % CPU_SETSIZE, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#else
+    (void) pin_thread;
+    (void) cpu;
+#endif
+    current_worker() = CurrentWorker{this, worker};
+    size_t seen = 0;
+    while (true){
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->job_ready.wait(guard, [&](){ return this->stopping || (this->generation != seen); });
+            if (this->stopping){
+                return;
+            }
+            seen = this->generation;
+        }
+        size_t task;
+        while (this->next_task(worker, task)){
+            if (this->failed.load(std::memory_order_relaxed)){
+                continue;   // drain the queues
+            }
+            try {
+                this->job(task, worker);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(this->lock);
+                if (! this->error){
+                    this->error = std::current_exception();
+                }
+                this->failed.store(true, std::memory_order_relaxed);
+            }
+        }
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (--this->running == 0){
+            this->job_done.notify_one();
+        }
+    }
+}
+
+} // namespace cphot
@@ -14,7 +14,8 @@
 #include "votable.hpp"
 #include <xtensor/xadapt.hpp>
 #include <xtensor/xarray.hpp>
-#include <cphot/hardcoded_data/vega_data.hpp>
+#include "quantity_array.hpp"
+#include "reference_spectra.hpp"
 
 namespace cphot {
 
@@ -27,6 +28,10 @@ using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
  * find the Vega synthetic spectrum (Bohlin 2007) in order to compute fluxes and
  * magnitudes in given filters
  *
+ * The default Vega spectrum is the shared `vega` reference spectrum (see
+ * `cphot::get_reference_spectrum`), so constructing a `Vega` object does not
+ * copy its data.
+ *
  * @ingroup VEGA
  **/
 class Vega {
@@ -41,26 +46,26 @@ class Vega {
              const QSpectralFluxDensity& flux_unit);
         Vega();
 
-        DMatrix get_wavelength();
-        DMatrix get_wavelength(const QLength& in);
-        DMatrix get_flux();
-        DMatrix get_flux(const QSpectralFluxDensity& in);
+        const DMatrix& get_wavelength() const;
+        DMatrix get_wavelength(const QLength& in) const;
+        const DMatrix& get_flux() const;
+        DMatrix get_flux(const QSpectralFluxDensity& in) const;
+        QuantityArray<QLength> get_wavelength_quantity() const;
+        QuantityArray<QSpectralFluxDensity> get_flux_quantity() const;
+        std::shared_ptr<const ReferenceSpectrum> get_spectrum() const;
 
     private:
-        DMatrix wavelength_nm;    ///< Wavelength in nm
-        DMatrix flux_flam;        ///< flux in flam
+        std::shared_ptr<const ReferenceSpectrum> spectrum;   ///< wavelength in nm and flux in flam
 
 };
 
 /**
  * @brief Construct a new Vega object from hardcoded data
+ *
+ * Uses the shared `vega` reference spectrum.
  */
 Vega::Vega() {
-    std::vector<std::size_t> shape = { cphot_vega::wavelength_nm.size() };
-    DMatrix xt_wave = xt::adapt(cphot_vega::wavelength_nm, shape);
-    DMatrix xt_flux = xt::adapt(cphot_vega::flux_flam, shape);
-    this->wavelength_nm = xt_wave;
-    this->flux_flam = xt_flux;
+    this->spectrum = get_reference_spectrum("vega");
 }
 
 /**
@@ -75,8 +80,8 @@ Vega::Vega(const DMatrix& wavelength,
            const DMatrix& flux,
            const QLength& wavelength_unit,
            const QSpectralFluxDensity& flux_unit) {
-    this->wavelength_nm = wavelength * wavelength_unit.to(nm);
-    this->flux_flam = flux * flux_unit.to(flam);
+    this->spectrum = std::make_shared<const ReferenceSpectrum>(
+        "vega", wavelength, flux, wavelength_unit, flux_unit);
 }
 
 /**
@@ -93,10 +98,9 @@ Vega::Vega(const std::vector<double>& wavelength,
            const QSpectralFluxDensity& flux_unit) {
 
     std::vector<std::size_t> shape = { wavelength.size() };
-    DMatrix xt_wave = xt::adapt(wavelength, shape);
-    DMatrix xt_flux = xt::adapt(flux, shape);
-    this->wavelength_nm = xt_wave * wavelength_unit.to(nm);
-    this->flux_flam = xt_flux * flux_unit.to(flam);
+    this->spectrum = std::make_shared<const ReferenceSpectrum>(
+        "vega", xt::adapt(wavelength, shape), xt::adapt(flux, shape),
+        wavelength_unit, flux_unit);
 }
 
 /**
@@ -124,8 +128,8 @@ Vega vega_from_votable(const std::string& infile){
  *
  * @return Vega wavelength in nm
  */
-DMatrix Vega::get_wavelength() {
-    return this->wavelength_nm;
+const DMatrix& Vega::get_wavelength() const {
+    return this->spectrum->get_wavelength();
 }
 
 /**
@@ -134,8 +138,8 @@ DMatrix Vega::get_wavelength() {
  * @param in  requested units for the wavelength
  * @return Vega wavelength units of in
  */
-DMatrix Vega::get_wavelength(const QLength& in) {
-    return this->wavelength_nm * nm.to(in);
+DMatrix Vega::get_wavelength(const QLength& in) const {
+    return this->spectrum->get_wavelength() * nm.to(in);
 }
 
 /**
@@ -143,8 +147,8 @@ DMatrix Vega::get_wavelength(const QLength& in) {
  *
  * @return Vega flux in flam
  */
-DMatrix Vega::get_flux() {
-    return this->flux_flam;
+const DMatrix& Vega::get_flux() const {
+    return this->spectrum->get_flux();
 }
 
 /**
@@ -153,8 +157,35 @@ DMatrix Vega::get_flux() {
  * @param in  requested units for the flux
  * @return Vega flux units of in
  */
-DMatrix Vega::get_flux(const QSpectralFluxDensity& in) {
-    return this->flux_flam * flam.to(in);
+DMatrix Vega::get_flux(const QSpectralFluxDensity& in) const {
+    return this->spectrum->get_flux() * flam.to(in);
+}
+
+/**
+ * @brief Get the internal wavelength with its unit
+ *
+ * @return wavelength in nm, sharing the reference spectrum data
+ */
+QuantityArray<QLength> Vega::get_wavelength_quantity() const {
+    return {std::shared_ptr<const DMatrix>(this->spectrum, &this->spectrum->get_wavelength()), nm};
+}
+
+/**
+ * @brief Get the internal flux with its unit
+ *
+ * @return Vega flux in flam, sharing the reference spectrum data
+ */
+QuantityArray<QSpectralFluxDensity> Vega::get_flux_quantity() const {
+    return {std::shared_ptr<const DMatrix>(this->spectrum, &this->spectrum->get_flux()), flam};
+}
+
+/**
+ * @brief Get the underlying reference spectrum
+ *
+ * @return shared immutable spectrum with its cumulative integrals
+ */
+std::shared_ptr<const ReferenceSpectrum> Vega::get_spectrum() const {
+    return this->spectrum;
 }
 
 } // namespace cphot
\ No newline at end of file
@@ -0,0 +1,321 @@
+/**
+ * @defgroup WGRID Wavelength grids
+ * @brief Wavelength definitions with known (uniform or log-uniform) spacing
+ *
+ * Most model grids are sampled linearly in \f$\lambda\f$ or in
+ * \f$\log\lambda\f$. On such grids, the index of any wavelength is computed
+ * arithmetically instead of searched for, and the trapezoid weights
+ * \f$\delta\lambda_i = (\lambda_{i+1} - \lambda_{i-1}) / 2\f$ are constant
+ * (uniform) or geometric (log-uniform).
+ *
+ * A `cphot::WavelengthGrid` detects the spacing of a wavelength definition or
+ * declares it explicitly. Passing it instead of an array to
+ * `cphot::Filter::get_flux`, `cphot::Filter::reinterp` or
+ * `cphot::reduce_resolution` selects the corresponding fast path.
+ *
+ * ```cpp
+ * auto grid = cphot::WavelengthGrid::uniform(3000., 0.5, 12001, angstrom);
+ * auto f = filter.get_flux(grid, flux, flam);
+ * ```
+ *
+ * \note Indices are always checked against the stored wavelength values, so
+ * that they do not depend on rounding. The trapezoid weights of a detected
+ * grid use the closed forms, which are exact up to the detection tolerance.
+ */
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <xtensor/xarray.hpp>
+#include <xtensor/xbuilder.hpp>
+#include "interpolate.hpp"
+#include "rquantities.hpp"
+
+namespace cphot {
+
+using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
+
+/**
+ * @ingroup WGRID
+ * @brief Spacing of a wavelength definition
+ */
+enum class GridSpacing { irregular, uniform, log_uniform };
+
+/**
+ * @ingroup WGRID
+ * @brief Sorted wavelength definition with its spacing.
+ */
+class WavelengthGrid {
+    public:
+        WavelengthGrid(const DMatrix& wavelength,
+                       const QLength& wavelength_unit,
+                       double rtol=1e-10);
+
+        static WavelengthGrid uniform(double start, double step, size_t n,
+                                      const QLength& wavelength_unit);
+        static WavelengthGrid log_uniform(double start, double ratio, size_t n,
+                                          const QLength& wavelength_unit);
+
+        GridSpacing get_spacing() const { return this->spacing; }
+        bool is_regular() const { return this->spacing != GridSpacing::irregular; }
+        size_t size() const { return this->wavelength.size(); }
+        const double* data() const { return this->wavelength.data(); }
+        const DMatrix& get_wavelength() const { return this->wavelength; }
+        QLength get_wavelength_unit() const { return this->wavelength_unit; }
+
+        size_t lower_bound(double x) const;
+        size_t upper_bound(double x) const;
+        double trapezoid_weight(size_t i) const;
+
+        void sample(const double* values, const double* x, size_t n,
+                    double left, double right, double* out) const;
+
+    private:
+        DMatrix wavelength;                     ///< wavelength values
+        QLength wavelength_unit = nm;           ///< unit of the wavelength values
+        GridSpacing spacing = GridSpacing::irregular;  ///< detected or declared spacing
+        double origin = 0;                      ///< first value (or its log)
+        double step = 0;                        ///< step (or log step)
+        //! trapezoid weights (uniform) or weights / λ (log-uniform): first, interior, last
+        double weight_factors[3] = {0, 0, 0};
+
+        WavelengthGrid() = default;
+        void set_spacing(GridSpacing spacing);
+        size_t guess(double x) const;
+};
+
+/**
+ * @brief Construct a grid from a wavelength definition and detect its spacing
+ *
+ * The grid is uniform (resp. log-uniform) if all steps (resp. log steps) are
+ * within `rtol` of their mean.
+ *
+ * @param wavelength        wavelength array (sorted)
+ * @param wavelength_unit   wavelength unit
+ * @param rtol              relative tolerance of the spacing detection
+ * @throw std::runtime_error if the wavelength is not sorted
+ */
+WavelengthGrid::WavelengthGrid(const DMatrix& wavelength,
+                               const QLength& wavelength_unit,
+                               double rtol)
+        : wavelength(wavelength), wavelength_unit(wavelength_unit) {
+    const size_t n = this->wavelength.size();
+    const double* w = this->wavelength.data();
+    if (! interpolate::is_sorted(w, n)){
+        throw std::runtime_error("WavelengthGrid: wavelength must be sorted");
+    }
+    if (n < 3){
+        return;
+    }
+    const double mean_step = (w[n - 1] - w[0]) / (n - 1);
+    bool uniform = mean_step > 0;
+    for (size_t i = 1; uniform && (i < n); ++i){
+        uniform = std::abs(w[i] - w[i - 1] - mean_step) <= rtol * mean_step;
+    }
+    if (uniform){
+        this->origin = w[0];
+        this->step = mean_step;
+        this->set_spacing(GridSpacing::uniform);
+        return;
+    }
+    if (w[0] <= 0){
+        return;
+    }
+    const double mean_log_step = std::log(w[n - 1] / w[0]) / (n - 1);
+    bool log_uniform = mean_log_step > 0;
+    for (size_t i = 1; log_uniform && (i < n); ++i){
+        log_uniform = std::abs(std::log(w[i] / w[i - 1]) - mean_log_step) <= rtol * mean_log_step;
+    }
+    if (log_uniform){
+        this->origin = std::log(w[0]);
+        this->step = mean_log_step;
+        this->set_spacing(GridSpacing::log_uniform);
+    }
+}
+
+/**
+ * @brief Uniform grid start + i * step
+ *
+ * @param start             first wavelength
+ * @param step              wavelength step (> 0)
+ * @param n                 number of points
+ * @param wavelength_unit   wavelength unit
+ * @return WavelengthGrid
+ */
+WavelengthGrid WavelengthGrid::uniform(double start, double step, size_t n,
+                                       const QLength& wavelength_unit){
+    if (step <= 0){
+        throw std::runtime_error("WavelengthGrid: step must be positive");
+    }
+    WavelengthGrid grid;
+    grid.wavelength = xt::zeros<double>({n});
+    for (size_t i = 0; i < n; ++i){
+        grid.wavelength[i] = start + i * step;
+    }
+    grid.wavelength_unit = wavelength_unit;
+    grid.origin = start;
+    grid.step = step;
+    grid.set_spacing((n > 1) ? GridSpacing::uniform : GridSpacing::irregular);
+    return grid;
+}
+
+/**
+ * @brief Log-uniform grid start * ratio^i
+ *
+ * @param start             first wavelength (> 0)
+ * @param ratio             ratio of consecutive wavelengths (> 1)
+ * @param n                 number of points
+ * @param wavelength_unit   wavelength unit
+ * @return WavelengthGrid
+ */
+WavelengthGrid WavelengthGrid::log_uniform(double start, double ratio, size_t n,
+                                           const QLength& wavelength_unit){
+    if ((start <= 0) || (ratio <= 1)){
+        throw std::runtime_error("WavelengthGrid: start must be positive and ratio > 1");
+    }
+    WavelengthGrid grid;
+    grid.origin = std::log(start);
+    grid.step = std::log(ratio);
+    grid.wavelength = xt::zeros<double>({n});
+    for (size_t i = 0; i < n; ++i){
+        grid.wavelength[i] = std::exp(grid.origin + i * grid.step);
+    }
+    grid.wavelength[0] = start;
+    grid.wavelength_unit = wavelength_unit;
+    grid.set_spacing((n > 1) ? GridSpacing::log_uniform : GridSpacing::irregular);
+    return grid;
+}
+
+/**
+ * @brief Set the spacing and the corresponding trapezoid weights
+ */
+void WavelengthGrid::set_spacing(GridSpacing spacing){
+    this->spacing = spacing;
+    if (spacing == GridSpacing::uniform){
+        this->weight_factors[0] = 0.5 * this->step;
+        this->weight_factors[1] = this->step;
+        this->weight_factors[2] = 0.5 * this->step;
+    } else if (spacing == GridSpacing::log_uniform){
+        // (λ_{i+1} - λ_{i-1}) / 2 = λ_i (r - 1 / r) / 2
+        const double r = std::exp(this->step);
+        this->weight_factors[0] = 0.5 * (r - 1.);
+        this->weight_factors[1] = 0.5 * (r - 1. / r);
+        this->weight_factors[2] = 0.5 * (1. - 1. / r);
+    }
+}
+
+/**
+ * @brief Arithmetic estimate of the number of points <= x
+ */
+size_t WavelengthGrid::guess(double x) const {
+    const size_t n = this->size();
+    double position = 0.;
+    if (this->spacing == GridSpacing::uniform){
+        position = (x - this->origin) / this->step;
+    } else if (x > 0){
+        position = (std::log(x) - this->origin) / this->step;
+    } else {
+        return 0;
+    }
+    if (!(position >= 0.)){
+        return 0;
+    }
+    if (position >= static_cast<double>(n)){
+        return n;
+    }
+    return static_cast<size_t>(position) + 1;
+}
+
+/**
+ * @brief Number of points < x (same as std::lower_bound)
+ *
+ * @param x  wavelength in the grid unit
+ * @return index of the first point >= x
+ */
+size_t WavelengthGrid::lower_bound(double x) const {
+    const double* w = this->data();
+    const size_t n = this->size();
+    if (! this->is_regular()){
+        return std::lower_bound(w, w + n, x) - w;
+    }
+    size_t i = std::min(this->guess(x), n);
+    while ((i > 0) && (w[i - 1] >= x)){ --i; }
+    while ((i < n) && (w[i] < x)){ ++i; }
+    return i;
+}
+
+/**
+ * @brief Number of points <= x (same as std::upper_bound)
+ *
+ * @param x  wavelength in the grid unit
+ * @return index of the first point > x
+ */
+size_t WavelengthGrid::upper_bound(double x) const {
+    const double* w = this->data();
+    const size_t n = this->size();
+    if (! this->is_regular()){
+        return std::upper_bound(w, w + n, x) - w;
+    }
+    size_t i = std::min(this->guess(x), n);
+    while ((i > 0) && (w[i - 1] > x)){ --i; }
+    while ((i < n) && (w[i] <= x)){ ++i; }
+    return i;
+}
+
+/**
+ * @brief Trapezoid weight of a point: (λ_{i+1} - λ_{i-1}) / 2 (half cells at the edges)
+ *
+ * @param i  index of the point
+ * @return weight in the grid unit
+ */
+double WavelengthGrid::trapezoid_weight(size_t i) const {
+    const size_t n = this->size();
+    const size_t edge = (i == 0) ? 0 : (i + 1 == n) ? 2 : 1;
+    switch (this->spacing){
+        case GridSpacing::uniform:
+            return this->weight_factors[edge];
+        case GridSpacing::log_uniform:
+            return this->weight_factors[edge] * this->wavelength[i];
+        default:
+            if (n < 2){
+                return 0.;
+            }
+            return 0.5 * (this->wavelength[std::min(i + 1, n - 1)]
+                          - this->wavelength[(i > 0) ? i - 1 : 0]);
+    }
+}
+
+/**
+ * @brief Linear interpolation of values defined on the grid at sorted points
+ *
+ * Regular grids locate every point arithmetically, other grids walk the grid
+ * alongside the points (see `cphot::interpolate::linear_sorted`).
+ *
+ * @param values  values on the grid (size())
+ * @param x       evaluation points (sorted, grid unit)
+ * @param n       number of evaluation points
+ * @param left    value for x < grid[0]
+ * @param right   value for x > grid[-1]
+ * @param out     output values (n)
+ */
+void WavelengthGrid::sample(const double* values, const double* x, size_t n,
+                            double left, double right, double* out) const {
+    const size_t m = this->size();
+    const double* w = this->data();
+    if ((! this->is_regular()) || (m < 2)){
+        interpolate::linear_sorted(x, n, w, values, m, left, right, out);
+        return;
+    }
+    for (size_t i = 0; i < n; ++i){
+        if (x[i] < w[0]){
+            out[i] = left;
+        } else if (x[i] > w[m - 1]){
+            out[i] = right;
+        } else {
+            const size_t k = std::min(this->upper_bound(x[i]) - 1, m - 2);
+            out[i] = interpolate::segment_value(x[i], w, values, k);
+        }
+    }
+}
+
+} // namespace cphot
@@ -0,0 +1,505 @@
+/**
+ * @defgroup WEIGHTSCACHE Weights cache
+ * @brief Photometry matrices stored on disk and memory-mapped across runs
+ *
+ * Compiling thousands of filters against a large wavelength grid
+ * (`cphot::PhotometryMatrix`) resamples every filter on the grid, and gives
+ * the same weights at every run of a batch job. A `cphot::WeightsCache`
+ * stores the compiled weights in a directory and maps them back on the next
+ * runs, so that loading the matrix costs one `mmap`.
+ *
+ * ```cpp
+ * cphot::WeightsCache cache("/scratch/cphot_weights");
+ * cphot::PhotometryMatrix pm = cache.get_photometry_matrix(filters, wavelength, nm);
+ * cphot::DMatrix fluxes = pm.get_flux(flux);
+ * ```
+ *
+ * Each file is named after a hash of the content of the filters (wavelength,
+ * transmission, detector), of the wavelength grid (values and unit), of the
+ * integration policy, of the flux density type and of the storage type. Changing any of them selects
+ * another file, so that stale weights are never used; `WeightsCache::clear`
+ * removes them. The hashes of the filters, of the grid and of the
+ * integration policy are also stored in the files and compared when a file
+ * is mapped, so that a collision of the names or a change in the way they
+ * are derived never returns the weights of other inputs. Files are written to a temporary name and renamed, so that
+ * concurrent jobs sharing a directory only ever see complete files.
+ *
+ * The files are in the native byte order and are not meant to be exchanged
+ * between machines.
+ */
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <xtensor/xarray.hpp>
+#include "filter.hpp"
+#include "flux_density.hpp"
+#include "hash.hpp"
+#include "integration.hpp"
+#include "photometry_matrix.hpp"
+#include "rquantities.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CPHOT_WEIGHTS_CACHE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cphot {
+
+using DMatrix = xt::xarray<double, xt::layout_type::row_major>;
+
+/**
+ * @ingroup WEIGHTSCACHE
+ * @brief Read-only file mapped in memory
+ *
+ * Read into memory on platforms without `mmap`.
+ */
+class MappedFile {
+    public:
+        explicit MappedFile(const std::string& path);
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* data() const { return this->address; }
+        size_t size() const { return this->n_bytes; }
+
+    private:
+        const char* address = nullptr;  ///< first byte of the file
+        size_t n_bytes = 0;             ///< size of the file
+        std::vector<char> buffer;       ///< content of the file without mmap
+};
+
+/**
+ * @brief Map a file in memory
+ *
+ * @param path  path of the file
+ * @throw std::runtime_error if the file cannot be read
+ */
+MappedFile::MappedFile(const std::string& path){
+#ifdef CPHOT_WEIGHTS_CACHE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0){
+        throw std::runtime_error("cannot open " + path);
+    }
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || (st.st_size <= 0)){
+        ::close(fd);
+        throw std::runtime_error("cannot read " + path);
+    }
+    void* mapped = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED){
+        throw std::runtime_error("cannot map " + path);
+    }
+    this->address = static_cast<const char*>(mapped);
+    this->n_bytes = static_cast<size_t>(st.st_size);
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (! file){
+        throw std::runtime_error("cannot open " + path);
+    }
+    this->buffer.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (! file.read(this->buffer.data(), this->buffer.size())){
+        throw std::runtime_error("cannot read " + path);
+    }
+    this->address = this->buffer.data();
+    this->n_bytes = this->buffer.size();
+#endif
+}
+
+/**
+ * @brief Unmap the file
+ */
+MappedFile::~MappedFile(){
+#ifdef CPHOT_WEIGHTS_CACHE_MMAP
+    if (this->address != nullptr){
+        ::munmap(const_cast<char*>(this->address), this->n_bytes);
+    }
+#endif
+}
+
+/**
+ * @ingroup WEIGHTSCACHE
+ * @brief Directory of compiled photometry matrices
+ *
+ * Safe to use from several threads and processes: the files are immutable
+ * once renamed into the directory.
+ */
+class WeightsCache {
+    public:
+        //! version of the file layout and of the weights (part of the keys)
+        static constexpr uint64_t version = 2;
+        //! extension of the cache files
+        static constexpr const char* extension = ".cphotw";
+
+        explicit WeightsCache(const std::string& directory);
+
+        template <typename Storage=double, typename Integration=integration::Trapezoid>
+        BasicPhotometryMatrix<Storage> get_photometry_matrix(const std::vector<Filter>& filters,
+                                                             const DMatrix& wavelength,
+                                                             const QLength& wavelength_unit,
+                                                             Integration integration=Integration(),
+                                                             FluxDensityType flux_type=FluxDensityType::flam);
+
+        template <typename Storage=double, typename Integration=integration::Trapezoid>
+        static uint64_t get_key(const std::vector<Filter>& filters,
+                                const DMatrix& wavelength,
+                                const QLength& wavelength_unit,
+                                FluxDensityType flux_type=FluxDensityType::flam);
+        std::string get_path(uint64_t key) const;
+        const std::string& get_directory() const { return this->directory; }
+        size_t get_hits() const { return this->hits; }
+        size_t get_misses() const { return this->misses; }
+        size_t clear();
+
+    private:
+        //! hashes of the inputs of a matrix, combined into its key
+        struct KeyParts {
+            uint64_t filters_hash = 0;                  ///< content of the filters
+            uint64_t grid_hash = 0;                     ///< wavelength grid and unit
+            uint64_t integration_hash = 0;              ///< name of the integration policy
+            uint64_t flux_type = 0;                     ///< flux density type
+            uint64_t storage_size = 0;                  ///< size of a weight in bytes
+        };
+
+        //! first bytes of the files
+        struct FileHeader {
+            char magic[8] = {'C', 'P', 'H', 'O', 'T', 'W', 'T', '\0'};
+            uint64_t version = WeightsCache::version;   ///< layout version
+            uint64_t key = 0;                           ///< key of the matrix
+            uint64_t filters_hash = 0;                  ///< content of the filters
+            uint64_t grid_hash = 0;                     ///< wavelength grid and unit
+            uint64_t integration_hash = 0;              ///< name of the integration policy
+            uint64_t flux_type = 0;                     ///< flux density type
+            uint64_t storage_size = 0;                  ///< size of a weight in bytes
+            uint64_t n_filters = 0;                     ///< number of rows
+            uint64_t n_wavelength = 0;                  ///< number of columns
+            uint64_t n_values = 0;                      ///< number of non-zero weights
+        };
+
+        std::string directory;              ///< where the files are stored
+        std::atomic<size_t> hits {0};       ///< matrices mapped from a file
+        std::atomic<size_t> misses {0};     ///< matrices compiled
+
+        static uint64_t hash_filter(const Filter& filter);
+        template <typename Storage, typename Integration>
+        static KeyParts get_key_parts(const std::vector<Filter>& filters,
+                                      const DMatrix& wavelength,
+                                      const QLength& wavelength_unit,
+                                      FluxDensityType flux_type);
+        static uint64_t combine_key(const KeyParts& parts, size_t n_filters);
+        template <typename Storage>
+        static std::unique_ptr<BasicPhotometryMatrix<Storage>> read(const std::string& path,
+                                                                    uint64_t key,
+                                                                    const KeyParts& parts,
+                                                                    const std::vector<Filter>& filters,
+                                                                    const DMatrix& wavelength,
+                                                                    const QLength& wavelength_unit);
+        template <typename Storage>
+        static bool write(const std::string& path,
+                          uint64_t key,
+                          const KeyParts& parts,
+                          const BasicPhotometryMatrix<Storage>& matrix);
+};
+
+/**
+ * @brief Open (or create) a cache directory
+ *
+ * @param directory  path of the directory
+ * @throw std::runtime_error if the directory cannot be created
+ */
+WeightsCache::WeightsCache(const std::string& directory)
+        : directory(directory) {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (! std::filesystem::is_directory(directory)){
+        throw std::runtime_error("cannot create weights cache directory " + directory);
+    }
+}
+
+/**
+ * @brief Content hash of a filter
+ *
+ * @param filter  filter
+ * @return hash of the wavelength, transmission and detector type
+ */
+uint64_t WeightsCache::hash_filter(const Filter& filter){
+    Fnv1a hash;
+    const DMatrix& wavelength = filter.get_wavelength();
+    const DMatrix& transmission = filter.get_transmission();
+    hash.add(wavelength.size());
+    hash.add(wavelength.data(), wavelength.size());
+    hash.add(transmission.data(), transmission.size());
+    hash.add(filter.get_detector_type());
+    return hash.value;
+}
+
+/**
+ * @brief Hashes of the inputs of a photometry matrix
+ *
+ * @tparam Storage          storage type of the weights
+ * @tparam Integration      integration policy
+ * @param filters           filters (rows of the matrix)
+ * @param wavelength        wavelength definition of the spectra
+ * @param wavelength_unit   unit of the wavelength definition
+ * @param flux_type         flux density type of the spectra
+ * @return hashes of the filters, grid and integration policy, flux density and storage types
+ */
+template <typename Storage, typename Integration>
+WeightsCache::KeyParts WeightsCache::get_key_parts(const std::vector<Filter>& filters,
+                                                   const DMatrix& wavelength,
+                                                   const QLength& wavelength_unit,
+                                                   FluxDensityType flux_type){
+    Fnv1a grid;
+    grid.add(wavelength.size());
+    grid.add(wavelength.data(), wavelength.size());
+    grid.add(wavelength_unit.to(nm));
+
+    Fnv1a content;
+    content.add(filters.size());
+    for (auto& filter: filters){
+        content.add(hash_filter(filter));
+    }
+
+    Fnv1a integration;
+    integration.add_bytes(Integration::name, std::char_traits<char>::length(Integration::name));
+
+    KeyParts parts;
+    parts.filters_hash = content.value;
+    parts.grid_hash = grid.value;
+    parts.integration_hash = integration.value;
+    parts.flux_type = static_cast<uint64_t>(flux_type);
+    parts.storage_size = sizeof(Storage);
+    return parts;
+}
+
+/**
+ * @brief Key of a matrix from the hashes of its inputs
+ *
+ * @param parts      hashes of the inputs
+ * @param n_filters  number of filters
+ * @return key of the matrix
+ */
+uint64_t WeightsCache::combine_key(const KeyParts& parts, size_t n_filters){
+    Fnv1a hash;
+    hash.add(version);
+    hash.add(parts.integration_hash);
+    hash.add(parts.flux_type);
+    hash.add(parts.storage_size);
+    hash.add(parts.grid_hash);
+    hash.add(n_filters);
+    hash.add(parts.filters_hash);
+    return hash.value;
+}
+
+/**
+ * @brief Key of a photometry matrix
+ *
+ * @tparam Storage          storage type of the weights
+ * @tparam Integration      integration policy
+ * @param filters           filters (rows of the matrix)
+ * @param wavelength        wavelength definition of the spectra
+ * @param wavelength_unit   unit of the wavelength definition
+ * @param flux_type         flux density type of the spectra
+ * @return hash of the filters, grid, integration policy, flux density and storage types
+ */
+template <typename Storage, typename Integration>
+uint64_t WeightsCache::get_key(const std::vector<Filter>& filters,
+                               const DMatrix& wavelength,
+                               const QLength& wavelength_unit,
+                               FluxDensityType flux_type){
+    return combine_key(get_key_parts<Storage, Integration>(filters, wavelength, wavelength_unit,
+                                                           flux_type),
+                       filters.size());
+}
+
+/**
+ * @brief Path of the file of a key
+ *
+ * @param key  key of the matrix (see `WeightsCache::get_key`)
+ * @return path in the cache directory
+ */
+std::string WeightsCache::get_path(uint64_t key) const {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(this->directory) / (name + std::string(extension))).string();
+}
+
+/**
+ * @brief Photometry matrix of filters on a wavelength grid, from the cache
+ *
+ * Maps the weights from the cache directory if they were compiled before
+ * (same filters, grid, integration policy, flux density type and storage).
+ * Otherwise compiles the matrix and stores it. A file that cannot be written does not prevent
+ * the matrix from being returned, it is compiled again at the next call.
+ *
+ * @tparam Storage          storage type of the weights (double or float)
+ * @tparam Integration      integration policy (default: trapezoid)
+ * @param filters           filters to compile (rows of the matrix)
+ * @param wavelength        wavelength definition of the spectra
+ * @param wavelength_unit   unit of the wavelength definition
+ * @param integration       integration policy
+ * @param flux_type         flux density type of the spectra (default: flam)
+ * @return photometry matrix
+ */
+template <typename Storage, typename Integration>
+BasicPhotometryMatrix<Storage> WeightsCache::get_photometry_matrix(const std::vector<Filter>& filters,
+                                                                   const DMatrix& wavelength,
+                                                                   const QLength& wavelength_unit,
+                                                                   Integration integration,
+                                                                   FluxDensityType flux_type){
+    const KeyParts parts = get_key_parts<Storage, Integration>(filters, wavelength, wavelength_unit,
+                                                               flux_type);
+    const uint64_t key = combine_key(parts, filters.size());
+    const std::string path = this->get_path(key);
+    auto cached = read<Storage>(path, key, parts, filters, wavelength, wavelength_unit);
+    if (cached){
+        ++this->hits;
+        return *cached;
+    }
+    ++this->misses;
+    BasicPhotometryMatrix<Storage> matrix(filters, wavelength, wavelength_unit, integration,
+                                          flux_type);
+    write(path, key, parts, matrix);
+    return matrix;
+}
+
+/**
+ * @brief Map a photometry matrix from a file
+ *
+ * The file is used only if its key, the hashes of its inputs and its sizes
+ * all match.
+ *
+ * @return matrix (nullptr if the file is missing or does not match)
+ */
+template <typename Storage>
+std::unique_ptr<BasicPhotometryMatrix<Storage>> WeightsCache::read(const std::string& path,
+                                                                   uint64_t key,
+                                                                   const KeyParts& parts,
+                                                                   const std::vector<Filter>& filters,
+                                                                   const DMatrix& wavelength,
+                                                                   const QLength& wavelength_unit){
+    std::shared_ptr<MappedFile> file;
+    try {
+        file = std::make_shared<MappedFile>(path);
+    } catch (const std::runtime_error&) {
+        return nullptr;
+    }
+    FileHeader header;
+    const FileHeader expected;
+    if (file->size() < sizeof(FileHeader)){
+        return nullptr;
+    }
+    std::memcpy(&header, file->data(), sizeof(FileHeader));
+    const size_t n_filters = filters.size();
+    const size_t index_bytes = (2 * n_filters + 1) * sizeof(uint64_t);
+    if ((std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0)
+        || (header.version != version) || (header.key != key)
+        || (header.filters_hash != parts.filters_hash) || (header.grid_hash != parts.grid_hash)
+        || (header.integration_hash != parts.integration_hash)
+        || (header.flux_type != parts.flux_type)
+        || (header.storage_size != sizeof(Storage)) || (parts.storage_size != sizeof(Storage))
+        || (header.n_filters != n_filters) || (header.n_wavelength != wavelength.size())
+        || (file->size() != sizeof(FileHeader) + index_bytes + header.n_values * sizeof(Storage))){
+        return nullptr;
+    }
+
+    std::vector<uint64_t> index(2 * n_filters + 1);
+    std::memcpy(index.data(), file->data() + sizeof(FileHeader), index_bytes);
+    std::vector<size_t> row_offsets(index.begin(), index.begin() + n_filters + 1);
+    std::vector<size_t> first_column(index.begin() + n_filters + 1, index.end());
+    if ((row_offsets.front() != 0) || (row_offsets.back() != header.n_values)){
+        return nullptr;
+    }
+    std::vector<std::string> names;
+    for (size_t k = 0; k < n_filters; ++k){
+        if ((row_offsets[k + 1] < row_offsets[k])
+            || (first_column[k] + row_offsets[k + 1] - row_offsets[k] > wavelength.size())){
+            return nullptr;
+        }
+        names.push_back(filters[k].get_name());
+    }
+    const Storage* values = reinterpret_cast<const Storage*>(
+        file->data() + sizeof(FileHeader) + index_bytes);
+    return std::unique_ptr<BasicPhotometryMatrix<Storage>>(new BasicPhotometryMatrix<Storage>(
+        names, wavelength, wavelength_unit, row_offsets, first_column, file, values));
+}
+
+/**
+ * @brief Store a photometry matrix in a file
+ *
+ * The file is written under a temporary name and renamed only once it is
+ * closed without error.
+ *
+ * @return true if the file was written
+ */
+template <typename Storage>
+bool WeightsCache::write(const std::string& path,
+                         uint64_t key,
+                         const KeyParts& parts,
+                         const BasicPhotometryMatrix<Storage>& matrix){
+    FileHeader header;
+    header.key = key;
+    header.filters_hash = parts.filters_hash;
+    header.grid_hash = parts.grid_hash;
+    header.integration_hash = parts.integration_hash;
+    header.flux_type = parts.flux_type;
+    header.storage_size = sizeof(Storage);
+    header.n_filters = matrix.n_filters();
+    header.n_wavelength = matrix.n_wavelength();
+    header.n_values = matrix.n_nonzero();
+    std::vector<uint64_t> index(matrix.row_offsets.begin(), matrix.row_offsets.end());
+    index.insert(index.end(), matrix.first_column.begin(), matrix.first_column.end());
+
+    const std::string tmp_path = path + ".tmp" + std::to_string(std::random_device()());
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+        file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(uint64_t));
+        file.write(reinterpret_cast<const char*>(matrix.values), header.n_values * sizeof(Storage));
+        // errors of the last writes (e.g., a full disk) only show when flushing
+        file.close();
+        if (file.fail()){
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0){
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Remove the files of the cache directory
+ *
+ * Matrices mapped from these files remain valid.
+ *
+ * @return number of files removed
+ */
+size_t WeightsCache::clear(){
+    size_t n_removed = 0;
+    for (const auto& entry: std::filesystem::directory_iterator(this->directory)){
+        if (entry.path().extension() == extension){
+            std::error_code error;
+            n_removed += std::filesystem::remove(entry.path(), error) ? 1 : 0;
+        }
+    }
+    return n_removed;
+}
+
+} // namespace cphot
@@ -5,9 +5,20 @@
  *
  */
 #include "testlib.hpp"
+#include <filesystem>
+#include <fstream>
+#include <thread>
 #include <cphot/rquantities.hpp>
 #include <cphot/filter.hpp>
+#include <cphot/filter_bank.hpp>
 #include <cphot/io.hpp>
+#include <cphot/magnitudes.hpp>
+#include <cphot/photometry.hpp>
+#include <cphot/photometry_matrix.hpp>
+#include <cphot/quantity_array.hpp>
+#include <cphot/sun.hpp>
+#include <cphot/weights_cache.hpp>
+#include <xtensor/xbuilder.hpp>
 
 /**
  * @brief Testing unit conversions
@@ -91,12 +102,1179 @@ void test_svo_energy_dtype(){
     EXPECT_NEAR(filt.get_Vega_zero_Jy().to(Jy), 1033.691278249937, 1e-5);
 }
 
+/**
+ * @brief Triangular passband between 400 and 600 nm (no network needed)
+ */
+cphot::Filter make_test_filter(const std::string& dtype="photon"){
+    cphot::DMatrix wave = xt::arange<double>(380., 621., 2.);
+    cphot::DMatrix trans = xt::zeros<double>({wave.size()});
+    for (size_t i=0; i < wave.size(); ++i){
+        trans[i] = std::max(0., 1. - std::abs(wave[i] - 500.) / 100.);
+    }
+    return cphot::Filter(wave, trans, nm, dtype, "test_triangle");
+}
+
+/**
+ * @brief A smooth "spectrum" on a grid different from the filter's
+ */
+cphot::DMatrix make_test_spectrum(const cphot::DMatrix& wave, double slope){
+    return 1e-12 * (1. + slope * (wave - 300.) / 600.) * xt::exp(-0.5 * xt::square((wave - 480.) / 150.));
+}
+
+void test_batch_flux(){
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 0.7);
+    const size_t n_spectra = 5;
+    for (const std::string dtype: {"photon", "energy"}){
+        cphot::Filter filt = make_test_filter(dtype);
+        cphot::DMatrix flux = xt::zeros<double>({n_spectra, wave.size()});
+        std::vector<double> expected;
+        for (size_t s=0; s < n_spectra; ++s){
+            cphot::DMatrix spec = make_test_spectrum(wave, 0.5 * s);
+            for (size_t i=0; i < wave.size(); ++i){
+                flux(s, i) = spec[i];
+            }
+            expected.push_back(filt.get_flux(wave, spec, nm, flam).to(flam));
+        }
+        auto batch = filt.get_flux_batch(wave, flux, nm, flam);
+        for (size_t s=0; s < n_spectra; ++s){
+            EXPECT_NEAR(batch[s].to(flam), expected[s], 1e-12 * std::abs(expected[s]));
+        }
+    }
+}
+
+void test_photometry_matrix(){
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 0.7);
+    std::vector<cphot::Filter> filters {make_test_filter("photon"),
+                                        make_test_filter("energy")};
+    const size_t n_spectra = 3;
+    cphot::DMatrix flux = xt::zeros<double>({n_spectra, wave.size()});
+    for (size_t s=0; s < n_spectra; ++s){
+        cphot::DMatrix spec = make_test_spectrum(wave, 0.5 * s);
+        for (size_t i=0; i < wave.size(); ++i){
+            flux(s, i) = spec[i];
+        }
+    }
+    cphot::PhotometryMatrix pm(filters, wave, nm);
+    cphot::DMatrix result = pm.get_flux(flux);
+    for (size_t k=0; k < filters.size(); ++k){
+        auto expected = filters[k].get_flux_batch(wave, flux, nm, flam);
+        for (size_t s=0; s < n_spectra; ++s){
+            EXPECT_NEAR(result(s, k), expected[s].to(flam), 1e-12 * std::abs(result(s, k)));
+        }
+    }
+}
+void test_reference_spectra(){
+    auto vega = cphot::get_reference_spectrum("vega");
+    const cphot::DMatrix& vw = vega->get_wavelength();
+    const cphot::DMatrix& vf = vega->get_flux();
+    // coarse and fine piecewise-linear passbands
+    cphot::Filter filt = make_test_filter();
+    cphot::DMatrix coarse_wave {300., 550., 1200.};
+    cphot::DMatrix coarse_trans {0., 1., 0.};
+    for (const auto& passband: {std::make_pair(filt.get_wavelength(), filt.get_transmission()),
+                                std::make_pair(coarse_wave, coarse_trans)}){
+        cphot::DMatrix T = xt::interp(vw, passband.first, passband.second, 0., 0.);
+        double expected_0 = xt::trapz(T * vf, vw)[0];
+        double expected_1 = xt::trapz(vw * T * vf, vw)[0];
+        double expected_norm = xt::trapz(vw * T, vw)[0];
+        EXPECT_NEAR(vega->moment(passband.first, passband.second, 0), expected_0, 1e-12 * expected_0);
+        EXPECT_NEAR(vega->moment(passband.first, passband.second, 1), expected_1, 1e-12 * expected_1);
+        EXPECT_NEAR(vega->moment(passband.first, passband.second, 1, false), expected_norm, 1e-12 * expected_norm);
+    }
+    // zero point from the cumulative integrals
+    cphot::Vega v;
+    double expected = filt.get_flux(v.get_wavelength(nm), v.get_flux(flam), nm, flam).to(flam);
+    EXPECT_NEAR(filt.get_Vega_zero_flux().to(flam), expected, 1e-12 * expected);
+}
+void test_spectrum_index(){
+    cphot::DMatrix wave = xt::arange<double>(3000., 9000., 0.3);
+    cphot::DMatrix flux = make_test_spectrum(wave / 10., 1.);
+    cphot::Spectrum spec(wave, flux, angstrom, flam);
+    cphot::Spectrum indexed(wave, flux, angstrom, flam, true);
+    for (const std::string dtype: {"photon", "energy"}){
+        cphot::Filter filt = make_test_filter(dtype);
+        double expected = filt.get_flux(wave, flux, angstrom, flam).to(flam);
+        EXPECT_NEAR(filt.get_flux(spec).to(flam), expected, 1e-12 * expected);
+        EXPECT_NEAR(filt.get_flux(indexed).to(flam), expected, 1e-12 * expected);
+    }
+    // Lick H_beta band
+    cphot::DMatrix knots {4847.875, 4876.625};
+    cphot::DMatrix box {1., 1.};
+    cphot::DMatrix T = xt::interp(wave, knots, box, 0., 0.);
+    double expected = xt::trapz(T * flux, wave)[0] / xt::trapz(T, wave)[0];
+    EXPECT_NEAR(indexed.get_mean_flux(4847.875 * angstrom, 4876.625 * angstrom).to(flam),
+                expected, 1e-12 * expected);
+}
+
+void test_fused_kernel(){
+    using namespace cphot::kernels;
+    // irregular grid, longer than one block of the kernel
+    cphot::DMatrix wave = xt::arange<double>(300., 700., 0.37);
+    wave += 0.05 * xt::sin(wave);
+    cphot::DMatrix flux = make_test_spectrum(wave, -1.);
+    cphot::Filter filt = make_test_filter();
+    const cphot::DMatrix filt_wave = filt.get_wavelength();
+    const cphot::DMatrix filt_trans = filt.get_transmission();
+    for (const bool photon: {true, false}){
+        cphot::DMatrix T = xt::interp(wave, filt_wave, filt_trans, 0., 0.);
+        if (photon) { T *= wave; }
+        double a = xt::trapz(T * flux, wave)[0];
+        double b = xt::trapz(T, wave)[0];
+        FluxIntegrals ref = fused_flux_integrals(
+            wave.data(), flux.data(), wave.size(),
+            filt_wave.data(), filt_trans.data(), filt_trans.size(),
+            photon, SimdLevel::scalar);
+        EXPECT_NEAR(ref.numerator, a, 1e-12 * std::abs(a));
+        EXPECT_NEAR(ref.denominator, b, 1e-12 * std::abs(b));
+        // every variant available on this CPU gives the same bits
+        for (const SimdLevel level: {SimdLevel::avx2, SimdLevel::avx512}){
+            FluxIntegrals res = fused_flux_integrals(
+                wave.data(), flux.data(), wave.size(),
+                filt_wave.data(), filt_trans.data(), filt_trans.size(),
+                photon, level);
+            EXPECT_NEAR(res.numerator, ref.numerator, 0.);
+            EXPECT_NEAR(res.denominator, ref.denominator, 0.);
+        }
+    }
+}
+
+void test_support_window(){
+    // zero padded filter on a wide spectrum
+    cphot::DMatrix filt_wave = xt::arange<double>(100., 1000., 5.);
+    cphot::DMatrix filt_trans = xt::zeros<double>({filt_wave.size()});
+    for (size_t i = 0; i < filt_wave.size(); ++i){
+        filt_trans[i] = std::max(0., 1. - std::abs(filt_wave[i] - 550.) / 40.);
+    }
+    cphot::Filter filt(filt_wave, filt_trans, nm, "photon", "narrow");
+    cphot::DMatrix wave = xt::arange<double>(91., 25000., 0.71);
+    cphot::DMatrix flux = make_test_spectrum(wave, 1.);
+    cphot::DMatrix T = xt::interp(wave, filt_wave, filt_trans, 0., 0.) * wave;
+    double expected = xt::trapz(T * flux, wave)[0] / xt::trapz(T, wave)[0];
+    EXPECT_NEAR(filt.get_flux(wave, flux, nm, flam).to(flam), expected, 1e-12 * expected);
+    EXPECT_NEAR(filt.get_flux_batch(wave, flux, nm, flam)[0].to(flam), expected, 1e-12 * expected);
+    // spectrum covering part of the support only
+    cphot::DMatrix half = xt::arange<double>(553.3, 800., 0.5);
+    cphot::DMatrix half_flux = make_test_spectrum(half, 1.);
+    T = xt::interp(half, filt_wave, filt_trans, 0., 0.) * half;
+    expected = xt::trapz(T * half_flux, half)[0] / xt::trapz(T, half)[0];
+    EXPECT_NEAR(filt.get_flux(half, half_flux, nm, flam).to(flam), expected, 1e-12 * expected);
+    // no overlap
+    cphot::DMatrix red = xt::arange<double>(600., 800., 0.5);
+    EXPECT_NEAR(filt.get_flux(red, make_test_spectrum(red, 1.), nm, flam).to(flam), 0., 0.);
+}
+
+void test_interpolate(){
+    cphot::DMatrix xp {1., 2., 2., 4., 7.};
+    cphot::DMatrix fp {0., 1., 3., 2., 5.};
+    cphot::DMatrix x = xt::arange<double>(-1., 9., 0.25);
+    cphot::DMatrix expected = xt::interp(x, xp, fp, -1., -2.);
+    cphot::DMatrix sorted = cphot::interpolate::linear(x, xp, fp, -1., -2.);
+    for (size_t i = 0; i < x.size(); ++i){
+        EXPECT_NEAR(sorted[i], expected[i], 1e-15);
+    }
+    // unsorted evaluation points
+    cphot::DMatrix y {5.5, 0., 3.5, 8., 2., 1.};
+    expected = xt::interp(y, xp, fp);
+    cphot::DMatrix unsorted = cphot::interpolate::linear(y, xp, fp);
+    for (size_t i = 0; i < y.size(); ++i){
+        EXPECT_NEAR(unsorted[i], expected[i], 1e-15);
+    }
+    // unsorted filter definitions are sorted at construction
+    cphot::Filter filt = make_test_filter();
+    cphot::DMatrix wave = filt.get_wavelength();
+    cphot::DMatrix trans = filt.get_transmission();
+    const size_t n = wave.size();
+    cphot::DMatrix rwave = xt::zeros<double>({n});
+    cphot::DMatrix rtrans = xt::zeros<double>({n});
+    for (size_t i = 0; i < n; ++i){
+        rwave[i] = wave[n - 1 - i];
+        rtrans[i] = trans[n - 1 - i];
+    }
+    cphot::Filter reversed(rwave, rtrans, nm, "photon", "reversed");
+    EXPECT_NEAR(reversed.get_lpivot().to(nm), filt.get_lpivot().to(nm), 0.);
+    EXPECT_NEAR(reversed.get_Vega_zero_flux().to(flam), filt.get_Vega_zero_flux().to(flam), 0.);
+}
+
+void test_wavelength_grid(){
+    auto uniform = cphot::WavelengthGrid::uniform(3000., 0.5, 12001, angstrom);
+    auto log_uniform = cphot::WavelengthGrid::log_uniform(3000., 1.0001, 3001, angstrom);
+    cphot::DMatrix irregular_wave = xt::arange<double>(300., 900., 0.7);
+    irregular_wave += 0.05 * xt::sin(irregular_wave);
+    cphot::WavelengthGrid irregular(irregular_wave, nm);
+    if ((cphot::WavelengthGrid(uniform.get_wavelength(), angstrom).get_spacing() != cphot::GridSpacing::uniform)
+        || (cphot::WavelengthGrid(log_uniform.get_wavelength(), angstrom).get_spacing() != cphot::GridSpacing::log_uniform)
+        || (irregular.get_spacing() != cphot::GridSpacing::irregular)){
+        throw std::logic_error("wrong grid spacing detection");
+    }
+    for (const auto* grid: {&uniform, &log_uniform, &irregular}){
+        const double* w = grid->data();
+        const size_t n = grid->size();
+        // bounds on the grid values, between them and outside
+        for (size_t i = 0; i < n; i += 97){
+            for (const double x: {w[i], w[i] + 1e-3, w[i] - 1e-3, w[0] - 1., w[n - 1] + 1.}){
+                EXPECT_NEAR<double>(grid->lower_bound(x), std::lower_bound(w, w + n, x) - w, 0.);
+                EXPECT_NEAR<double>(grid->upper_bound(x), std::upper_bound(w, w + n, x) - w, 0.);
+            }
+            const double dx = 0.5 * (w[std::min(i + 1, n - 1)] - w[(i > 0) ? i - 1 : 0]);
+            EXPECT_NEAR(grid->trapezoid_weight(i), dx, 1e-9 * dx);
+        }
+        const QLength unit = grid->get_wavelength_unit();
+        cphot::DMatrix wave = grid->get_wavelength();
+        cphot::DMatrix flux = make_test_spectrum(wave * unit.to(nm), 1.);
+        for (const std::string dtype: {"photon", "energy"}){
+            cphot::Filter filt = make_test_filter(dtype);
+            double expected = filt.get_flux(wave, flux, unit, flam).to(flam);
+            EXPECT_NEAR(filt.get_flux(*grid, flux, flam).to(flam), expected, 1e-9 * expected);
+        }
+        cphot::Filter filt = make_test_filter();
+        cphot::DMatrix expected = filt.reinterp(wave, unit).get_transmission();
+        cphot::DMatrix trans = filt.reinterp(*grid).get_transmission();
+        for (size_t i = 0; i < n; ++i){
+            EXPECT_NEAR(trans[i], expected[i], 1e-12);
+        }
+    }
+}
+
+void test_exact_linear(){
+    // spectrum much coarser than the filter
+    cphot::DMatrix coarse = xt::arange<double>(300., 900., 17.);
+    cphot::DMatrix coarse_flux = make_test_spectrum(coarse, 1.);
+    // oversampled linear interpolation of the spectrum converges to the exact value
+    cphot::DMatrix fine = xt::arange<double>(300., 883., 0.001);
+    cphot::DMatrix fine_flux = xt::interp(fine, coarse, coarse_flux);
+    for (const std::string dtype: {"photon", "energy"}){
+        cphot::Filter filt = make_test_filter(dtype);
+        double expected = filt.get_flux(fine, fine_flux, nm, flam).to(flam);
+        double exact = filt.get_flux(coarse, coarse_flux, nm, flam,
+                                     cphot::IntegrationMode::exact_linear).to(flam);
+        EXPECT_NEAR(exact, expected, 1e-8 * expected);
+    }
+    // a product of linear functions is integrated exactly
+    cphot::DMatrix wave {0., 10.};
+    cphot::DMatrix flux {1., 3.};
+    cphot::Filter box(cphot::DMatrix {2., 4., 6.}, cphot::DMatrix {0., 1., 0.}, nm, "energy", "box");
+    // T is symmetric around 4 with unit height: int T f / int T = f(4) = 1.8
+    EXPECT_NEAR(box.get_flux(wave, flux, nm, flam, cphot::IntegrationMode::exact_linear).to(flam),
+                1.8, 1e-14);
+}
+
+void test_integration_policies(){
+    using namespace cphot::integration;
+    // Simpson is exact for quadratics on irregular grids (odd and even sizes)
+    for (const size_t n: {7, 8}){
+        cphot::DMatrix x = xt::zeros<double>({n});
+        cphot::DMatrix y = xt::zeros<double>({n});
+        for (size_t i = 0; i < n; ++i){
+            x[i] = i + 0.3 * std::sin(3. * i);
+            y[i] = 1. - 2. * x[i] + 0.5 * x[i] * x[i];
+        }
+        auto primitive = [](double z){ return z - z * z + z * z * z / 6.; };
+        double expected = primitive(x[n - 1]) - primitive(x[0]);
+        EXPECT_NEAR(Simpson::integrate(x.data(), y.data(), n), expected, 1e-12);
+    }
+
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 3.1);
+    cphot::DMatrix flux = make_test_spectrum(wave, 1.);
+    cphot::DMatrix flux2d = xt::zeros<double>({2, wave.size()});
+    for (size_t i = 0; i < wave.size(); ++i){
+        flux2d(0, i) = flux[i];
+        flux2d(1, i) = 2. * flux[i];
+    }
+    std::vector<cphot::Filter> filters {make_test_filter("photon"), make_test_filter("energy")};
+    cphot::PhotometryMatrix simpson(filters, wave, nm, Simpson());
+    cphot::PhotometryMatrix exact(filters, wave, nm, ExactLinear());
+    cphot::DMatrix simpson_flux = simpson.get_flux(flux2d);
+    cphot::DMatrix exact_flux = exact.get_flux(flux2d);
+    for (size_t k = 0; k < filters.size(); ++k){
+        auto& filt = filters[k];
+        double f_simpson = filt.get_flux<Simpson>(wave, flux, nm, flam).to(flam);
+        double f_exact = filt.get_flux<ExactLinear>(wave, flux, nm, flam).to(flam);
+        EXPECT_NEAR(f_simpson, filt.get_flux(wave, flux, nm, flam,
+                                             cphot::IntegrationMode::simpson).to(flam), 0.);
+        EXPECT_NEAR(simpson_flux(0, k), f_simpson, 1e-12 * f_simpson);
+        EXPECT_NEAR(simpson_flux(1, k), 2. * f_simpson, 2e-12 * f_simpson);
+        EXPECT_NEAR(exact_flux(0, k), f_exact, 1e-12 * f_exact);
+        EXPECT_NEAR(filt.get_flux_batch<ExactLinear>(wave, flux, nm, flam)[0].to(flam),
+                    f_exact, 1e-12 * f_exact);
+        // all rules agree on a smooth spectrum
+        double f_trapz = filt.get_flux(wave, flux, nm, flam).to(flam);
+        EXPECT_NEAR(f_simpson, f_trapz, 1e-4 * f_trapz);
+        EXPECT_NEAR(f_exact, f_trapz, 1e-4 * f_trapz);
+    }
+}
+
+/**
+ * @brief Testing filters with a compile-time detector type
+ */
+void test_typed_filter(){
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 3.1);
+    cphot::DMatrix flux = make_test_spectrum(wave, 1.);
+    cphot::Filter photon = make_test_filter("photon");
+    cphot::Filter energy = make_test_filter("energy");
+    cphot::TypedFilter<cphot::PhotonCounter> typed_photon(photon);
+    cphot::TypedFilter<cphot::EnergyCounter> typed_energy(
+        energy.get_wavelength(), energy.get_transmission(), nm, "test_triangle");
+    EXPECT_NEAR(typed_energy.get_lpivot().to(nm), energy.get_lpivot().to(nm), 0.);
+    for (const auto mode: {cphot::IntegrationMode::trapezoid,
+                           cphot::IntegrationMode::simpson,
+                           cphot::IntegrationMode::exact_linear}){
+        EXPECT_NEAR(typed_photon.get_flux(wave, flux, nm, flam, mode).to(flam),
+                    photon.get_flux(wave, flux, nm, flam, mode).to(flam), 0.);
+        EXPECT_NEAR(typed_energy.get_flux(wave, flux, nm, flam, mode).to(flam),
+                    energy.get_flux(wave, flux, nm, flam, mode).to(flam), 0.);
+    }
+    cphot::WavelengthGrid grid(wave, nm);
+    EXPECT_NEAR(typed_photon.get_flux(grid, flux, flam).to(flam),
+                photon.get_flux(grid, flux, flam).to(flam), 0.);
+    bool thrown = false;
+    try {
+        cphot::TypedFilter<cphot::PhotonCounter> mismatch(energy);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+
+    // a flux shorter than the wavelength is rejected
+    cphot::DMatrix short_flux = xt::zeros<double>({wave.size() - 1});
+    thrown = false;
+    try {
+        photon.get_flux(wave, short_flux, nm, flam);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+    thrown = false;
+    try {
+        typed_energy.get_flux(wave, short_flux, nm, flam);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+}
+
+/**
+ * @brief Testing single precision spectra and weights against double precision
+ *
+ * Error budget (positive spectra): u = 2^-24 per single precision operand with
+ * double accumulators, plus n u with single precision accumulators.
+ */
+void test_mixed_precision(){
+    const double u = std::ldexp(1., -24);
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 0.7);
+    const size_t n_wave = wave.size();
+    const size_t n_spectra = 3;
+    cphot::DMatrix flux = xt::zeros<double>({n_spectra, n_wave});
+    cphot::FMatrix flux32 = xt::zeros<float>({n_spectra, n_wave});
+    for (size_t s=0; s < n_spectra; ++s){
+        cphot::DMatrix spec = make_test_spectrum(wave, 0.5 * s);
+        for (size_t i=0; i < n_wave; ++i){
+            flux(s, i) = spec[i];
+            flux32(s, i) = static_cast<float>(spec[i]);
+        }
+    }
+    cphot::DMatrix spec = make_test_spectrum(wave, 1.);
+    cphot::FMatrix spec32 = xt::zeros<float>({n_wave});
+    for (size_t i=0; i < n_wave; ++i){
+        spec32[i] = static_cast<float>(spec[i]);
+    }
+    cphot::WavelengthGrid grid(wave, nm);
+
+    std::vector<cphot::Filter> filters {make_test_filter("photon"), make_test_filter("energy")};
+    for (auto& filt: filters){
+        double expected = filt.get_flux(wave, spec, nm, flam).to(flam);
+        EXPECT_NEAR(filt.get_flux(wave, spec32, nm, flam).to(flam), expected, u * expected);
+        EXPECT_NEAR(filt.get_flux(grid, spec32, flam).to(flam), expected, u * expected);
+
+        auto batch = filt.get_flux_batch(wave, flux, nm, flam);
+        auto batch_mixed = filt.get_flux_batch(wave, flux32, nm, flam);
+        auto batch_single = filt.get_flux_batch<cphot::integration::Trapezoid, float>(
+            wave, flux32, nm, flam);
+        for (size_t s=0; s < n_spectra; ++s){
+            double f = batch[s].to(flam);
+            EXPECT_NEAR(batch_mixed[s].to(flam), f, u * f);
+            EXPECT_NEAR(batch_single[s].to(flam), f, (n_wave + 2) * u * f);
+        }
+    }
+
+    cphot::PhotometryMatrix pm(filters, wave, nm);
+    cphot::PhotometryMatrixF pm32(filters, wave, nm);
+    cphot::DMatrix expected = pm.get_flux(flux);
+    cphot::DMatrix mixed = pm32.get_flux(flux32);
+    cphot::FMatrix single = pm32.get_flux<float>(flux32);
+    for (size_t s=0; s < n_spectra; ++s){
+        for (size_t k=0; k < filters.size(); ++k){
+            double f = expected(s, k);
+            EXPECT_NEAR(pm.get_flux(flux32)(s, k), f, u * f);
+            EXPECT_NEAR(mixed(s, k), f, 2 * u * f);
+            EXPECT_NEAR(static_cast<double>(single(s, k)), f, (n_wave + 2) * u * f);
+        }
+    }
+}
+
+/**
+ * @brief Testing photometry on views of existing buffers
+ */
+void test_array_views(){
+    using namespace cphot::integration;
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 1.3);
+    cphot::DMatrix flux = make_test_spectrum(wave, 1.);
+    const size_t n_wave = wave.size();
+    const size_t n_columns = 3;
+    std::vector<double> wave_vector(wave.data(), wave.data() + n_wave);
+    std::vector<double> buffer(n_wave * n_columns, 0.);
+    for (size_t i = 0; i < n_wave; ++i){
+        buffer[i * n_columns + 1] = flux[i];
+    }
+    cphot::ArrayView<double> wave_view(wave_vector);
+    cphot::ArrayView<double> column(buffer.data() + 1, n_wave, n_columns);
+
+    for (const std::string dtype: {"photon", "energy"}){
+        cphot::Filter filt = make_test_filter(dtype);
+        double expected = filt.get_flux(wave, flux, nm, flam).to(flam);
+        EXPECT_NEAR(filt.get_flux(wave_view, cphot::ArrayView<double>(flux), nm, flam).to(flam),
+                    expected, 0.);
+        EXPECT_NEAR(filt.get_flux(wave_view, column, nm, flam).to(flam), expected, 0.);
+        EXPECT_NEAR(filt.get_flux<Simpson>(wave_view, column, nm, flam).to(flam),
+                    filt.get_flux<Simpson>(wave, flux, nm, flam).to(flam), 0.);
+        EXPECT_NEAR(filt.get_flux<ExactLinear>(wave_view, column, nm, flam).to(flam),
+                    filt.get_flux<ExactLinear>(wave, flux, nm, flam).to(flam), 0.);
+        bool thrown = false;
+        try {
+            filt.get_flux(column, column, nm, flam);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+    }
+
+    // accessors share the reference data
+    cphot::Vega vega;
+    EXPECT_NEAR(static_cast<double>(vega.get_flux().data()
+                                    == cphot::get_reference_spectrum("vega")->get_flux().data()),
+                1., 0.);
+}
+
+/**
+ * @brief Testing repeated photometry in several wavelength units
+ */
+void test_wavelength_units(){
+    cphot::Filter filt = make_test_filter("photon");
+    cphot::Filter copy = filt;
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 0.9);
+    cphot::DMatrix flux = make_test_spectrum(wave, 1.);
+    double expected = filt.get_flux(wave, flux, nm, flam).to(flam);
+    // more units than cached, twice, through the filter and its copy
+    const std::vector<QLength> units {angstrom, micrometre, meter, 10 * nm, 0.1 * angstrom, nm};
+    for (size_t pass = 0; pass < 2; ++pass){
+        for (const auto& unit: units){
+            cphot::DMatrix w = wave * nm.to(unit);
+            cphot::Filter& f = (pass == 0) ? filt : copy;
+            EXPECT_NEAR(f.get_flux(w, flux, unit, flam).to(flam), expected, 1e-12 * expected);
+            EXPECT_NEAR(f.get_flux<cphot::integration::ExactLinear>(w, flux, unit, flam).to(flam),
+                        filt.get_flux<cphot::integration::ExactLinear>(wave, flux, nm, flam).to(flam),
+                        1e-12 * expected);
+        }
+    }
+}
+
+/**
+ * @brief Testing that copies of a filter share its data
+ */
+void test_filter_sharing(){
+    cphot::Filter filt = make_test_filter("energy");
+    std::vector<cphot::Filter> copies(100, filt);
+    cphot::Filter moved = std::move(copies.back());
+    for (auto* f: {&copies.front(), &moved}){
+        EXPECT_NEAR(static_cast<double>(&(f->get_wavelength()) == &(filt.get_wavelength())), 1., 0.);
+        EXPECT_NEAR(static_cast<double>(&(f->get_transmission()) == &(filt.get_transmission())), 1., 0.);
+        EXPECT_NEAR(f->get_lpivot().to(nm), filt.get_lpivot().to(nm), 0.);
+        EXPECT_NEAR(f->get_Vega_zero_mag(), filt.get_Vega_zero_mag(), 0.);
+    }
+}
+
+/**
+ * @brief Testing the contiguous storage of filters
+ */
+void test_filter_bank(){
+    cphot::DMatrix box_wave = xt::arange<double>(4000., 6001., 20.);
+    cphot::DMatrix box_trans = xt::zeros<double>({box_wave.size()});
+    for (size_t i = 10; i < 90; ++i){ box_trans[i] = 0.8; }
+    std::vector<cphot::Filter> filters {make_test_filter("photon"),
+                                        make_test_filter("energy"),
+                                        cphot::Filter(box_wave, box_trans, angstrom, "energy", "box")};
+    cphot::FilterBank bank(filters);
+    EXPECT_NEAR(static_cast<double>(bank.size()), 3., 0.);
+    EXPECT_NEAR(static_cast<double>(bank.find("box")), 2., 0.);
+
+    cphot::DMatrix wave = xt::arange<double>(3000., 9000., 7.);
+    cphot::DMatrix flux = make_test_spectrum(wave * 0.1, 1.);
+    auto fluxes = bank.get_flux(wave, flux, angstrom, flam);
+    auto exact = bank.get_flux<cphot::integration::ExactLinear>(wave, flux, angstrom, flam);
+    for (size_t k = 0; k < filters.size(); ++k){
+        auto& filt = filters[k];
+        EXPECT_NEAR(bank.get_lpivot()[k], filt.get_lpivot().to(nm), 0.);
+        EXPECT_NEAR(bank.get_cl()[k], filt.get_cl().to(nm), 0.);
+        EXPECT_NEAR(bank.get_fwhm()[k], filt.get_fwhm().to(nm), 0.);
+        EXPECT_NEAR(bank.get_norm()[k], filt.get_norm(), 0.);
+        EXPECT_NEAR(bank.get_wavelength(k)[3], filt.get_wavelength()[3], 0.);
+        double expected = filt.get_flux(wave, flux, angstrom, flam).to(flam);
+        EXPECT_NEAR(fluxes[k].to(flam), expected, 1e-12 * expected);
+        double expected_exact = filt.get_flux<cphot::integration::ExactLinear>(
+            wave, flux, angstrom, flam).to(flam);
+        EXPECT_NEAR(exact[k].to(flam), expected_exact, 1e-12 * expected_exact);
+        cphot::Filter copy = bank.get_filter(k);
+        EXPECT_NEAR(copy.get_lpivot().to(nm), filt.get_lpivot().to(nm), 0.);
+    }
+
+    // single precision spectra per unit frequency, Simpson rule
+    cphot::FMatrix flux32 = xt::zeros<float>({wave.size()});
+    for (size_t i = 0; i < wave.size(); ++i){
+        flux32[i] = static_cast<float>(flux[i]);
+    }
+    auto fnu = bank.get_flux<cphot::integration::Simpson>(wave, flux32, angstrom, Jy,
+                                                          cphot::FluxDensityType::fnu);
+    for (size_t k = 0; k < filters.size(); ++k){
+        double expected = filters[k].get_flux<cphot::integration::Simpson>(
+            wave, flux32, angstrom, Jy, cphot::FluxDensityType::fnu).to(Jy);
+        EXPECT_NEAR(fnu[k].to(Jy), expected, 1e-12 * expected);
+    }
+
+    bool thrown = false;
+    try {
+        cphot::DMatrix short_flux = xt::zeros<double>({wave.size() - 1});
+        bank.get_flux(wave, short_flux, angstrom, flam);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+}
+
+/**
+ * @brief Testing the cache of the filter resampled on spectrum wavelengths
+ */
+void test_grid_cache(){
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 0.7);
+    cphot::DMatrix flux = make_test_spectrum(wave, 1.);
+    cphot::FMatrix flux32 = xt::zeros<float>({wave.size()});
+    for (size_t i = 0; i < wave.size(); ++i){
+        flux32[i] = static_cast<float>(flux[i]);
+    }
+    // same length and endpoints, one value moved within the filter
+    cphot::DMatrix moved = wave;
+    moved[300] += 0.3;
 
+    for (const std::string dtype: {"photon", "energy"}){
+        cphot::Filter filt = make_test_filter(dtype);
+        cphot::Filter uncached = make_test_filter(dtype);
+        EXPECT_NEAR(static_cast<double>(filt.get_grid_cache_stats().capacity), 0., 0.);
+        filt.set_grid_cache_capacity(8);
+        double expected = uncached.get_flux(wave, flux, nm, flam).to(flam);
+        for (size_t pass = 0; pass < 3; ++pass){
+            EXPECT_NEAR(filt.get_flux(wave, flux, nm, flam).to(flam), expected, 0.);
+        }
+        EXPECT_NEAR(filt.get_flux(wave, flux32, nm, flam).to(flam),
+                    uncached.get_flux(wave, flux32, nm, flam).to(flam), 0.);
+        cphot::GridCacheStats stats = filt.get_grid_cache_stats();
+        EXPECT_NEAR(static_cast<double>(stats.misses), 1., 0.);
+        EXPECT_NEAR(static_cast<double>(stats.hits), 3., 0.);
+        EXPECT_NEAR(static_cast<double>(uncached.get_grid_cache_stats().size), 0., 0.);
 
+        EXPECT_NEAR(filt.get_flux(moved, flux, nm, flam).to(flam),
+                    uncached.get_flux(moved, flux, nm, flam).to(flam), 0.);
+        EXPECT_NEAR(static_cast<double>(filt.get_grid_cache_stats().misses), 2., 0.);
+
+        // the capacity is per handle: a copy without cache leaves the grids to filt
+        cphot::Filter copy = filt;
+        copy.set_grid_cache_capacity(0);
+        EXPECT_NEAR(copy.get_flux(wave, flux, nm, flam).to(flam), expected, 0.);
+        stats = filt.get_grid_cache_stats();
+        EXPECT_NEAR(static_cast<double>(stats.capacity), 8., 0.);
+        EXPECT_NEAR(static_cast<double>(stats.size), 1., 0.);
+        EXPECT_NEAR(static_cast<double>(stats.hits + stats.misses), 5., 0.);
+
+        // the least recently used grid is dropped
+        filt.set_grid_cache_capacity(1);
+        EXPECT_NEAR(filt.get_flux(wave, flux, nm, flam).to(flam), expected, 0.);
+        stats = filt.get_grid_cache_stats();
+        EXPECT_NEAR(static_cast<double>(stats.misses), 3., 0.);
+        EXPECT_NEAR(static_cast<double>(stats.size), 1., 0.);
+
+        filt.clear_grid_cache();
+        stats = filt.get_grid_cache_stats();
+        EXPECT_NEAR(static_cast<double>(stats.hits + stats.misses + stats.size), 0., 0.);
+    }
+}
+
+/**
+ * @brief Testing the photometry matrices stored on disk
+ */
+void test_weights_cache(){
+    namespace fs = std::filesystem;
+    const fs::path directory = fs::temp_directory_path() / "cphot_test_weights_cache";
+    fs::remove_all(directory);
+    std::vector<cphot::Filter> filters {make_test_filter("photon"), make_test_filter("energy")};
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 1.1);
+    cphot::DMatrix flux = make_test_spectrum(wave, 1.);
+    cphot::PhotometryMatrix expected(filters, wave, nm);
+
+    cphot::WeightsCache cache(directory.string());
+    cphot::PhotometryMatrix compiled = cache.get_photometry_matrix(filters, wave, nm);
+    cphot::PhotometryMatrix mapped = cache.get_photometry_matrix(filters, wave, nm);
+    EXPECT_NEAR(static_cast<double>(cache.get_misses()), 1., 0.);
+    EXPECT_NEAR(static_cast<double>(cache.get_hits()), 1., 0.);
+    EXPECT_NEAR(static_cast<double>(mapped.n_nonzero()), static_cast<double>(expected.n_nonzero()), 0.);
+    cphot::DMatrix fluxes = mapped.get_flux(flux);
+    for (size_t k = 0; k < filters.size(); ++k){
+        EXPECT_NEAR(fluxes(0, k), expected.get_flux(flux)(0, k), 0.);
+        EXPECT_NEAR(compiled.get_flux(flux)(0, k), expected.get_flux(flux)(0, k), 0.);
+    }
+
+    // other storage, rule, grid or filters: other files
+    cache.get_photometry_matrix<float>(filters, wave, nm);
+    cache.get_photometry_matrix(filters, wave, nm, cphot::integration::Simpson());
+    cphot::DMatrix moved = wave;
+    moved[10] += 0.01;
+    cache.get_photometry_matrix(filters, moved, nm);
+    filters[1] = make_test_filter("photon");
+    cache.get_photometry_matrix(filters, wave, nm);
+    EXPECT_NEAR(static_cast<double>(cache.get_misses()), 5., 0.);
+
+    // a damaged file is compiled again
+    const std::string path = cache.get_path(cphot::WeightsCache::get_key(filters, wave, nm));
+    fs::resize_file(path, fs::file_size(path) - 8);
+    cphot::PhotometryMatrix rebuilt = cache.get_photometry_matrix(filters, wave, nm);
+    EXPECT_NEAR(static_cast<double>(cache.get_misses()), 6., 0.);
+    EXPECT_NEAR(rebuilt.get_flux(flux)(0, 1), expected.get_flux(flux)(0, 0), 0.);
+
+    // same key but other filters (a collision): the stored hashes do not match
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        const uint64_t other_hash = 42;
+        file.seekp(3 * sizeof(uint64_t));    // magic, version, key, then the hash of the filters
+        file.write(reinterpret_cast<const char*>(&other_hash), sizeof(other_hash));
+    }
+    rebuilt = cache.get_photometry_matrix(filters, wave, nm);
+    EXPECT_NEAR(static_cast<double>(cache.get_misses()), 7., 0.);
+    EXPECT_NEAR(rebuilt.get_flux(flux)(0, 1), expected.get_flux(flux)(0, 0), 0.);
+    cache.get_photometry_matrix(filters, wave, nm);
+    EXPECT_NEAR(static_cast<double>(cache.get_misses()), 7., 0.);
+
+    EXPECT_NEAR(static_cast<double>(cache.clear()), 5., 0.);
+    fs::remove_all(directory);
+}
+
+/**
+ * @brief Testing spectra per unit frequency and in photons
+ */
+void test_flux_density_types(){
+    using cphot::FluxDensityType;
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 0.7);
+    cphot::DMatrix flux = make_test_spectrum(wave, 1.);
+    // same spectrum per unit frequency (Jy) and in photons (arbitrary units)
+    const double lambda2_to_jy = 1e13 / speed_of_light.to(meter / second);
+    cphot::DMatrix fnu = lambda2_to_jy * xt::square(wave * 10.) * flux;
+    cphot::DMatrix photlam = wave * flux;
+    cphot::DMatrix inv_lambda = 1. / wave;
+    cphot::DMatrix inv_lambda2 = xt::square(inv_lambda);
+
+    for (const std::string dtype: {"photon", "energy"}){
+        cphot::Filter filt = make_test_filter(dtype);
+        filt.set_grid_cache_capacity(8);
+        cphot::Filter uncached = make_test_filter(dtype);
+        for (const auto mode: {cphot::IntegrationMode::trapezoid, cphot::IntegrationMode::simpson}){
+            double expected = filt.get_flux(wave, flux, nm, flam, mode).to(flam);
+            double flux_nu = filt.get_flux(wave, fnu, nm, Jy, mode, FluxDensityType::fnu).to(Jy);
+            double flux_phot = filt.get_flux(wave, photlam, nm, flam, mode, FluxDensityType::photlam).to(flam);
+            // <λ^2 f> <λ^-2> = <f> and <λ f> <λ^-1> = <f> with the weights of each type
+            EXPECT_NEAR(flux_nu / lambda2_to_jy / 100. * filt.get_flux(wave, inv_lambda2, nm, flam, mode).to(flam),
+                        expected, 1e-12 * expected);
+            EXPECT_NEAR(flux_phot * filt.get_flux(wave, inv_lambda, nm, flam, mode).to(flam),
+                        expected, 1e-12 * expected);
+            EXPECT_NEAR(uncached.get_flux(wave, fnu, nm, Jy, mode, FluxDensityType::fnu).to(Jy),
+                        flux_nu, 1e-15 * flux_nu);
+        }
+        // pivot wavelength relation of the Jy zero points
+        double expected = filt.get_flux(wave, flux, nm, flam).to(flam);
+        double pivot = filt.get_lpivot().to(angstrom);
+        EXPECT_NEAR(filt.get_flux(wave, fnu, nm, Jy, FluxDensityType::fnu).to(Jy),
+                    lambda2_to_jy * pivot * pivot * expected, 1e-4 * lambda2_to_jy * pivot * pivot * expected);
+
+        std::vector<cphot::Filter> filters {filt};
+        cphot::PhotometryMatrix pm(filters, wave, nm, cphot::integration::Trapezoid(), FluxDensityType::fnu);
+        double flux_nu = filt.get_flux(wave, fnu, nm, Jy, FluxDensityType::fnu).to(Jy);
+        EXPECT_NEAR(pm.get_flux(fnu)(0, 0), flux_nu, 1e-12 * flux_nu);
+    }
+
+    EXPECT_NEAR(static_cast<double>(cphot::parse_flux_density_type("photnu") == FluxDensityType::photnu), 1., 0.);
+    bool thrown = false;
+    try {
+        cphot::parse_flux_density_type("Jy");
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+}
+
+/**
+ * @brief Testing arrays of quantities with deferred units
+ */
+void test_quantity_arrays(){
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 0.7);
+    cphot::DMatrix flux = make_test_spectrum(wave, 1.);
+    cphot::QuantityArray<QLength> wavelength(wave * 10., angstrom);
+    cphot::QuantityArray<QSpectralFluxDensity> spectrum(flux, flam);
+    EXPECT_NEAR(wavelength[3].to(nm), wave[3], 1e-12 * wave[3]);
+    EXPECT_NEAR(wavelength.to(nm)[5], wave[5], 1e-12 * wave[5]);
+
+    // products with scalars only change the unit
+    auto scaled = spectrum * 2.;
+    auto area = wavelength * wavelength[0];
+    EXPECT_NEAR(static_cast<double>(scaled.get_shared_values() == spectrum.get_shared_values()), 1., 0.);
+    EXPECT_NEAR(area[1].to(nanometre * nanometre), wave[1] * wave[0], 1e-9);
+    EXPECT_NEAR((area / wavelength[0]).to(nm)[2], wave[2], 1e-12 * wave[2]);
+
+    cphot::Filter filt = make_test_filter("photon");
+    double expected = filt.get_flux(wave, flux, nm, flam).to(flam);
+    EXPECT_NEAR(filt.get_flux(wavelength, spectrum).to(flam), expected, 1e-12 * expected);
+    EXPECT_NEAR(filt.get_flux(wavelength, scaled).to(flam), 2. * expected, 2e-12 * expected);
+
+    cphot::Vega vega;
+    auto vega_flux = vega.get_flux_quantity();
+    EXPECT_NEAR(static_cast<double>(&vega_flux.get_values() == &vega.get_flux()), 1., 0.);
+    double vega_expected = filt.get_flux(vega.get_wavelength(), vega.get_flux(), nm, flam).to(flam);
+    EXPECT_NEAR(filt.get_flux(vega.get_wavelength_quantity(), vega_flux).to(flam),
+                vega_expected, 1e-12 * vega_expected);
+
+    cphot::Sun sun(2. * au);
+    auto sun_flux = sun.get_flux_quantity();
+    EXPECT_NEAR(sun_flux[100].to(flam), sun.get_flux()[100], 1e-12 * sun.get_flux()[100]);
+
+    bool thrown = false;
+    try {
+        cphot::QuantityArray<QLength> short_wavelength(xt::arange<double>(300., 400., 1.), nm);
+        filt.get_flux(short_wavelength, spectrum);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+}
+
+/**
+ * @brief Testing batch conversions between fluxes and magnitudes
+ */
+void test_magnitudes(){
+    using cphot::MagnitudeSystem;
+    std::vector<cphot::Filter> filters {make_test_filter("photon"), make_test_filter("energy")};
+    cphot::ZeroPoints zp(filters);
+    const size_t n_objects = 37;
+    cphot::DMatrix flux = xt::zeros<double>({n_objects, filters.size()});
+    cphot::DMatrix flux_err = xt::zeros<double>({n_objects, filters.size()});
+    for (size_t i = 0; i < n_objects; ++i){
+        for (size_t k = 0; k < filters.size(); ++k){
+            flux(i, k) = std::pow(10., -20. + 0.37 * i + 0.11 * k) * (1. + 0.013 * i);
+            flux_err(i, k) = 0.05 * flux(i, k);
+        }
+    }
+
+    for (const auto system: {MagnitudeSystem::vega, MagnitudeSystem::ab, MagnitudeSystem::st}){
+        cphot::DMatrix mag = cphot::flux_to_mag(flux, zp, system);
+        for (size_t k = 0; k < filters.size(); ++k){
+            const double zero_mag = zp.get_zero_mags(system)[k];
+            for (size_t i = 0; i < n_objects; ++i){
+                EXPECT_NEAR(mag(i, k), -2.5 * std::log10(flux(i, k)) - zero_mag, 1e-12);
+            }
+        }
+        // fluxes per unit frequency, against the Jy zero points of the filters
+        cphot::DMatrix flux_jy = flux * 1e20;
+        cphot::DMatrix mag_jy = cphot::flux_to_mag(flux_jy, zp, system, Jy, cphot::FluxDensityType::fnu);
+        for (size_t k = 0; k < filters.size(); ++k){
+            const cphot::Filter& filt = filters[k];
+            const double zero_jy = (system == MagnitudeSystem::ab) ? filt.get_AB_zero_Jy().to(Jy)
+                                 : (system == MagnitudeSystem::st) ? filt.get_ST_zero_Jy().to(Jy)
+                                 : filt.get_Vega_zero_Jy().to(Jy);
+            EXPECT_NEAR(mag_jy(5, k), -2.5 * std::log10(flux_jy(5, k) / zero_jy), 1e-10);
+        }
+        cphot::DMatrix back_jy = cphot::mag_to_flux(mag_jy, zp, system, 1e-3 * Jy, cphot::FluxDensityType::fnu);
+        EXPECT_NEAR(back_jy(9, 1), 1e3 * flux_jy(9, 1), 1e-12 * back_jy(9, 1));
+
+        cphot::DMatrix back = cphot::mag_to_flux(mag, zp, system);
+        for (size_t i = 0; i < flux.size(); ++i){
+            EXPECT_NEAR(back.data()[i], flux.data()[i], 1e-14 * flux.data()[i]);
+        }
+
+        auto with_errors = cphot::flux_to_mag(flux, flux_err, zp, system);
+        EXPECT_NEAR(with_errors.values(3, 0), mag(3, 0), 0.);
+        EXPECT_NEAR(with_errors.errors(3, 0), 2.5 / std::log(10.) * 0.05, 1e-15);
+        auto fluxes = cphot::mag_to_flux(with_errors.values, with_errors.errors, zp, system);
+        EXPECT_NEAR(fluxes.errors(7, 1), flux_err(7, 1), 1e-12 * flux_err(7, 1));
+    }
+
+    // every instruction set gives the same values, special values as std::log10
+    std::vector<double> values {0., -1., std::numeric_limits<double>::infinity(), 1e-310, 1., 3.7e12};
+    std::vector<double> offset {0.};
+    std::vector<double> expected(values.size()), result(values.size());
+    cphot::kernels::flux_to_mag(values.data(), nullptr, values.size(), 1, offset.data(),
+                                expected.data(), nullptr, cphot::kernels::SimdLevel::scalar);
+    for (const auto level: {cphot::kernels::SimdLevel::avx2, cphot::kernels::SimdLevel::avx512}){
+        cphot::kernels::flux_to_mag(values.data(), nullptr, values.size(), 1, offset.data(),
+                                    result.data(), nullptr, level);
+        for (size_t i = 0; i < values.size(); ++i){
+            EXPECT_NEAR(static_cast<double>(std::memcmp(&result[i], &expected[i], sizeof(double)) == 0), 1., 0.);
+        }
+    }
+    EXPECT_NEAR(static_cast<double>(std::isinf(expected[0]) && (expected[0] > 0)), 1., 0.);
+    EXPECT_NEAR(static_cast<double>(std::isnan(expected[1])), 1., 0.);
+    EXPECT_NEAR(expected[3], -2.5 * std::log10(1e-310), 1e-12);
+    EXPECT_NEAR(expected[5], -2.5 * std::log10(3.7e12), 1e-12);
+
+    EXPECT_NEAR(static_cast<double>(cphot::parse_magnitude_system("AB") == MagnitudeSystem::ab), 1., 0.);
+    bool thrown = false;
+    try {
+        cphot::DMatrix wrong = xt::zeros<double>({n_objects, size_t(3)});
+        cphot::flux_to_mag(wrong, zp, MagnitudeSystem::vega);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+    thrown = false;
+    try {
+        cphot::flux_to_mag(flux, zp, MagnitudeSystem::ab, flam, cphot::FluxDensityType::photlam);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+}
+
+/**
+ * @brief Testing one filter library shared by several threads
+ *
+ * Meant to run under ThreadSanitizer as well (CPHOT_SANITIZE_THREAD).
+ */
+void test_concurrent_filters(){
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 0.7);
+    cphot::DMatrix wave_aa = wave * 10.;
+    cphot::DMatrix flux = make_test_spectrum(wave, 1.);
+    const size_t n_threads = 8;
+    const size_t n_repeats = 20;
+
+    // every thread computes the same values on the shared (const) library,
+    // starting from empty lazy properties and caches
+    auto compute = [&](const std::vector<cphot::Filter>& library){
+        std::vector<double> values;
+        for (const cphot::Filter& filt: library){
+            values.push_back(filt.get_flux(wave, flux, nm, flam).to(flam));
+            values.push_back(filt.get_flux(wave_aa, flux, angstrom, flam).to(flam));
+            values.push_back(filt.get_flux(wave, flux, nm, flam, cphot::IntegrationMode::simpson).to(flam));
+            values.push_back(filt.get_flux(wave, flux, nm, Jy, cphot::IntegrationMode::trapezoid,
+                                           cphot::FluxDensityType::fnu).to(Jy));
+            values.push_back(filt.get_leff().to(nm));
+            values.push_back(filt.get_Vega_zero_mag());
+            values.push_back(filt.get_AB_zero_mag());
+            values.push_back(filt.get_wavelength(angstrom)[3]);
+        }
+        return values;
+    };
+    auto make_library = [](){
+        std::vector<cphot::Filter> library {make_test_filter("photon"), make_test_filter("energy"),
+                                            make_test_filter("photon").reinterp(xt::arange<double>(390., 611., 1.5))};
+        for (auto& filt: library){
+            filt.set_grid_cache_capacity(8);
+        }
+        return library;
+    };
+
+    const std::vector<double> expected = compute(make_library());
+    const std::vector<cphot::Filter> library = make_library();
+    std::vector<std::vector<double>> results(n_threads * n_repeats);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < n_threads; ++t){
+        threads.emplace_back([&, t](){
+            for (size_t r = 0; r < n_repeats; ++r){
+                results[t * n_repeats + r] = compute(library);
+                if ((t % 4 == 0) && (r % 5 == 0)){
+                    // copies share the caches of the library
+                    cphot::Filter copy = library[r % library.size()];
+                    copy.clear_grid_cache();
+                }
+            }
+        });
+    }
+    for (auto& thread: threads){
+        thread.join();
+    }
+    for (const auto& values: results){
+        for (size_t i = 0; i < expected.size(); ++i){
+            EXPECT_NEAR(values[i], expected[i], 0.);
+        }
+    }
+    EXPECT_NEAR(static_cast<double>(library[0].get_grid_cache_stats().size > 0), 1., 0.);
+}
+
+/**
+ * @brief Testing parallel batch photometry
+ */
+void test_parallel_photometry(){
+    cphot::DMatrix wave = xt::arange<double>(300., 900., 0.7);
+    const size_t n_wave = wave.size();
+    const size_t n_spectra = 37;
+    cphot::DMatrix flux = xt::zeros<double>({n_spectra, n_wave});
+    for (size_t s = 0; s < n_spectra; ++s){
+        cphot::DMatrix spec = make_test_spectrum(wave, 1. + 0.1 * s);
+        std::copy(spec.begin(), spec.end(), flux.begin() + s * n_wave);
+    }
+    const std::vector<cphot::Filter> filters {make_test_filter("photon"), make_test_filter("energy"),
+                                              make_test_filter("photon").reinterp(xt::arange<double>(390., 611., 1.5))};
+
+    // same values as get_flux_batch, bit for bit, whatever the threads and tiles,
+    // and as get_flux up to rounding
+    auto batch_flux = [&](const cphot::Filter& filt, cphot::IntegrationMode mode,
+                          cphot::FluxDensityType flux_type){
+        using namespace cphot::integration;
+        switch (mode){
+            case cphot::IntegrationMode::simpson:
+                return filt.get_flux_batch<Simpson>(wave, flux, nm, Jy, flux_type);
+            case cphot::IntegrationMode::exact_linear:
+                return filt.get_flux_batch<ExactLinear>(wave, flux, nm, Jy, flux_type);
+            default:
+                return filt.get_flux_batch<Trapezoid>(wave, flux, nm, Jy, flux_type);
+        }
+    };
+    for (auto mode: {cphot::IntegrationMode::trapezoid, cphot::IntegrationMode::simpson,
+                     cphot::IntegrationMode::exact_linear}){
+        cphot::PhotometryOptions options;
+        options.mode = mode;
+        options.flux_type = cphot::FluxDensityType::fnu;
+        cphot::DMatrix expected = xt::zeros<double>({n_spectra, filters.size()});
+        for (size_t k = 0; k < filters.size(); ++k){
+            const auto batch = batch_flux(filters[k], mode, options.flux_type);
+            for (size_t s = 0; s < n_spectra; ++s){
+                expected(s, k) = batch[s].to(Jy);
+            }
+        }
+        for (size_t s = 0; s < n_spectra; ++s){
+            cphot::DMatrix spec = xt::zeros<double>({n_wave});
+            std::copy(flux.begin() + s * n_wave, flux.begin() + (s + 1) * n_wave, spec.begin());
+            for (size_t k = 0; k < filters.size(); ++k){
+                const double reference = filters[k].get_flux(wave, spec, nm, Jy, mode, options.flux_type).to(Jy);
+                EXPECT_NEAR(expected(s, k), reference, 1e-12 * std::abs(reference));
+            }
+        }
+        const size_t n_threads[] = {1, 3, 8};
+        const size_t spectra_per_task[] = {0, 1, 5, 100};
+        for (size_t nt: n_threads){
+            for (size_t chunk: spectra_per_task){
+                options.n_threads = nt;
+                options.spectra_per_task = chunk;
+                options.filters_per_task = chunk % 2 + 1;
+                cphot::DMatrix result = cphot::photometry(filters, wave, flux, nm, Jy, options);
+                EXPECT_NEAR(static_cast<double>(result.size()), static_cast<double>(expected.size()), 0.);
+                EXPECT_NEAR(static_cast<double>(std::memcmp(result.data(), expected.data(), expected.size() * sizeof(double)) == 0), 1., 0.);
+            }
+        }
+    }
+
+    // shared pool, reused across calls, and a single spectrum
+    cphot::ThreadPool pool(4);
+    cphot::PhotometryOptions options;
+    options.pool = &pool;
+    cphot::DMatrix first = cphot::photometry(filters, wave, flux, nm, flam, options);
+    cphot::DMatrix second = cphot::photometry(filters, wave, flux, nm, flam, options);
+    EXPECT_NEAR(static_cast<double>(std::memcmp(first.data(), second.data(), first.size() * sizeof(double)) == 0), 1., 0.);
+    cphot::DMatrix single = make_test_spectrum(wave, 1.);
+    cphot::DMatrix one = cphot::photometry(filters, wave, single, nm, flam, options);
+    EXPECT_NEAR(one(0, 1), filters[1].get_flux_batch(wave, single, nm, flam)[0].to(flam), 0.);
+
+    // every task runs once
+    std::vector<int> counts(1000, 0);
+    pool.parallel_for(counts.size(), [&](size_t task){ counts[task] += 1; });
+    for (int count: counts){
+        EXPECT_NEAR(static_cast<double>(count), 1., 0.);
+    }
+
+    // a task may use its own pool: the nested loops run on the calling worker
+    std::vector<cphot::DMatrix> nested(3);
+    std::vector<int> nested_workers(3, 0);
+    pool.parallel_for(nested.size(), [&](size_t task, size_t worker){
+        pool.parallel_for(1, [&](size_t, size_t inner){ nested_workers[task] = (inner == worker); });
+        nested[task] = cphot::photometry(filters, wave, flux, nm, flam, options);
+    });
+    for (size_t task = 0; task < nested.size(); ++task){
+        EXPECT_NEAR(static_cast<double>(nested_workers[task]), 1., 0.);
+        EXPECT_NEAR(static_cast<double>(std::memcmp(nested[task].data(), first.data(), first.size() * sizeof(double)) == 0), 1., 0.);
+    }
+
+    // errors of the tasks and of the input shape reach the caller
+    bool thrown = false;
+    try {
+        pool.parallel_for(100, [](size_t task){
+            if (task == 42){ throw std::runtime_error("task failed"); }
+        });
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+    thrown = false;
+    try {
+        cphot::DMatrix wrong = xt::zeros<double>({n_spectra, n_wave + 1});
+        cphot::photometry(filters, wave, wrong, nm, flam, options);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+}
+
+/**
+ * @brief Testing parallel photometry of spectra on their own wavelength grids
+ */
+void test_ragged_photometry(){
+    std::vector<cphot::Filter> filters {make_test_filter("photon"), make_test_filter("energy"),
+                                        make_test_filter("photon").reinterp(xt::arange<double>(390., 611., 1.5))};
+    // reference values without the grid cache
+    std::vector<cphot::Filter> uncached;
+    for (auto& filt: filters){
+        uncached.push_back(filt.reinterp(filt.get_wavelength()));
+        filt.set_grid_cache_capacity(8);
+    }
+
+    // spectra with different ranges and steps, concatenated
+    const size_t n_spectra = 23;
+    std::vector<cphot::DMatrix> waves, fluxes;
+    std::vector<size_t> offsets {0};
+    for (size_t s = 0; s < n_spectra; ++s){
+        waves.push_back(xt::arange<double>(300. + 7. * s, 880. - 3. * s, 0.5 + 0.13 * s));
+        fluxes.push_back(make_test_spectrum(waves.back(), 1. + 0.1 * s));
+        offsets.push_back(offsets.back() + waves.back().size());
+    }
+    cphot::DMatrix wave = xt::zeros<double>({offsets.back()});
+    cphot::DMatrix flux = xt::zeros<double>({offsets.back()});
+    for (size_t s = 0; s < n_spectra; ++s){
+        std::copy(waves[s].begin(), waves[s].end(), wave.begin() + offsets[s]);
+        std::copy(fluxes[s].begin(), fluxes[s].end(), flux.begin() + offsets[s]);
+    }
+
+    for (auto mode: {cphot::IntegrationMode::trapezoid, cphot::IntegrationMode::simpson,
+                     cphot::IntegrationMode::exact_linear}){
+        cphot::PhotometryOptions options;
+        options.mode = mode;
+        cphot::DMatrix expected = xt::zeros<double>({n_spectra, filters.size()});
+        for (size_t s = 0; s < n_spectra; ++s){
+            for (size_t k = 0; k < filters.size(); ++k){
+                expected(s, k) = uncached[k].get_flux(waves[s], fluxes[s], nm, flam, mode).to(flam);
+                // same definition as the cached get_flux
+                double cached = filters[k].get_flux(waves[s], fluxes[s], nm, flam, mode).to(flam);
+                EXPECT_NEAR(expected(s, k), cached, 1e-12 * std::abs(cached));
+            }
+        }
+        for (auto& filt: filters){
+            filt.clear_grid_cache();
+        }
+        const size_t n_threads[] = {1, 4};
+        const size_t spectra_per_task[] = {0, 3};
+        for (size_t nt: n_threads){
+            for (size_t chunk: spectra_per_task){
+                options.n_threads = nt;
+                options.spectra_per_task = chunk;
+                cphot::DMatrix result = cphot::photometry(filters, wave, flux, offsets, nm, flam, options);
+                EXPECT_NEAR(static_cast<double>(std::memcmp(result.data(), expected.data(), expected.size() * sizeof(double)) == 0), 1., 0.);
+            }
+        }
+    }
+    // the ragged photometry does not fill the grid cache
+    EXPECT_NEAR(static_cast<double>(filters[1].get_grid_cache_stats().size), 0., 0.);
+
+    // a workspace stops allocating once it has seen the longest spectrum
+    cphot::integration::Workspace workspace;
+    filters[0].get_flux<cphot::integration::Simpson>(cphot::ArrayView<double>(waves[0]), cphot::ArrayView<double>(fluxes[0]),
+                                                     nm, flam, cphot::FluxDensityType::flam, workspace);
+    const double* buffer = workspace.weights.data();
+    for (size_t s = 1; s < n_spectra; ++s){
+        double value = filters[0].get_flux<cphot::integration::Simpson>(
+            cphot::ArrayView<double>(waves[s]), cphot::ArrayView<double>(fluxes[s]),
+            nm, flam, cphot::FluxDensityType::flam, workspace).to(flam);
+        EXPECT_NEAR(value, uncached[0].get_flux(waves[s], fluxes[s], nm, flam, cphot::IntegrationMode::simpson).to(flam), 0.);
+    }
+    EXPECT_NEAR(static_cast<double>(workspace.weights.data() == buffer), 1., 0.);
+
+    bool thrown = false;
+    try {
+        std::vector<size_t> wrong {0, 10, offsets.back() - 1};
+        cphot::photometry(filters, wave, flux, wrong, nm, flam);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+    // leading points outside any spectrum
+    thrown = false;
+    try {
+        std::vector<size_t> shifted {1, 10, offsets.back()};
+        cphot::photometry(filters, wave, flux, shifted, nm, flam);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+    // unsorted wavelength within a spectrum
+    thrown = false;
+    try {
+        cphot::DMatrix unsorted = wave;
+        std::swap(unsorted[offsets[1] + 1], unsorted[offsets[1] + 2]);
+        cphot::photometry(filters, unsorted, flux, offsets, nm, flam);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_NEAR(thrown ? 1. : 0., 1., 0.);
+}
 
 int main() {
     std::cout << "Testing units..." << std::endl;
     test_units();
+    std::cout << "Testing batch photometry..." << std::endl;
+    test_batch_flux();
+    std::cout << "Testing photometry matrix..." << std::endl;
+    test_photometry_matrix();
+    std::cout << "Testing reference spectra..." << std::endl;
+    test_reference_spectra();
+    std::cout << "Testing spectrum moment index..." << std::endl;
+    test_spectrum_index();
+    std::cout << "Testing fused kernel..." << std::endl;
+    test_fused_kernel();
+    std::cout << "Testing filter support window..." << std::endl;
+    test_support_window();
+    std::cout << "Testing interpolation..." << std::endl;
+    test_interpolate();
+    std::cout << "Testing wavelength grids..." << std::endl;
+    test_wavelength_grid();
+    std::cout << "Testing exact linear integration..." << std::endl;
+    test_exact_linear();
+    std::cout << "Testing integration policies..." << std::endl;
+    test_integration_policies();
+    std::cout << "Testing typed filters..." << std::endl;
+    test_typed_filter();
+    std::cout << "Testing mixed precision..." << std::endl;
+    test_mixed_precision();
+    std::cout << "Testing array views..." << std::endl;
+    test_array_views();
+    std::cout << "Testing wavelength units..." << std::endl;
+    test_wavelength_units();
+    std::cout << "Testing filter copies..." << std::endl;
+    test_filter_sharing();
+    std::cout << "Testing filter bank..." << std::endl;
+    test_filter_bank();
+    std::cout << "Testing grid cache..." << std::endl;
+    test_grid_cache();
+    std::cout << "Testing weights cache..." << std::endl;
+    test_weights_cache();
+    std::cout << "Testing flux density types..." << std::endl;
+    test_flux_density_types();
+    std::cout << "Testing quantity arrays..." << std::endl;
+    test_quantity_arrays();
+    std::cout << "Testing magnitudes..." << std::endl;
+    test_magnitudes();
+    std::cout << "Testing concurrent filters..." << std::endl;
+    test_concurrent_filters();
+    std::cout << "Testing parallel photometry..." << std::endl;
+    test_parallel_photometry();
+    std::cout << "Testing ragged photometry..." << std::endl;
+    test_ragged_photometry();
     std::cout << "Testing SVO energy filter..." << std::endl;
     test_svo_energy_dtype();
     std::cout << "Testing SVO photon filter..." << std::endl;